@@ -46,6 +46,21 @@ JANSSONPATH_EXPORT jsonpath_t* jsonpath_parse_classical(const char** p_jsonpath_
 // Release the jsonpath. Do nothing to NULL.
 void JANSSONPATH_EXPORT jsonpath_release(jsonpath_t* jsonpath);
 
+// Cache of compiled jsonpaths keyed by text and classical, for hosts evaluating a small set of jsonpaths given as text
+// again and again. It's shared by all threads, and keeps about JANSSONPATH_PATH_CACHE_SIZE(set by CMake) jsonpaths
+// most recently used. Jsonpaths failing to compile, compiled with warnings or longer than 1024 are not cached.
+struct jsonpath_cache_entry_t;
+typedef struct jsonpath_cache_entry_t jsonpath_cache_entry_t;
+// Compile given Null-terminated jsonpath, or get it from the cache. Returns NULL on error.
+// The entry must be released, and its jsonpath stays valid until then even if evicted meanwhile.
+JANSSONPATH_EXPORT jsonpath_cache_entry_t* jsonpath_cache_acquire(const char* jsonpath_begin, bool classical, jsonpath_error_t* error);
+// The compiled jsonpath, shared with other users of the cache: don't release or bind it.
+JANSSONPATH_EXPORT const jsonpath_t* jsonpath_cache_get(const jsonpath_cache_entry_t* entry);
+// Do nothing to NULL.
+void JANSSONPATH_EXPORT jsonpath_cache_release(jsonpath_cache_entry_t* entry);
+// Drop everything cached. Entries acquired stay valid until they are released.
+void JANSSONPATH_EXPORT jsonpath_cache_clear(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -31,7 +31,7 @@ typedef struct jsonpath_result_t {
 #define jsonpath_incref(in) (json_incref((in).value),(in))
 
 // instead of jsonpath_result_release we decref it.
-#define jsonpath_decref(in) json_decref(in.value)
+#define jsonpath_decref(in) json_decref((in).value)
 
 // As a loose constrain, jsonpath_functions should not json_decref or modify its input. (json_incref is allowed)
 // jsonpath_function should return a new reference.
@@ -66,16 +66,181 @@ typedef struct jsonpath_function_lookup_t {
 	};
 }jsonpath_function_lookup_t;
 
+// Variable lookup returns a new reference, or NULL if there's no such variable.
 typedef json_t* (*jsonpath_variable_lookup_t)(const char*);
+// The same with a context, like bind_map of functions, so that symbol tables need not be global.
+typedef json_t* (*jsonpath_variable_lookup_bind_t)(const char*, void*);
+
+typedef enum jsonpath_variable_tag_t{
+	JSONPATH_VARIABLE_PLAIN, JSONPATH_VARIABLE_BIND, JSONPATH_VARIABLE_MAX
+} jsonpath_variable_tag_t;
 
 typedef struct jsonpath_symbol_lookup_t {
 	jsonpath_function_lookup_t function_lookup;
-	jsonpath_variable_lookup_t variable_lookup;
+	// JSONPATH_VARIABLE_PLAIN, the zero value, looks variables up with variable_lookup.
+	jsonpath_variable_tag_t variable_tag;
+	union{
+		jsonpath_variable_lookup_t variable_lookup;
+		struct {
+			jsonpath_variable_lookup_bind_t variable_lookup_bind;
+			void* variable_context;
+		};
+	};
 }jsonpath_symbol_lookup_t;
 
 struct jsonpath_t;
 typedef struct jsonpath_t jsonpath_t;
-JANSSONPATH_EXPORT jsonpath_result_t jsonpath_evaluate(json_t* root, jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// Evaluation does not modify jsonpath, so one compiled jsonpath can be evaluated by multiple threads at once.
+// (Results may share constant nodes between threads, which relies on jansson's atomic reference counting.)
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_evaluate(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+
+// Resolve names of functions and variables called in jsonpath once, rather than at every call while evaluating.
+// Functions are bound to what symbols map them to, and variables to their values by now. Names bound are not looked up
+// any more whatever symbols are given to evaluation; names not found are left to be looked up then.
+// Binding again replaces bindings before, and NULL symbols drops them.
+// Unlike evaluation it modifies jsonpath, so bind before jsonpath is shared by threads. Bytecode compiled afterwards
+// carries the bindings.
+void JANSSONPATH_EXPORT jsonpath_bind(jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols);
+
+// Alternative engine: jsonpath lowered into linear bytecode, run by a stack machine instead of walking the tree.
+// Results are the same with jsonpath_evaluate, and evaluation does not recurse whatever deep the jsonpath is.
+// Bytecode does not refer to the jsonpath compiled from, and it can be shared by threads like jsonpath.
+struct jsonpath_bytecode_t;
+typedef struct jsonpath_bytecode_t jsonpath_bytecode_t;
+// Returns NULL if out of memory.
+JANSSONPATH_EXPORT jsonpath_bytecode_t* jsonpath_bytecode_compile(const jsonpath_t* jsonpath);
+// Release the bytecode. Do nothing to NULL.
+void JANSSONPATH_EXPORT jsonpath_bytecode_release(jsonpath_bytecode_t* bytecode);
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_evaluate_bytecode(json_t* root, const jsonpath_bytecode_t* bytecode, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+
+// Borrowed evaluation mode, for a document read by many threads at once, where taking and dropping references of its
+// nodes would write their reference counts back and forth between cores. Matches which are nodes of root are handed
+// out as borrowed pointers, and evaluation itself takes no reference of them; only right values made while evaluating
+// are owned by the result(json arrays made, like &$.a[*], reference their elements as usual, and so may functions
+// called). root must be kept alive and unchanged until the result is released.
+typedef struct jsonpath_borrowed_t {
+	// The elements of the collection jsonpath_evaluate would give, or its value as the only one(none if it's missing
+	// or evaluation fails). Valid until the result is released.
+	json_t* const* values;
+	size_t size;
+	bool is_collection : 1;
+	bool is_right_value : 1;
+	bool is_constant : 1;
+	// Keeps right values alive, private.
+	void* owner;
+} jsonpath_borrowed_t;
+JANSSONPATH_EXPORT jsonpath_borrowed_t jsonpath_evaluate_borrowed(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+JANSSONPATH_EXPORT jsonpath_borrowed_t jsonpath_evaluate_bytecode_borrowed(json_t* root, const jsonpath_bytecode_t* bytecode, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// Release the result, which is zeroed. Nothing in it may be used afterwards, json_incref what is to be kept.
+void JANSSONPATH_EXPORT jsonpath_borrowed_release(jsonpath_borrowed_t* result);
+
+// One jsonpath evaluated against n documents, results[i] and errors[i] for roots[i] as jsonpath_evaluate gives them.
+// The jsonpath is compiled into bytecode once for the batch, with names of functions and variables looked up in symbols
+// then as jsonpath_bind does, and the stacks of the machine are set up once for each run of documents. Given parallel,
+// documents are split among the threads of jsonpath_set_parallel_filter, so functions called must be thread safe, and
+// reason of an error may be in a buffer of the thread which ran the document, valid until that thread evaluates again.
+void JANSSONPATH_EXPORT jsonpath_evaluate_batch(json_t** roots, size_t n, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_result_t* results, jsonpath_error_t* errors, bool parallel);
+
+// Matches pulled one at a time: the elements of the collection jsonpath_evaluate would give, or its value if that's not
+// a collection. Paths from $ are evaluated lazily, every index taking the next element from the index before it only
+// when asked, so memory does not grow with the number of matches and stopping early skips the rest of the work. Other
+// jsonpaths are evaluated at begin. Steps after a node which is missing are not evaluated, so errors they would raise
+// are not reported. root and jsonpath must be kept alive and unchanged until the iterator ends, and so must symbols.
+struct jsonpath_iter_t;
+typedef struct jsonpath_iter_t jsonpath_iter_t;
+// Returns NULL with error set if evaluation fails before the first match, or out of memory.
+JANSSONPATH_EXPORT jsonpath_iter_t* jsonpath_iter_begin(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// The next match, borrowed until the next call or the end of the iterator(json_incref to keep it). NULL when there's
+// none left, or on error, which ends the iteration.
+JANSSONPATH_EXPORT json_t* jsonpath_iter_next(jsonpath_iter_t* iter, jsonpath_error_t* error);
+// Location of the match jsonpath_iter_next gave last, as a new json array of the keys(strings) and indexes(integers)
+// leading to it from root. It's kept by the iterator as it goes, and costs nothing unless asked for. NULL if the match
+// is not a node of root(like $.a.# or 1 + 1), or the jsonpath is one evaluated at begin.
+JANSSONPATH_EXPORT json_t* jsonpath_iter_location(const jsonpath_iter_t* iter);
+// A location as a new json string, a normalized path like $['store']['book'][3], or a JSON Pointer like /store/book/3.
+JANSSONPATH_EXPORT json_t* jsonpath_location_normalized(const json_t* location);
+JANSSONPATH_EXPORT json_t* jsonpath_location_pointer(const json_t* location);
+// Release the iterator, whether its matches are used up or not. Do nothing to NULL.
+void JANSSONPATH_EXPORT jsonpath_iter_end(jsonpath_iter_t* iter);
+
+// Answers built on the iterator, which stop pulling matches as soon as they are known, so .., filters and ranges are
+// not run to the end. Results are what the matches jsonpath_iter_next gives would make, and on error they are
+// false, NULL or 0 with error set.
+// Whether jsonpath matches anything.
+JANSSONPATH_EXPORT bool jsonpath_exists(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// The first match, as a new reference. NULL if there's none.
+JANSSONPATH_EXPORT json_t* jsonpath_evaluate_first(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// A new json array of the first limit matches at most.
+JANSSONPATH_EXPORT json_t* jsonpath_evaluate_limit(json_t* root, const jsonpath_t* jsonpath, size_t limit, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// How many matches there are, without keeping any of them.
+JANSSONPATH_EXPORT size_t jsonpath_count(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+
+// Matches serialized one by one into a sink as they are pulled from the iterator, without a collection of them or the
+// text of all of them. Each match is dumped like json_dump_callback with flags(JSON_ENCODE_ANY is implied), either as
+// elements of a json array, separated by "," with JSON_COMPACT and ", " without, or one per line. Returns false with
+// error set on failure, text dumped before it is left in the sink. A callback or fd failing gives error 0x700000004,
+// a buffer which can't grow the unknown error.
+typedef enum jsonpath_dump_format_t {
+	JSONPATH_DUMP_ARRAY,
+	JSONPATH_DUMP_LINES
+} jsonpath_dump_format_t;
+// Text handed to callback in pieces, like json_dump_callback. callback returns -1 to stop.
+JANSSONPATH_EXPORT bool jsonpath_dump_callback(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, json_dump_callback_t callback, void* data, size_t flags, jsonpath_dump_format_t format, jsonpath_error_t* error);
+// Text written to fd in blocks.
+JANSSONPATH_EXPORT bool jsonpath_dump_fd(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, int fd, size_t flags, jsonpath_dump_format_t format, jsonpath_error_t* error);
+// Text appended to buffer, which is grown as needed. Start with a zeroed one, and reuse it by setting size to 0. It's
+// not NUL terminated.
+typedef struct jsonpath_buffer_t {
+	char* data;
+	size_t size;
+	size_t capacity;
+} jsonpath_buffer_t;
+JANSSONPATH_EXPORT bool jsonpath_dump_buffer(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_buffer_t* buffer, size_t flags, jsonpath_dump_format_t format, jsonpath_error_t* error);
+// Release memory of buffer, which is zeroed.
+void JANSSONPATH_EXPORT jsonpath_buffer_release(jsonpath_buffer_t* buffer);
+
+// Many jsonpaths evaluated against one document in a single walk. Leading .name, [n], .* and ..name steps shared by
+// jsonpaths starting from $ are taken once for all of them, so pulling many fields out of a document costs about one
+// lookup per distinct step. The plan refers to jsonpaths, which must be kept alive and not be bound again until the
+// plan is released. It can be evaluated by multiple threads at once. Returns NULL if out of memory.
+struct jsonpath_plan_t;
+typedef struct jsonpath_plan_t jsonpath_plan_t;
+JANSSONPATH_EXPORT jsonpath_plan_t* jsonpath_plan_compile(const jsonpath_t* const* jsonpaths, size_t size);
+// Release the plan. Do nothing to NULL.
+void JANSSONPATH_EXPORT jsonpath_plan_release(jsonpath_plan_t* plan);
+// results[i] and errors[i] are what jsonpath_evaluate gives for the i-th jsonpath the plan is compiled from.
+void JANSSONPATH_EXPORT jsonpath_plan_evaluate(json_t* root, const jsonpath_plan_t* plan, jsonpath_symbol_lookup_t* symbols, jsonpath_result_t* results, jsonpath_error_t* errors);
+
+// Streaming engine: jsonpath evaluated while json text is read, without loading the document. Only values matched are
+// built as json_t, everything else is skipped on the fly, so memory used is about the nesting depth plus the size of
+// the matches(and of each element tested by a filter). Accepted are paths from $ made of .name, [n], .*, [*], [from:to]
+// with indexes not counting back, at most one ..name or ..*, and then at most one filter [?()] followed by any indexes.
+// Filters and indexes after them must not refer to $. Other jsonpaths are rejected with a not streamable error.
+// Results are the same as jsonpath_evaluate on the loaded document, except that indexes past the end of an array match
+// nothing instead of the last element, and a name repeated in one object matches every time. Any json value is
+// accepted as the document. The stream refers to jsonpath, which must be kept alive and not be bound again until the
+// stream is released. It can be evaluated by multiple threads at once.
+struct jsonpath_stream_t;
+typedef struct jsonpath_stream_t jsonpath_stream_t;
+// Returns NULL with error set if jsonpath can't be streamed or out of memory.
+JANSSONPATH_EXPORT jsonpath_stream_t* jsonpath_stream_compile(const jsonpath_t* jsonpath, jsonpath_error_t* error);
+// Release the stream. Do nothing to NULL.
+void JANSSONPATH_EXPORT jsonpath_stream_release(jsonpath_stream_t* stream);
+// Json text given in memory.
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_stream_evaluate_buffer(const char* buffer, size_t size, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// Json text read from fd until the end of file.
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_stream_evaluate_fd(int fd, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// Json text given piece by piece by callback, like json_load_callback.
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_stream_evaluate_callback(json_load_callback_t callback, void* data, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+
+// Filters([?()]) over json arrays of at least min_size elements are split into chunks, run by a pool of thread_count
+// threads together with the thread evaluating, and matches are joined in the order of the array. Both engines use it.
+// 0 threads(the default) turns it off, and stops the threads started before.
+// Conditions of such filters are evaluated concurrently, so functions and variable lookups they call must be thread
+// safe, and jansson must count references atomically(2.11 or later). An error is the one of the first element failing,
+// but elements after it may have been evaluated.
+// Not thread safe: call it while nothing is being evaluated. Returns false if threads could not be started.
+JANSSONPATH_EXPORT bool jsonpath_set_parallel_filter(size_t min_size, size_t thread_count);
 
 #ifdef __cplusplus
 }
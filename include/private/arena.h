@@ -0,0 +1,27 @@
+#ifndef JANSSONPATH_ARENA_H
+#define JANSSONPATH_ARENA_H
+#include "common.h"
+
+// bump allocator for short-lived scratch memory, like the tree being built
+// while parsing. there's no way to free a single allocation; everything is
+// freed at once with arena_release.
+
+typedef struct arena_chunk_t arena_chunk_t;
+typedef struct arena_t {
+    arena_chunk_t* head;
+} arena_t;
+
+// memory returned is aligned for any type janssonpath stores
+#define ARENA_ALIGN(size) \
+    (((size) + sizeof(arena_align_t) - 1) / sizeof(arena_align_t) * sizeof(arena_align_t))
+typedef union arena_align_t {
+    void* pointer;
+    long long integer;
+    double real;
+} arena_align_t;
+
+void JANSSONPATH_NO_EXPORT arena_init(arena_t* arena);
+JANSSONPATH_NO_EXPORT void* arena_alloc(arena_t* arena, size_t size);
+void JANSSONPATH_NO_EXPORT arena_release(arena_t* arena);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef JANSSONPATH_COLLECTION_H
+#define JANSSONPATH_COLLECTION_H
+#include "common.h"
+#include "jansson.h"
+
+// intermediate collection of json nodes: a flat vector of borrowed pointers,
+// no reference is taken per element. the nodes are kept alive by the anchors
+// of the collection instead, which are
+//     - values it references: the node its items are children of, or items
+//       computed on the fly(like results of -$..price)
+//     - collections it references: the collection whose items it borrows,
+//       for a path step mapped over every element
+// a collection becomes a real json_array only where the user can see it,
+// unless it's handed out as it is by the borrowed mode. collections never
+// leave one evaluation but to its caller, so the reference count is not atomic.
+
+typedef struct collection_anchor_t collection_anchor_t;
+
+typedef struct collection_t {
+	size_t refcount;
+	json_t** items;
+	size_t size;
+	size_t capacity;
+	collection_anchor_t* anchors;
+	size_t anchor_size;
+	size_t anchor_capacity;
+} collection_t;
+
+// capacity is only a hint, the collection grows when needed
+JANSSONPATH_NO_EXPORT collection_t* collection_new(size_t capacity);
+JANSSONPATH_NO_EXPORT collection_t* collection_incref(collection_t* collection);
+void JANSSONPATH_NO_EXPORT collection_decref(collection_t* collection);
+
+// item is borrowed, it must be kept alive by some anchor of the collection
+void JANSSONPATH_NO_EXPORT collection_append(collection_t* collection, json_t* item);
+// steals reference to item. NULL is ignored.
+void JANSSONPATH_NO_EXPORT collection_append_new(collection_t* collection, json_t* item);
+// steals reference to value, which is released together with the collection
+void JANSSONPATH_NO_EXPORT collection_anchor_value(collection_t* collection, json_t* value);
+// references parent until the collection is released
+void JANSSONPATH_NO_EXPORT collection_anchor_parent(collection_t* collection, collection_t* parent);
+// items of other are appended, and its anchors are shared. other is released.
+void JANSSONPATH_NO_EXPORT collection_merge(collection_t* collection, collection_t* other);
+
+// new json_array referencing every item
+JANSSONPATH_NO_EXPORT json_t* collection_to_array(const collection_t* collection);
+
+#endif
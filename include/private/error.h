@@ -5,6 +5,7 @@ jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_unknown;
 JANSSONPATH_NO_EXPORT jsonpath_error_t jsonpath_error_nullptr;
 jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_to_array_non_collection;
 jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_from_array_collection;
+jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_collection_oprand;
 
 JANSSONPATH_NO_EXPORT jsonpath_error_t
 jsonpath_error_eof_escape(const char* position);
@@ -17,4 +18,10 @@ jsonpath_error_function_not_found(const char* function_name);
 jsonpath_error_t JANSSONPATH_NO_EXPORT
 json_error_unmatched_bracked(const char* position);
 jsonpath_error_t JANSSONPATH_NO_EXPORT
-json_error_expecting_index(const char* position);
\ No newline at end of file
+json_error_expecting_index(const char* position);
+JANSSONPATH_NO_EXPORT jsonpath_error_t
+jsonpath_error_not_streamable(const char* reason);
+JANSSONPATH_NO_EXPORT jsonpath_error_t
+jsonpath_error_malformed_json(const char* reason);
+jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_read_failed;
+jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_write_failed;
@@ -0,0 +1,104 @@
+#ifndef EVALUATE_IMPL_H
+#define EVALUATE_IMPL_H
+
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/collection.h"
+#include "private/jsonpath_ast.h"
+
+// building blocks shared by the tree walker(evaluate.c) and the bytecode
+// machine(bytecode.c). they work on values already evaluated, so both engines
+// get exactly the same semantic for free.
+
+// jsonpath_result_t used while evaluating. collection is a collection_t rather than a json_array, and it's turned
+// into one by result_export when handed to the user.
+typedef struct result_t {
+	union {
+		json_t* value;
+		collection_t* collection; // if is_collection
+	};
+	bool is_collection : 1;
+	bool is_right_value : 1;
+	bool is_constant : 1;
+	// value is not referenced by the result, it's a node of the document, or an element(or descendant of it) of the
+	// collection being mapped, and it's kept alive by the caller or by that collection.
+	bool is_borrowed : 1;
+} result_t;
+
+JANSSONPATH_NO_EXPORT result_t make_result_new(json_t* value, bool is_right_value, bool is_constant);
+JANSSONPATH_NO_EXPORT result_t make_result_borrow(json_t* value, bool is_right_value, bool is_constant);
+JANSSONPATH_NO_EXPORT result_t make_result_collection(collection_t* collection, bool is_right_value, bool is_constant);
+// new reference, never borrowed
+JANSSONPATH_NO_EXPORT result_t result_incref(result_t in);
+#define result_decref(in) ((in).is_collection ? collection_decref((in).collection) : (in).is_borrowed ? (void)0 : json_decref((in).value))
+// another reference to in, a borrowed value stays borrowed: whoever lends it outlives every copy
+#define result_share(in) ((in).is_borrowed ? (in) : result_incref(in))
+// in is released
+JANSSONPATH_NO_EXPORT jsonpath_result_t result_export(result_t in);
+// in is released, borrowed nodes stay borrowed
+JANSSONPATH_NO_EXPORT jsonpath_borrowed_t result_export_borrowed(result_t in);
+
+typedef struct jsonpath_callable_t {
+	jsonpath_callable_tag_t tag;
+	union {
+		jsonpath_callable_bind_t bind;
+		jsonpath_callable_plain_t plain;
+	};
+} jsonpath_callable_t;
+
+struct jsonpath_symbol_t {
+	enum { SYMBOL_CALLABLE, SYMBOL_VARIABLE, SYMBOL_MAX } tag;
+	union {
+		jsonpath_callable_t callable;
+		json_t* variable;
+	};
+};
+
+JANSSONPATH_NO_EXPORT jsonpath_symbol_t get_symbol(jsonpath_symbol_lookup_t* symbols, const char* name);
+// new reference, for symbols bound which are kept by the jsonpath
+JANSSONPATH_NO_EXPORT jsonpath_symbol_t symbol_incref(jsonpath_symbol_t symbol);
+JANSSONPATH_NO_EXPORT json_t* evaluate_symbol(jsonpath_symbol_t symbol, json_t** args, size_t arg_n);
+void JANSSONPATH_NO_EXPORT release_symbol(jsonpath_symbol_t symbol);
+// drop the binding of a function call
+void JANSSONPATH_NO_EXPORT unbind_symbol(path_arbitrary_t* arbitrary);
+
+// collection for results derived from node(its children, or results of each element of it), which keeps
+// node alive as long as it's needed
+JANSSONPATH_NO_EXPORT collection_t* derived_collection(result_t node, size_t capacity);
+
+// index of the element [index] takes from an array of array_size elements, counting back if minus and clamped to
+// the last one. for empty array it returns -1
+JANSSONPATH_NO_EXPORT long long json_array_index_translate(json_int_t index, size_t array_size);
+// simple index(identifier, number, * or #) to a single node. node borrowed gives results borrowed as well.
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_simple_index(result_t node, json_t* simple_index);
+// ..simple_index to a single node
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_recursive(result_t node, json_t* simple_index);
+// the same, but matches are appended to a collection already there
+void JANSSONPATH_NO_EXPORT recursive_accumulate(result_t* ret, result_t node, json_t* simple_index);
+// [(expression)] to a single node, given value of expression. sub_exp_result is released.
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_sub_exp(result_t node, result_t sub_exp_result, jsonpath_error_t* error);
+// [from:to] to a single node which is a json array, given value of from and to(NULL value if omitted)
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_range(result_t node, result_t from, result_t to);
+// [first, last] of an array of array_size elements taken by [from:to], first > last if none. returns false if a bound
+// is not a number.
+JANSSONPATH_NO_EXPORT bool range_bounds(size_t array_size, result_t from, result_t to, long long* first, long long* last);
+// one index of a path applied to node, with $ in it being root. node is not released.
+JANSSONPATH_NO_EXPORT result_t evaluate_path_index(json_t* root, result_t node, path_index_t index, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// condition of a filter for one element, with @ being element and $ being root
+JANSSONPATH_NO_EXPORT result_t evaluate_condition(json_t* root, json_t* element, const jsonpath_t* expression, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+// whether cond of a filter keeps the element. cond is released. returns false on error.
+JANSSONPATH_NO_EXPORT bool filter_test(result_t cond, bool* keep, jsonpath_error_t* error);
+// keep value in filter result if cond is true. cond is released. returns false on error.
+JANSSONPATH_NO_EXPORT bool filter_accumulate(result_t* ret, json_t* value, result_t cond, jsonpath_error_t* error);
+// merge result of an index applied to one element of a collection into ret. mapped_element is released.
+void JANSSONPATH_NO_EXPORT collection_accumulate(result_t* ret, result_t mapped_element);
+
+// regex is the pattern of =~ compiled ahead, or NULL
+JANSSONPATH_NO_EXPORT result_t binary_deal_with_collection(path_binary_tag_t operator_, result_t lhs, result_t rhs, jsonpath_regex_t* regex, jsonpath_error_t* error);
+// && and || whose value is decided by lhs alone, like in C. returns true with the result in decided if rhs needs
+// not to be evaluated. lhs is not released.
+JANSSONPATH_NO_EXPORT bool logical_short_circuit(path_binary_tag_t operator_, result_t lhs, result_t* decided);
+JANSSONPATH_NO_EXPORT result_t evaluate_unary(path_unary_tag_t op, result_t oprand, jsonpath_error_t* error);
+
+#endif
@@ -3,10 +3,6 @@
 
 #include "jansson.h"
 
-#ifdef JANSSONPATH_CONSTANT_FOLD
-#include "janssonpath_evaluate.h"
-#endif
-
 // structures below are not visiable external. in interface there's only
 // jsonpath_t*.
 
@@ -93,22 +89,30 @@ typedef enum path_binary_tag_t {
 #endif
     BINARY_MAX
 } path_binary_tag_t;
+// compiled regular expression, see regex_impl.h
+typedef struct jsonpath_regex_t jsonpath_regex_t;
 typedef struct path_binary_t {
     path_binary_tag_t tag;
     jsonpath_t* lhs;
     jsonpath_t* rhs;
+    // =~ with a literal pattern, compiled once by jsonpath_optimize. NULL otherwise.
+    jsonpath_regex_t* regex;
 } path_binary_t;
 
 typedef enum path_arbitrary_tag_t {
     // function call | // should we support to form JSON nodes in janssonpath?
     ARB_FUNC
 } path_arbitrary_tag_t;
+// function or variable a name resolves to, see evaluate_impl.h
+typedef struct jsonpath_symbol_t jsonpath_symbol_t;
 typedef struct path_arbitrary_t {
     path_arbitrary_tag_t tag;
     json_t* func_name;  // should be json_string
     jsonpath_t** nodes;
     size_t size;
     size_t capacity;
+    // func_name resolved by jsonpath_bind. NULL if not bound.
+    jsonpath_symbol_t* symbol;
 } path_arbitrary_t;
 
 typedef enum path_single_tag_t {
@@ -130,9 +134,6 @@ typedef enum jsonpath_tag_t {
     JSON_UNARY,
     JSON_BINARY,
     JSON_ARBITRAY,
-#ifdef JANSSONPATH_CONSTANT_FOLD
-    JSON_CONSTANT,
-#endif
     JSON_MAX
 } jsonpath_tag_t;
 struct jsonpath_t {
@@ -144,12 +145,16 @@ struct jsonpath_t {
         path_unary_t unary;
         path_binary_t binary;
         path_arbitrary_t arbitrary;
-#ifdef JANSSONPATH_CONSTANT_FOLD
-        jsonpath_result_t constant_result;
-#endif
     };
 };
+// nodes are never modified after compilation(except by jsonpath_bind) so that
+// one jsonpath_t can be evaluated by many threads at once.
+// a compiled jsonpath is a single block of memory, with the root node at its
+// beginning and every node placed right after its parent.
 
+// drop references to json_t held by the tree, memory of nodes is not freed.
 void JANSSONPATH_NO_EXPORT jsonpath_release_no_free(jsonpath_t* jsonpath);
+// optimization passes(constant folding, precompiling regular expressions) run at the end of compilation.
+void JANSSONPATH_NO_EXPORT jsonpath_optimize(jsonpath_t* jsonpath);
 
 #endif
\ No newline at end of file
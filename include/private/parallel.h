@@ -0,0 +1,32 @@
+#ifndef JANSSONPATH_PARALLEL_H
+#define JANSSONPATH_PARALLEL_H
+
+#include "jansson.h"
+#include "private/common.h"
+#include "private/evaluate_impl.h"
+
+// loops split into chunks, run by the pool set up with jsonpath_set_parallel_filter and by the thread evaluating.
+// [?()] over large json arrays is one, both engines hand the condition in as a predicate so they share the merge.
+
+// body of a loop for indexes [begin, end), chunk is the index of the chunk. returns false on failure, chunks after
+// it are not started then. called concurrently.
+typedef bool (*parallel_body_t)(void* context, size_t chunk, size_t begin, size_t end);
+// first index of a chunk, chunks differ in size by one at most
+#define PARALLEL_CHUNK_BEGIN(size, chunk_n, chunk) \
+	((size) / (chunk_n) * (chunk) + ((size) % (chunk_n) < (chunk) ? (size) % (chunk_n) : (chunk)))
+// how many chunks size indexes are split into
+JANSSONPATH_NO_EXPORT size_t parallel_chunk_count(size_t size);
+// run body over [0, size) split into chunk_n chunks. returns the first chunk failing, or chunk_n if none. chunks
+// before it have all been run.
+JANSSONPATH_NO_EXPORT size_t parallel_for(size_t size, size_t chunk_n, parallel_body_t body, void* context);
+
+// condition of the filter for one element, result_t owned by the caller. called concurrently.
+typedef result_t (*parallel_predicate_t)(void* context, json_t* element, jsonpath_error_t* error);
+
+// whether filtering an array of size elements is worth the pool
+JANSSONPATH_NO_EXPORT bool parallel_filter_wanted(size_t size);
+// the same as filter_accumulate for every element of array in order, ret is a collection. returns false on error,
+// which is the error of the first element failing.
+JANSSONPATH_NO_EXPORT bool parallel_filter(result_t* ret, json_t* array, parallel_predicate_t predicate, void* context, jsonpath_error_t* error);
+
+#endif
@@ -5,6 +5,7 @@
 #include "janssonpath_error.h"
 #include "private/error.h"
 #include "private/jansson_memory.h"
+#include "private/jsonpath_ast.h"
 
 // =~ is sub-match. If you want to make a full match, consider using ^ $ in
 // single line case
@@ -38,4 +39,17 @@ JANSSONPATH_NO_EXPORT bool regex_match(const char* subject,
 
 JANSSONPATH_NO_EXPORT jansson_regex_t* regex_compile(const char* pattern,
 	jsonpath_error_t* error);
+
+// jsonpath_regex_t is a compiled pattern shared by reference counting. patterns
+// compiled are kept in a LRU cache of JANSSONPATH_REGEX_CACHE_SIZE patterns, which
+// is shared by all threads.
+
+// new reference to the pattern, compiled only if it's not in the cache
+JANSSONPATH_NO_EXPORT jsonpath_regex_t* regex_acquire(const char* pattern,
+	jsonpath_error_t* error);
+JANSSONPATH_NO_EXPORT jsonpath_regex_t* regex_incref(jsonpath_regex_t* regex);
+void JANSSONPATH_NO_EXPORT regex_release(jsonpath_regex_t* regex);
+JANSSONPATH_NO_EXPORT bool regex_test(const char* subject,
+	const jsonpath_regex_t* regex);
+
 #endif
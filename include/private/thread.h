@@ -0,0 +1,56 @@
+#ifndef JANSSONPATH_THREAD_H
+#define JANSSONPATH_THREAD_H
+
+// just enough of threads for state shared by every thread, like caches.
+// mutexes are statically initialized, so there's nothing to set up or tear down.
+// JSONPATH_THREAD_LOCAL is for buffers handed out to the caller, like messages in jsonpath_error_t.
+// tls keys are for per thread scratch which must be released when the thread exits, the destructor
+// is declared as void JSONPATH_TLS_CALLBACK destructor(void*).
+// threads are for the pool of parallel filters, the function is declared as
+// JSONPATH_THREAD_PROC function(void*) and returns 0.
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK jsonpath_mutex_t;
+#define JSONPATH_MUTEX_INITIALIZER SRWLOCK_INIT
+#define mutex_lock(mutex) AcquireSRWLockExclusive(mutex)
+#define mutex_unlock(mutex) ReleaseSRWLockExclusive(mutex)
+typedef DWORD jsonpath_tls_key_t;
+#define JSONPATH_TLS_CALLBACK WINAPI
+#define tls_key_create(key, destructor) ((*(key) = FlsAlloc(destructor)) != FLS_OUT_OF_INDEXES)
+#define tls_set(key, value) (FlsSetValue((key), (value)) != 0)
+typedef CONDITION_VARIABLE jsonpath_cond_t;
+#define JSONPATH_COND_INITIALIZER CONDITION_VARIABLE_INIT
+#define cond_wait(cond, mutex) SleepConditionVariableSRW((cond), (mutex), INFINITE, 0)
+#define cond_broadcast(cond) WakeAllConditionVariable(cond)
+typedef HANDLE jsonpath_thread_t;
+#define JSONPATH_THREAD_PROC DWORD WINAPI
+#define thread_create(thread, function, argument) ((*(thread) = CreateThread(NULL, 0, (function), (argument), 0, NULL)) != NULL)
+#define thread_join(thread) (WaitForSingleObject((thread), INFINITE), CloseHandle(thread))
+#else
+#include <pthread.h>
+typedef pthread_mutex_t jsonpath_mutex_t;
+#define JSONPATH_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define mutex_lock(mutex) pthread_mutex_lock(mutex)
+#define mutex_unlock(mutex) pthread_mutex_unlock(mutex)
+typedef pthread_key_t jsonpath_tls_key_t;
+#define JSONPATH_TLS_CALLBACK
+#define tls_key_create(key, destructor) (pthread_key_create((key), (destructor)) == 0)
+#define tls_set(key, value) (pthread_setspecific((key), (value)) == 0)
+typedef pthread_cond_t jsonpath_cond_t;
+#define JSONPATH_COND_INITIALIZER PTHREAD_COND_INITIALIZER
+#define cond_wait(cond, mutex) pthread_cond_wait((cond), (mutex))
+#define cond_broadcast(cond) pthread_cond_broadcast(cond)
+typedef pthread_t jsonpath_thread_t;
+#define JSONPATH_THREAD_PROC void*
+#define thread_create(thread, function, argument) (pthread_create((thread), NULL, (function), (argument)) == 0)
+#define thread_join(thread) pthread_join((thread), NULL)
+#endif
+
+#ifdef _MSC_VER
+#define JSONPATH_THREAD_LOCAL __declspec(thread)
+#else
+#define JSONPATH_THREAD_LOCAL __thread
+#endif
+
+#endif
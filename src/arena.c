@@ -0,0 +1,41 @@
+#include "private/arena.h"
+#include "private/jansson_memory.h"
+
+// a node of the parsed tree is 32 bytes or so, most jsonpath fit in one chunk
+static const size_t arena_chunk_size_default = 1024;
+
+struct arena_chunk_t {
+    arena_chunk_t* next;
+    size_t size;
+    size_t used;
+    arena_align_t data[];
+};
+
+void JANSSONPATH_NO_EXPORT arena_init(arena_t* arena) { arena->head = NULL; }
+
+JANSSONPATH_NO_EXPORT void* arena_alloc(arena_t* arena, size_t size) {
+    size = ARENA_ALIGN(size);
+    arena_chunk_t* chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > arena_chunk_size_default ? size : arena_chunk_size_default;
+        chunk = do_malloc(sizeof(arena_chunk_t) + chunk_size);
+        if (!chunk) return NULL;
+        chunk->next = arena->head;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->head = chunk;
+    }
+    void* ret = (char*)chunk->data + chunk->used;
+    chunk->used += size;
+    return ret;
+}
+
+void JANSSONPATH_NO_EXPORT arena_release(arena_t* arena) {
+    arena_chunk_t* chunk = arena->head;
+    while (chunk) {
+        arena_chunk_t* next = chunk->next;
+        do_free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+}
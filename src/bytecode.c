@@ -0,0 +1,839 @@
+#include <string.h>
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+#include "private/jsonpath_ast.h"
+#include "private/evaluate_impl.h"
+#include "private/arena.h"
+#include "private/parallel.h"
+#ifdef JANSSONPATH_SUPPORT_REGEX
+#include "private/regex_impl.h"
+#endif
+
+// jsonpath lowered into linear code of a stack machine. every node leaves exactly one value on the value stack.
+// what the tree walker keeps in C stack frames(the $ and @ in scope, the collection being mapped, the function
+// being called) lives in an explicit control stack here, so evaluation does not recurse at all.
+//
+// a path $.a[(exp)] is lowered into
+//     <$>  DUP  STEP "a"  MAP_BEGIN  L: MAP_NEXT end  <exp>  SUB_EXP  JUMP L  end: MAP_END  NIP
+// the copy of $ made by DUP stays under the path being indexed, it's the $ inside of indexes.
+
+typedef enum opcode_t {
+	OP_ROOT,            // push $
+	OP_CURR,            // push @
+	OP_CONST,           // push constants[operand]
+	OP_OMITTED,         // push omitted part of [from:to]
+	OP_DUP,             // push top again
+	OP_NIP,             // drop the value under top
+	OP_UNARY,           // operand is path_unary_tag_t
+	OP_BINARY,          // operand is path_binary_tag_t
+	OP_REGEX,           // =~ with the pattern compiled ahead, regexes[operand]
+	OP_AND_THEN,        // if lhs on top decides &&, replace it with the result and jump to operand
+	OP_OR_ELSE,         // the same for ||
+	OP_CALL_BEGIN,      // look up function named constants[operand]
+	OP_CALL_BOUND,      // begin a call to the function bound ahead, symbols[operand]
+	OP_ARG,             // check the argument just pushed
+	OP_CALL,            // call with operand arguments on the stack
+	OP_STEP,            // index top with simple index constants[operand]
+	OP_STEP_RECURSIVE,  // index top with ..constants[operand]
+	OP_MAP_BEGIN,       // pop a value, apply following index to it(or each of its element for collection)
+	OP_MAP_NEXT,        // move to next element, jump to operand after the last one
+	OP_MAP_END,         // push the mapped result
+	OP_SUB_EXP,         // index current element with value of [(expression)]
+	OP_RANGE_CHECK,     // skip current element which is not an array, jump to operand
+	OP_RANGE_ARG,       // check the range bound just pushed
+	OP_RANGE,           // slice current element with the range bounds pushed
+	OP_FILTER_BEGIN,    // filter children of current element
+	OP_FILTER_NEXT,     // move @ to next child, jump to operand after the last one
+	OP_FILTER_TEST,     // keep @ if the condition pushed is true
+	OP_FILTER_END,      // the filtered array is the result of current element
+	OP_JUMP,
+	OP_MAX
+} opcode_t;
+
+typedef struct instruction_t {
+	opcode_t op;
+	unsigned operand;
+} instruction_t;
+
+struct jsonpath_bytecode_t {
+	instruction_t* code;
+	size_t size;
+	json_t** constants;
+	size_t constant_size;
+	jsonpath_regex_t** regexes;
+	size_t regex_size;
+	jsonpath_symbol_t* symbols; // bound by jsonpath_bind
+	size_t symbol_size;
+	// deepest the stacks can grow, known at lowering
+	size_t max_values;
+	size_t max_controls;
+};
+
+// change to depth of stacks by each instruction. OP_CALL pops its arguments additionally.
+static const int value_effect[OP_MAX] = {
+	[OP_ROOT] = 1, [OP_CURR] = 1, [OP_CONST] = 1, [OP_OMITTED] = 1, [OP_DUP] = 1, [OP_NIP] = -1,
+	[OP_BINARY] = -1, [OP_REGEX] = -1, [OP_CALL] = 1, [OP_MAP_BEGIN] = -1, [OP_MAP_END] = 1,
+	[OP_SUB_EXP] = -1, [OP_RANGE] = -2, [OP_FILTER_TEST] = -1,
+};
+static const int control_effect[OP_MAX] = {
+	[OP_CALL_BEGIN] = 1, [OP_CALL_BOUND] = 1, [OP_CALL] = -1, [OP_MAP_BEGIN] = 1, [OP_MAP_END] = -1,
+	[OP_FILTER_BEGIN] = 1, [OP_FILTER_END] = -1,
+};
+
+typedef struct builder_t {
+	arena_t arena;
+	instruction_t* code;
+	size_t size;
+	size_t capacity;
+	json_t** constants;
+	size_t constant_size;
+	size_t constant_capacity;
+	jsonpath_regex_t** regexes;
+	size_t regex_size;
+	size_t regex_capacity;
+	jsonpath_symbol_t* symbols;
+	size_t symbol_size;
+	size_t symbol_capacity;
+	size_t values;
+	size_t max_values;
+	size_t controls;
+	size_t max_controls;
+	jsonpath_symbol_lookup_t* bind; // names not bound in the jsonpath are looked up here while lowering, if not NULL
+	bool failed;
+} builder_t;
+
+static size_t emit(builder_t* builder, opcode_t op, size_t operand) {
+	if (builder->size + 1 > builder->capacity) {
+		size_t capacity = builder->capacity ? builder->capacity * 2 : 32;
+		instruction_t* code = arena_alloc(&builder->arena, sizeof(instruction_t) * capacity);
+		if (!code) {
+			builder->failed = true;
+			return 0;
+		}
+		if (builder->size) memcpy(code, builder->code, sizeof(instruction_t) * builder->size);
+		builder->code = code;
+		builder->capacity = capacity;
+	}
+	instruction_t instruction = { op, (unsigned)operand };
+	builder->code[builder->size] = instruction;
+
+	builder->values += value_effect[op];
+	if (op == OP_CALL) builder->values -= operand;
+	if (builder->values > builder->max_values) builder->max_values = builder->values;
+	builder->controls += control_effect[op];
+	if (builder->controls > builder->max_controls) builder->max_controls = builder->controls;
+	return builder->size++;
+}
+
+// point jump of the instruction to the next one emitted
+static void patch(builder_t* builder, size_t at) {
+	if (builder->failed) return;
+	builder->code[at].operand = (unsigned)builder->size;
+}
+
+static size_t add_constant(builder_t* builder, json_t* constant) {
+	if (builder->constant_size + 1 > builder->constant_capacity) {
+		size_t capacity = builder->constant_capacity ? builder->constant_capacity * 2 : 8;
+		json_t** constants = arena_alloc(&builder->arena, sizeof(json_t*) * capacity);
+		if (!constants) {
+			builder->failed = true;
+			return 0;
+		}
+		if (builder->constant_size) memcpy(constants, builder->constants, sizeof(json_t*) * builder->constant_size);
+		builder->constants = constants;
+		builder->constant_capacity = capacity;
+	}
+	builder->constants[builder->constant_size] = json_incref(constant);
+	return builder->constant_size++;
+}
+
+#ifdef JANSSONPATH_SUPPORT_REGEX
+static size_t add_regex(builder_t* builder, jsonpath_regex_t* regex) {
+	if (builder->regex_size + 1 > builder->regex_capacity) {
+		size_t capacity = builder->regex_capacity ? builder->regex_capacity * 2 : 4;
+		jsonpath_regex_t** regexes = arena_alloc(&builder->arena, sizeof(jsonpath_regex_t*) * capacity);
+		if (!regexes) {
+			builder->failed = true;
+			return 0;
+		}
+		if (builder->regex_size) memcpy(regexes, builder->regexes, sizeof(jsonpath_regex_t*) * builder->regex_size);
+		builder->regexes = regexes;
+		builder->regex_capacity = capacity;
+	}
+	builder->regexes[builder->regex_size] = regex_incref(regex);
+	return builder->regex_size++;
+}
+#endif
+
+static size_t add_symbol(builder_t* builder, jsonpath_symbol_t symbol) {
+	if (builder->symbol_size + 1 > builder->symbol_capacity) {
+		size_t capacity = builder->symbol_capacity ? builder->symbol_capacity * 2 : 4;
+		jsonpath_symbol_t* symbols = arena_alloc(&builder->arena, sizeof(jsonpath_symbol_t) * capacity);
+		if (!symbols) {
+			builder->failed = true;
+			return 0;
+		}
+		if (builder->symbol_size) memcpy(symbols, builder->symbols, sizeof(jsonpath_symbol_t) * builder->symbol_size);
+		builder->symbols = symbols;
+		builder->symbol_capacity = capacity;
+	}
+	builder->symbols[builder->symbol_size] = symbol_incref(symbol);
+	return builder->symbol_size++;
+}
+
+static void lower(builder_t* builder, const jsonpath_t* jsonpath);
+
+static void lower_map(builder_t* builder, const path_index_t* index) {
+	emit(builder, OP_MAP_BEGIN, 0);
+	size_t next = emit(builder, OP_MAP_NEXT, 0);
+	switch (index->tag) {
+	case INDEX_SUB_EXP:
+		lower(builder, index->expression);
+		emit(builder, OP_SUB_EXP, 0);
+		break;
+	case INDEX_SUB_RANGE: {
+		emit(builder, OP_RANGE_CHECK, next);
+		size_t i;
+		for (i = 0; i < 2; ++i) {
+			if (index->range[i]) {
+				lower(builder, index->range[i]);
+				emit(builder, OP_RANGE_ARG, 0);
+			} else {
+				emit(builder, OP_OMITTED, 0);
+			}
+		}
+		emit(builder, OP_RANGE, 0);
+		break;
+	}
+	case INDEX_FILTER: {
+		emit(builder, OP_FILTER_BEGIN, 0);
+		size_t child = emit(builder, OP_FILTER_NEXT, 0);
+		lower(builder, index->expression);
+		emit(builder, OP_FILTER_TEST, 0);
+		emit(builder, OP_JUMP, child);
+		patch(builder, child);
+		emit(builder, OP_FILTER_END, 0);
+		break;
+	}
+	default:
+		assert(false);
+		builder->failed = true;
+		break;
+	}
+	emit(builder, OP_JUMP, next);
+	patch(builder, next);
+	emit(builder, OP_MAP_END, 0);
+}
+
+static void lower_path(builder_t* builder, const path_indexes_t* indexes) {
+	lower(builder, indexes->root_node);
+	// simple indexes don't refer to $, no need to keep it
+	bool keep_root = false;
+	size_t i;
+	for (i = 0; i < indexes->size; ++i) {
+		path_index_tag_t tag = indexes->indexes[i].tag;
+		if (tag == INDEX_SUB_EXP || tag == INDEX_SUB_RANGE || tag == INDEX_FILTER) keep_root = true;
+	}
+	if (keep_root) emit(builder, OP_DUP, 0);
+	for (i = 0; i < indexes->size; ++i) {
+		const path_index_t* index = &indexes->indexes[i];
+		switch (index->tag) {
+		case INDEX_SUB_SIMPLE:
+			emit(builder, OP_STEP, add_constant(builder, index->simple_index));
+			break;
+		case INDEX_DOT_RECURSIVE:
+			emit(builder, OP_STEP_RECURSIVE, add_constant(builder, index->simple_index));
+			break;
+		default:
+			lower_map(builder, index);
+			break;
+		}
+	}
+	if (keep_root) emit(builder, OP_NIP, 0);
+}
+
+static void lower(builder_t* builder, const jsonpath_t* jsonpath) {
+	if (builder->failed) return;
+	switch (jsonpath->tag) {
+	case JSON_SINGLE:
+		switch (jsonpath->single.tag) {
+		case SINGLE_ROOT:
+			emit(builder, OP_ROOT, 0);
+			return;
+		case SINGLE_CURR:
+			emit(builder, OP_CURR, 0);
+			return;
+		case SINGLE_CONST:
+			emit(builder, OP_CONST, add_constant(builder, jsonpath->single.constant));
+			return;
+		default:
+			break;
+		}
+		break;
+	case JSON_INDEX:
+		lower_path(builder, &jsonpath->indexes);
+		return;
+	case JSON_UNARY:
+		lower(builder, jsonpath->unary.node);
+		emit(builder, OP_UNARY, jsonpath->unary.tag);
+		return;
+	case JSON_BINARY: {
+		// a ++ b ++ c ... is a left deep tree, walk down the left side with a loop so that long chains don't recurse
+		size_t depth = 0, i;
+		const jsonpath_t* node;
+		for (node = jsonpath; node->tag == JSON_BINARY; node = node->binary.lhs) ++depth;
+		const jsonpath_t** chain = arena_alloc(&builder->arena, sizeof(jsonpath_t*) * depth);
+		if (!chain) {
+			builder->failed = true;
+			return;
+		}
+		for (i = 0, node = jsonpath; i < depth; ++i, node = node->binary.lhs) chain[i] = node;
+		lower(builder, node);
+		for (i = depth; i-- > 0;) {
+			path_binary_tag_t tag = chain[i]->binary.tag;
+			if (tag == BINARY_AND || tag == BINARY_OR) {
+				size_t skip = emit(builder, tag == BINARY_AND ? OP_AND_THEN : OP_OR_ELSE, 0);
+				lower(builder, chain[i]->binary.rhs);
+				emit(builder, OP_BINARY, tag);
+				patch(builder, skip);
+				continue;
+			}
+			lower(builder, chain[i]->binary.rhs);
+#ifdef JANSSONPATH_SUPPORT_REGEX
+			if (chain[i]->binary.regex) {
+				emit(builder, OP_REGEX, add_regex(builder, chain[i]->binary.regex));
+				continue;
+			}
+#endif
+			emit(builder, OP_BINARY, tag);
+		}
+		return;
+	}
+	case JSON_ARBITRAY: {
+		const path_arbitrary_t* arbitrary = &jsonpath->arbitrary;
+		jsonpath_symbol_t symbol = { SYMBOL_MAX, {.variable = NULL} };
+		if (!arbitrary->symbol && builder->bind) symbol = get_symbol(builder->bind, json_string_value(arbitrary->func_name));
+		if (arbitrary->symbol) emit(builder, OP_CALL_BOUND, add_symbol(builder, *arbitrary->symbol));
+		else if (symbol.tag != SYMBOL_MAX) emit(builder, OP_CALL_BOUND, add_symbol(builder, symbol));
+		else emit(builder, OP_CALL_BEGIN, add_constant(builder, arbitrary->func_name));
+		if (symbol.tag != SYMBOL_MAX) release_symbol(symbol);
+		size_t i;
+		for (i = 0; i < arbitrary->size; ++i) {
+			lower(builder, arbitrary->nodes[i]);
+			emit(builder, OP_ARG, 0);
+		}
+		emit(builder, OP_CALL, arbitrary->size);
+		return;
+	}
+	default:
+		break;
+	}
+	assert(false);
+	builder->failed = true;
+}
+
+void JANSSONPATH_EXPORT jsonpath_bytecode_release(jsonpath_bytecode_t* bytecode) {
+	if (!bytecode) return;
+	size_t i;
+	for (i = 0; i < bytecode->constant_size; ++i) json_decref(bytecode->constants[i]);
+#ifdef JANSSONPATH_SUPPORT_REGEX
+	for (i = 0; i < bytecode->regex_size; ++i) regex_release(bytecode->regexes[i]);
+#endif
+	for (i = 0; i < bytecode->symbol_size; ++i) release_symbol(bytecode->symbols[i]);
+	do_free(bytecode);
+}
+
+// code, symbols, constants and regexes are stored right after the header in one block
+static jsonpath_bytecode_t* compile(const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* bind) {
+	builder_t builder;
+	memset(&builder, 0, sizeof(builder));
+	arena_init(&builder.arena);
+	builder.bind = bind;
+	builder.controls = builder.max_controls = 1; // the outermost $ and @
+	lower(&builder, jsonpath);
+
+	jsonpath_bytecode_t* ret = NULL;
+	if (!builder.failed) {
+		size_t code_offset = ARENA_ALIGN(sizeof(jsonpath_bytecode_t));
+		size_t symbol_offset = code_offset + ARENA_ALIGN(sizeof(instruction_t) * builder.size);
+		size_t constant_offset = symbol_offset + ARENA_ALIGN(sizeof(jsonpath_symbol_t) * builder.symbol_size);
+		size_t regex_offset = constant_offset + sizeof(json_t*) * builder.constant_size;
+		ret = do_malloc(regex_offset + sizeof(jsonpath_regex_t*) * builder.regex_size);
+	}
+	if (ret) {
+		ret->code = (instruction_t*)((char*)ret + ARENA_ALIGN(sizeof(jsonpath_bytecode_t)));
+		ret->size = builder.size;
+		ret->symbols = (jsonpath_symbol_t*)((char*)ret->code + ARENA_ALIGN(sizeof(instruction_t) * builder.size));
+		ret->symbol_size = builder.symbol_size;
+		ret->constants = (json_t**)((char*)ret->symbols + ARENA_ALIGN(sizeof(jsonpath_symbol_t) * builder.symbol_size));
+		ret->constant_size = builder.constant_size;
+		ret->regexes = (jsonpath_regex_t**)(ret->constants + builder.constant_size);
+		ret->regex_size = builder.regex_size;
+		ret->max_values = builder.max_values;
+		ret->max_controls = builder.max_controls;
+		memcpy(ret->code, builder.code, sizeof(instruction_t) * builder.size);
+		if (builder.symbol_size) memcpy(ret->symbols, builder.symbols, sizeof(jsonpath_symbol_t) * builder.symbol_size);
+		if (builder.constant_size) memcpy(ret->constants, builder.constants, sizeof(json_t*) * builder.constant_size);
+		if (builder.regex_size) memcpy(ret->regexes, builder.regexes, sizeof(jsonpath_regex_t*) * builder.regex_size);
+	} else {
+		size_t i;
+		for (i = 0; i < builder.constant_size; ++i) json_decref(builder.constants[i]);
+		for (i = 0; i < builder.symbol_size; ++i) release_symbol(builder.symbols[i]);
+#ifdef JANSSONPATH_SUPPORT_REGEX
+		for (i = 0; i < builder.regex_size; ++i) regex_release(builder.regexes[i]);
+#endif
+	}
+	arena_release(&builder.arena);
+	return ret;
+}
+
+JANSSONPATH_EXPORT jsonpath_bytecode_t* jsonpath_bytecode_compile(const jsonpath_t* jsonpath) {
+	return compile(jsonpath, NULL);
+}
+
+typedef enum control_tag_t {
+	CONTROL_TOP, CONTROL_MAP, CONTROL_FILTER, CONTROL_CALL
+} control_tag_t;
+
+typedef struct control_t {
+	control_tag_t tag;
+	// $ and @ in scope
+	json_t* root;
+	result_t curr;
+	// map: the value indexed(owned); filter: the element whose children are filtered
+	result_t node;
+	// map: the element being indexed
+	result_t element;
+	// map and filter: the result so far(owned)
+	result_t ret;
+	size_t index;
+	void* iter;
+	jsonpath_symbol_t symbol;
+} control_t;
+
+static const result_t error_result = { {.value = NULL}, false, false, false, false };
+
+static void map_accumulate(control_t* map, result_t mapped_element) {
+	assert(map->tag == CONTROL_MAP);
+	if (!map->node.is_collection) map->ret = mapped_element;
+	else collection_accumulate(&map->ret, mapped_element);
+}
+
+static result_t step(result_t node, json_t* simple_index) {
+	if (!node.is_collection) return jsonpath_evaluate_impl_simple_index(node, simple_index);
+	const collection_t* items = node.collection;
+	result_t ret = make_result_collection(derived_collection(node, items->size), true, node.is_constant);
+	size_t index;
+	for (index = 0; index < items->size; ++index) {
+		result_t element = make_result_borrow(items->items[index], node.is_right_value, node.is_constant);
+		collection_accumulate(&ret, jsonpath_evaluate_impl_simple_index(element, simple_index));
+	}
+	return ret;
+}
+
+static void release_control(control_t* control) {
+	switch (control->tag) {
+	case CONTROL_MAP:
+		result_decref(control->node);
+		result_decref(control->ret);
+		break;
+	case CONTROL_FILTER:
+		result_decref(control->ret);
+		break;
+	case CONTROL_CALL:
+		release_symbol(control->symbol);
+		break;
+	default:
+		break;
+	}
+}
+
+#define LOCAL_VALUES 16
+#define LOCAL_CONTROLS 8
+#define LOCAL_ARGS 8
+
+// stacks deep enough for bytecode, on the C stack if they are small
+typedef struct stacks_t {
+	result_t local_values[LOCAL_VALUES];
+	control_t local_controls[LOCAL_CONTROLS];
+	result_t* values;
+	control_t* controls;
+} stacks_t;
+
+static bool stacks_init(stacks_t* stacks, const jsonpath_bytecode_t* bytecode) {
+	stacks->values = bytecode->max_values > LOCAL_VALUES ? do_malloc(sizeof(result_t) * bytecode->max_values) : stacks->local_values;
+	stacks->controls = bytecode->max_controls > LOCAL_CONTROLS ? do_malloc(sizeof(control_t) * bytecode->max_controls) : stacks->local_controls;
+	return stacks->values && stacks->controls;
+}
+
+static void stacks_release(stacks_t* stacks) {
+	if (stacks->values != stacks->local_values) do_free(stacks->values);
+	if (stacks->controls != stacks->local_controls) do_free(stacks->controls);
+}
+
+static result_t run(const jsonpath_bytecode_t* bytecode, stacks_t* stacks, size_t pc, size_t end, json_t* root, result_t curr, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+
+// run code from pc up to end with $ and @ given, which leaves one value
+static result_t execute(const jsonpath_bytecode_t* bytecode, size_t pc, size_t end, json_t* root, result_t curr, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	stacks_t stacks;
+	result_t ret = error_result;
+	if (stacks_init(&stacks, bytecode)) ret = run(bytecode, &stacks, pc, end, root, curr, symbols, error);
+	else *error = jsonpath_error_unknown;
+	stacks_release(&stacks);
+	return ret;
+}
+
+// condition of a filter run in parallel, the code between FILTER_NEXT and FILTER_TEST
+typedef struct filter_context_t {
+	const jsonpath_bytecode_t* bytecode;
+	size_t begin;
+	size_t end;
+	json_t* root;
+	jsonpath_symbol_lookup_t* symbols;
+} filter_context_t;
+
+static result_t filter_predicate(void* context, json_t* element, jsonpath_error_t* error) {
+	const filter_context_t* filter = context;
+	return execute(filter->bytecode, filter->begin, filter->end, filter->root, make_result_borrow(element, false, false), filter->symbols, error);
+}
+
+static result_t run(const jsonpath_bytecode_t* bytecode, stacks_t* stacks, size_t pc, size_t end, json_t* root, result_t curr, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	result_t* values = stacks->values;
+	control_t* controls = stacks->controls;
+	result_t* top = values - 1;
+	control_t* control = controls;
+	memset(control, 0, sizeof(control_t));
+	control->tag = CONTROL_TOP;
+	control->root = root;
+	control->curr = curr;
+
+	const instruction_t* code = bytecode->code;
+	json_t* const* constants = bytecode->constants;
+	result_t ret = error_result;
+	while (pc < end) {
+		instruction_t instruction = code[pc++];
+		switch (instruction.op) {
+		case OP_ROOT: {
+			*++top = make_result_borrow(control->root, false, false);
+			break;
+		}
+		case OP_CURR:
+			*++top = result_share(control->curr);
+			break;
+		case OP_CONST:
+			*++top = make_result_new(json_incref(constants[instruction.operand]), true, true);
+			break;
+		case OP_OMITTED:
+			*++top = make_result_new(NULL, true, true);
+			break;
+		case OP_DUP:
+			top[1] = result_share(top[0]);
+			++top;
+			break;
+		case OP_NIP:
+			result_decref(top[-1]);
+			top[-1] = top[0];
+			--top;
+			break;
+		case OP_UNARY: {
+			result_t result = evaluate_unary((path_unary_tag_t)instruction.operand, *top, error);
+			result_decref(*top);
+			*top = result;
+			if (error->abort) goto fail;
+			break;
+		}
+		case OP_BINARY: {
+			result_t rhs = *top--;
+			result_t result = error_result;
+			if (rhs.is_collection) *error = jsonpath_error_collection_oprand;
+			else result = binary_deal_with_collection((path_binary_tag_t)instruction.operand, *top, rhs, NULL, error);
+			result_decref(rhs);
+			result_decref(*top);
+			*top = result;
+			if (error->abort) goto fail;
+			break;
+		}
+		case OP_AND_THEN:
+		case OP_OR_ELSE: {
+			result_t decided;
+			if (!logical_short_circuit(instruction.op == OP_AND_THEN ? BINARY_AND : BINARY_OR, *top, &decided)) break;
+			result_decref(*top);
+			*top = decided;
+			pc = instruction.operand;
+			break;
+		}
+#ifdef JANSSONPATH_SUPPORT_REGEX
+		case OP_REGEX: {
+			result_t rhs = *top--;
+			result_t result = error_result;
+			if (rhs.is_collection) *error = jsonpath_error_collection_oprand;
+			else result = binary_deal_with_collection(BINARY_REGEX, *top, rhs, bytecode->regexes[instruction.operand], error);
+			result_decref(rhs);
+			result_decref(*top);
+			*top = result;
+			if (error->abort) goto fail;
+			break;
+		}
+#endif
+		case OP_CALL_BEGIN: {
+			const char* name = json_string_value(constants[instruction.operand]);
+			jsonpath_symbol_t symbol = get_symbol(symbols, name);
+			if (symbol.tag == SYMBOL_MAX) {
+				*error = jsonpath_error_function_not_found(name);
+				goto fail;
+			}
+			control[1] = control[0];
+			++control;
+			control->tag = CONTROL_CALL;
+			control->symbol = symbol;
+			break;
+		}
+		case OP_CALL_BOUND:
+			control[1] = control[0];
+			++control;
+			control->tag = CONTROL_CALL;
+			control->symbol = symbol_incref(bytecode->symbols[instruction.operand]);
+			break;
+		case OP_ARG:
+		case OP_RANGE_ARG:
+			if (top->is_collection) {
+				*error = jsonpath_error_collection_oprand;
+				goto fail;
+			}
+			break;
+		case OP_CALL: {
+			size_t arg_n = instruction.operand, i;
+			json_t* local_args[LOCAL_ARGS];
+			json_t** args = arg_n > LOCAL_ARGS ? do_malloc(sizeof(json_t*) * arg_n) : local_args;
+			result_t* first = top - arg_n + 1;
+			for (i = 0; i < arg_n; ++i) args[i] = first[i].value;
+			result_t result = make_result_new(evaluate_symbol(control->symbol, args, arg_n), true, false);
+			release_symbol(control->symbol);
+			--control;
+			for (i = 0; i < arg_n; ++i) result_decref(first[i]);
+			if (args != local_args) do_free(args);
+			top = first;
+			*top = result;
+			break;
+		}
+		case OP_STEP: {
+			result_t result = step(*top, constants[instruction.operand]);
+			result_decref(*top);
+			*top = result;
+			break;
+		}
+		case OP_STEP_RECURSIVE: {
+			// matches of every element go straight into one collection
+			result_t node = *top;
+			result_t result = make_result_collection(derived_collection(node, 0), true, node.is_constant);
+			if (!node.is_collection) {
+				recursive_accumulate(&result, node, constants[instruction.operand]);
+			} else {
+				const collection_t* items = node.collection;
+				size_t index;
+				for (index = 0; index < items->size; ++index) {
+					result_t element = make_result_borrow(items->items[index], node.is_right_value, node.is_constant);
+					recursive_accumulate(&result, element, constants[instruction.operand]);
+				}
+			}
+			result_decref(node);
+			*top = result;
+			break;
+		}
+		case OP_MAP_BEGIN: {
+			result_t node = *top--;
+			if (top->is_collection) {
+				// $ is a plain json node, a collection is seen as a json_array
+				result_t root_array = make_result_new(collection_to_array(top->collection), top->is_right_value, top->is_constant);
+				result_decref(*top);
+				*top = root_array;
+			}
+			++control;
+			control->tag = CONTROL_MAP;
+			control->root = top->value; // left by OP_DUP
+			control->curr = node;
+			control->node = node;
+			if (node.is_collection) {
+				// elements are borrowed, ret keeps node alive for results derived from them
+				control->ret = make_result_collection(derived_collection(node, node.collection->size), true, node.is_constant);
+			} else {
+				control->ret = error_result;
+			}
+			control->index = 0;
+			break;
+		}
+		case OP_MAP_NEXT: {
+			result_t node = control->node;
+			if (!node.is_collection) {
+				if (control->index++) {
+					pc = instruction.operand;
+					break;
+				}
+				control->element = node;
+			} else {
+				if (control->index >= node.collection->size) {
+					pc = instruction.operand;
+					break;
+				}
+				control->element = make_result_borrow(node.collection->items[control->index++], node.is_right_value, node.is_constant);
+			}
+			break;
+		}
+		case OP_MAP_END:
+			result_decref(control->node);
+			*++top = control->ret;
+			--control;
+			break;
+		case OP_SUB_EXP: {
+			result_t mapped = jsonpath_evaluate_impl_sub_exp(control->element, *top--, error);
+			if (error->abort) {
+				result_decref(mapped);
+				goto fail;
+			}
+			map_accumulate(control, mapped);
+			break;
+		}
+		case OP_RANGE_CHECK:
+			if (!json_is_array(control->element.value)) {
+				map_accumulate(control, error_result);
+				pc = instruction.operand;
+			}
+			break;
+		case OP_RANGE: {
+			result_t mapped = jsonpath_evaluate_impl_range(control->element, top[-1], top[0]);
+			result_decref(top[0]);
+			result_decref(top[-1]);
+			top -= 2;
+			map_accumulate(control, mapped);
+			break;
+		}
+		case OP_FILTER_BEGIN: {
+			result_t element = control->element;
+			++control;
+			control->tag = CONTROL_FILTER;
+			control->root = control[-1].root;
+			control->node = element;
+			size_t size = json_is_object(element.value) ? json_object_size(element.value) : json_is_array(element.value) ? json_array_size(element.value) : 0;
+			control->ret = make_result_collection(derived_collection(element, size), true, element.is_constant);
+			control->index = 0;
+			control->iter = json_is_object(element.value) ? json_object_iter(element.value) : NULL;
+			if (json_is_array(element.value) && parallel_filter_wanted(size)) {
+				// FILTER_NEXT which follows jumps to FILTER_END, right after FILTER_TEST and JUMP back
+				size_t filter_end = code[pc].operand;
+				filter_context_t context = { bytecode, pc + 1, filter_end - 2, control->root, symbols };
+				if (!parallel_filter(&control->ret, element.value, filter_predicate, &context, error)) goto fail;
+				pc = filter_end;
+			}
+			break;
+		}
+		case OP_FILTER_NEXT: {
+			json_t* node = control->node.value;
+			json_t* value = NULL;
+			if (json_is_object(node)) {
+				if (control->iter) {
+					value = json_object_iter_value(control->iter);
+					control->iter = json_object_iter_next(node, control->iter);
+				}
+			} else if (json_is_array(node)) {
+				if (control->index < json_array_size(node)) value = json_array_get(node, control->index++);
+			}
+			if (!value) {
+				pc = instruction.operand;
+				break;
+			}
+			control->curr = make_result_borrow(value, false, false);
+			break;
+		}
+		case OP_FILTER_TEST:
+			if (!filter_accumulate(&control->ret, control->curr.value, *top--, error)) goto fail;
+			break;
+		case OP_FILTER_END: {
+			result_t mapped = control->ret;
+			--control;
+			map_accumulate(control, mapped);
+			break;
+		}
+		case OP_JUMP:
+			pc = instruction.operand;
+			break;
+		default:
+			assert(false);
+			*error = jsonpath_error_unknown;
+			goto fail;
+		}
+	}
+	assert(top == values && control == controls);
+	return *top;
+
+fail:
+	while (top >= values) {
+		result_decref(*top);
+		--top;
+	}
+	while (control > controls) {
+		release_control(control);
+		--control;
+	}
+	return ret;
+}
+
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_evaluate_bytecode(json_t* root, const jsonpath_bytecode_t* bytecode, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	*error = jsonpath_error_ok;
+	return result_export(execute(bytecode, 0, bytecode->size, root, make_result_borrow(root, false, false), symbols, error));
+}
+
+JANSSONPATH_EXPORT jsonpath_borrowed_t jsonpath_evaluate_bytecode_borrowed(json_t* root, const jsonpath_bytecode_t* bytecode, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	*error = jsonpath_error_ok;
+	return result_export_borrowed(execute(bytecode, 0, bytecode->size, root, make_result_borrow(root, false, false), symbols, error));
+}
+
+typedef struct batch_t {
+	json_t** roots;
+	const jsonpath_bytecode_t* bytecode;
+	jsonpath_symbol_lookup_t* symbols;
+	jsonpath_result_t* results;
+	jsonpath_error_t* errors;
+} batch_t;
+
+// documents [begin, end) of the batch, run on one pair of stacks
+static bool batch_chunk(void* context, size_t chunk, size_t begin, size_t end) {
+	const batch_t* batch = context;
+	stacks_t stacks;
+	size_t i;
+	(void)chunk;
+	bool ok = stacks_init(&stacks, batch->bytecode);
+	for (i = begin; i < end; ++i) {
+		json_t* root = batch->roots[i];
+		jsonpath_error_t* error = &batch->errors[i];
+		if (!ok) {
+			*error = jsonpath_error_unknown;
+			batch->results[i] = result_export(error_result);
+			continue;
+		}
+		*error = jsonpath_error_ok;
+		batch->results[i] = result_export(run(batch->bytecode, &stacks, 0, batch->bytecode->size, root, make_result_borrow(root, false, false), batch->symbols, error));
+	}
+	stacks_release(&stacks);
+	return true;
+}
+
+void JANSSONPATH_EXPORT jsonpath_evaluate_batch(json_t** roots, size_t n, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_result_t* results, jsonpath_error_t* errors, bool parallel) {
+	batch_t batch;
+	size_t i;
+	batch.bytecode = compile(jsonpath, symbols);
+	if (!batch.bytecode) {
+		// the tree walker needs no memory ahead
+		for (i = 0; i < n; ++i) results[i] = jsonpath_evaluate(roots[i], jsonpath, symbols, &errors[i]);
+		return;
+	}
+	batch.roots = roots;
+	batch.symbols = symbols;
+	batch.results = results;
+	batch.errors = errors;
+	if (parallel && n > 1) parallel_for(n, parallel_chunk_count(n), batch_chunk, &batch);
+	else batch_chunk(&batch, 0, 0, n);
+	jsonpath_bytecode_release((jsonpath_bytecode_t*)batch.bytecode);
+}
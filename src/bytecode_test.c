@@ -0,0 +1,717 @@
+#include "janssonpath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Evaluate every expression with both the tree walker and the bytecode
+// machine, and check they agree on error, flags and value. then with filters
+// run in parallel, pulled one by one, over a batch of documents, with the
+// symbols bound ahead, borrowed, and all through one plan.
+// usage: bytecode_test                      built-in document and expressions
+//        bytecode_test json_file            expressions from stdin, one a line
+//        bytecode_test json_file path...    like full_test
+
+static const char document[] =
+    "{\"store\":{\"book\":[{\"category\":\"reference\",\"author\":\"Nigel Rees\",\"title\":\"Sayings of the Century\",\"price\":8.95},"
+    "{\"category\":\"fiction\",\"author\":\"Evelyn Waugh\",\"title\":\"Sword of Honour\",\"price\":12.99},"
+    "{\"category\":\"fiction\",\"author\":\"Herman Melville\",\"title\":\"Moby Dick\",\"isbn\":\"0-553-21311-3\",\"price\":8.99},"
+    "{\"category\":\"fiction\",\"author\":\"J. R. R. Tolkien\",\"title\":\"The Lord of the Rings\",\"isbn\":\"0-395-19395-8\",\"price\":22.99}],"
+    "\"bicycle\":{\"color\":\"red\",\"price\":19.95},\"nums\":[1,2,3,4,5],\"count\":3,\"flags\":[true,false]}}";
+
+static const char* expressions[] = {
+    "$.store.book[0].title",
+    "$..price",
+    "$.store.book[?(@.price>10)].title",
+    "1+2*3",
+    "\"a\"++\"b\"",
+    "$.store.book[1:2].author",
+    "$.store.*",
+    "$..book[.#-1]",
+    "&$.store.nums[0:2]",
+    "$.store.count*2 == 6",
+    "!$.store.flags[0]",
+    "$.store.nums[?(@ % 2 == 1)]",
+    "$.store.book.#",
+    "$.store.book[-1].title",
+    "$.store.book[(@.#-1)].author",
+    "$..*",
+    "$..#",
+    "$.store.book.*.price",
+    "$.store.book.*.author",
+    "-$.store.nums.*",
+    "~$.store.nums.*",
+    "$.store.nums.* * 2",
+    "$.store.nums.* > 2",
+    "$.store.book[?(@.isbn)].title",
+    "$.store.book[?(@.price < 10 && @.category == \"fiction\")].title",
+    "(&$.store.nums[0:1]) ++ (&$.store.nums[3:4])",
+    "*(&$.store.nums.*)",
+    "$.store.nums[1:]",
+    "$.store.nums[:2]",
+    "$.store.nums[$.store.count:]",
+    "$.store.nums[\"a\":]",
+    "$.store.nums[1+1]",
+    "$.store.book.*[0:1]",
+    "$.store.book[0:2][?(@ == \"fiction\")]",
+    "$.store.book[(1)][(\"title\")]",
+    "$.store.book[($.store.nonexist)]",
+    "$.store.book[(&$.store.nums.*)]",
+    "$.store.book[(@.#-1)].isbn[1:2]",
+    "$.store.bicycle[?(@ == \"red\")]",
+    "$.store.book[?(@.price > $.store.bicycle.price)].title",
+    "$.store.book[?(@.*)]",
+    "$.store.book[?($..price)]",
+    "($.store.book ++ $.store.book)[(@.# / 2)].title",
+    "$.store..color",
+    "$.nonexist",
+    "$.store.nonexist.deeper",
+    "$.store.nums.* + $.store.nums.*",
+    "1 + $.store.nums.*",
+    "&1",
+    "*$.store.nums.*",
+    "7/0",
+    "1.5*2",
+    "max($.store.nums[0], $.store.nums[4], 3)",
+    "max($.store.nums.*)",
+    "max()",
+    "count",
+    "count(1)",
+    "missing_function(1, 2)",
+    "$.store.book[?(max(@.price, 10) > 10)].title",
+    "$.store.nums[?(@ * 10 < count)]",
+    "$.store.book[(max(count, 2) - 42)].author",
+    "[1]",
+    "(*(&$.store.book.*))[?(@.price > 10)].title",
+    "(*(&(-$.store.nums.*)))[($.# - 1)]",
+    "($..book)[0]",
+    "$.store.book[?(@.price > 100 && missing_function(@))]",
+    "$.store.book[?(@.price > 20 || missing_function(@))].title",
+    "$.store.flags[1] && $.store.nums.*",
+    "$.store.flags[0] && $.store.nums.*",
+    "$.store.nums.* > 2 && 1",
+    "0 || $.store.count",
+    "\"a\" && missing_function()",
+    // skipped when built without regular expression
+    "$.store.book[?(@.author =~ \"^J\")].title",
+    "$.store.book.*.title =~ \"of\"",
+    "$.store.book[?(\"fiction\" =~ @.category)].title",
+    "$.store.book[0].title =~ \"(\"",
+    "$..book[?(@.price > 10)]..price",
+    "$.store.nums[-2:]",
+    "$..book[1:2].title",
+    "$.store.book[(@.#-1)][?(@ == \"fiction\")]",
+    "$.store.*[(@.#-1)]",
+    "$..*[\"color\"]",
+    "$.store.book[?(@.price * $.store.count - 1 > 30)].author",
+    "$.store.count * 2.5 == 7.5 && !($.store.count % 2 == 0)",
+    "-($.store.count << 2) + ~$.store.count",
+    "$.store.count == 3.0",
+    "$.store.count / 0.0 > 1",
+    "-$.store.count * 1.5 / 0",
+    "$.store.flags[0] ^ $.store.flags[1] | $.store.flags[1]",
+    "-$.store.book.*.price * 2 + 1",
+    "!($.store.nums.* / 0 == 1) && $.store.nums.* % 2",
+};
+
+#define EXPRESSION_N (sizeof(expressions) / sizeof(expressions[0]))
+
+static json_t* max_function(json_t** args, size_t arg_n) {
+    json_t* ret = NULL;
+    size_t i;
+    for (i = 0; i < arg_n; ++i) {
+        if (!json_is_number(args[i])) return NULL;
+        if (!ret || json_number_value(args[i]) > json_number_value(ret))
+            ret = args[i];
+    }
+    return json_incref(ret);
+}
+
+static json_t* count_variable;
+static json_t* variable_lookup(const char* name) {
+    if (!strcmp(name, "count")) return json_incref(count_variable);
+    return NULL;
+}
+
+// the same variables, looked up through a context
+static json_t* variable_lookup_bind(const char* name, void* context) {
+    return json_incref(json_object_get((json_t*)context, name));
+}
+
+static const char* function_names[] = {"max"};
+static const jsonpath_callable_plain_t functions[] = {max_function};
+
+static jsonpath_symbol_lookup_t symbols;
+static jsonpath_symbol_lookup_t bind_symbols;
+static json_t* variables;
+
+static void init_symbols(void) {
+    count_variable = json_integer(42);
+    symbols.function_lookup.tag = JSONPATH_CALLABLE_PLAIN;
+    symbols.function_lookup.plain_table.names = function_names;
+    symbols.function_lookup.plain_table.functions = functions;
+    symbols.function_lookup.plain_table.size = 1;
+    symbols.variable_tag = JSONPATH_VARIABLE_PLAIN;
+    symbols.variable_lookup = variable_lookup;
+
+    variables = json_object();
+    json_object_set(variables, "count", count_variable);
+    bind_symbols.function_lookup = symbols.function_lookup;
+    bind_symbols.variable_tag = JSONPATH_VARIABLE_BIND;
+    bind_symbols.variable_lookup_bind = variable_lookup_bind;
+    bind_symbols.variable_context = variables;
+}
+
+static bool same_result(jsonpath_result_t lhs, jsonpath_error_t lhs_error,
+                        jsonpath_result_t rhs, jsonpath_error_t rhs_error) {
+    if (lhs_error.abort != rhs_error.abort || lhs_error.code != rhs_error.code)
+        return false;
+    if (lhs_error.abort) return true;
+    if (lhs.is_collection != rhs.is_collection ||
+        lhs.is_right_value != rhs.is_right_value ||
+        lhs.is_constant != rhs.is_constant)
+        return false;
+    if (!lhs.value || !rhs.value) return lhs.value == rhs.value;
+    return json_equal(lhs.value, rhs.value);
+}
+
+static int compare(const char* test_path, const char* name,
+                   jsonpath_result_t expected, jsonpath_error_t expected_error,
+                   jsonpath_result_t result, jsonpath_error_t error) {
+    if (same_result(expected, expected_error, result, error)) return 0;
+    char* expected_out =
+        expected.value
+            ? json_dumps(expected.value, JSON_COMPACT | JSON_ENCODE_ANY)
+            : NULL;
+    char* out = result.value
+                    ? json_dumps(result.value, JSON_COMPACT | JSON_ENCODE_ANY)
+                    : NULL;
+    printf("mismatch: %s\n", test_path);
+    printf("  tree:     code %llx [%d%d%d] %s\n", expected_error.code,
+           expected.is_collection, expected.is_right_value,
+           expected.is_constant, expected_out ? expected_out : "(null)");
+    printf("  %-9s code %llx [%d%d%d] %s\n", name, error.code,
+           result.is_collection, result.is_right_value, result.is_constant,
+           out ? out : "(null)");
+    free(expected_out);
+    free(out);
+    return 1;
+}
+
+#define release_result(result, error) \
+    do {                               \
+        if (!(error).abort) jsonpath_decref(result); \
+    } while (0)
+
+// a batch of documents agrees with evaluating them one by one
+#define BATCH_N 5
+static int test_batch(json_t* json, const jsonpath_t* jsonpath,
+                      const char* test_path, bool parallel) {
+    json_t* empty = json_object();
+    json_t* roots[BATCH_N] = {json, json_object_get(json, "store"), empty,
+                              json, json_object_get(json, "store")};
+    jsonpath_result_t results[BATCH_N];
+    jsonpath_error_t errors[BATCH_N];
+    int ret = 0;
+    size_t i;
+    jsonpath_evaluate_batch(roots, BATCH_N, jsonpath, &symbols, results,
+                            errors, parallel);
+    for (i = 0; i < BATCH_N; ++i) {
+        jsonpath_error_t error;
+        jsonpath_result_t expected =
+            jsonpath_evaluate(roots[i], jsonpath, &symbols, &error);
+        ret |= compare(test_path, parallel ? "par batch:" : "batch:",
+                       expected, error, results[i], errors[i]);
+        release_result(expected, error);
+        release_result(results[i], errors[i]);
+    }
+    json_decref(empty);
+    return ret;
+}
+
+// the location of a match, if it has one, leads to the match from root.
+// returns 0 if it does.
+static int check_location(json_t* json, const jsonpath_iter_t* iter,
+                          json_t* value) {
+    json_t* location = jsonpath_iter_location(iter);
+    if (!location) return 0;
+    json_t* node = json;
+    size_t i;
+    for (i = 0; node && i < json_array_size(location); ++i) {
+        json_t* step = json_array_get(location, i);
+        node = json_is_string(step)
+                   ? json_object_get(node, json_string_value(step))
+                   : json_array_get(node, (size_t)json_integer_value(step));
+    }
+    json_decref(location);
+    return node != value;
+}
+
+// locations in both forms, and escapes in them
+static int test_location(void) {
+    static const char text[] =
+        "{\"a/b\": [{\"it's\": 1}, {\"x~\\n\": [0, 2]}]}";
+    static const char* const paths[] = {"$[\"a/b\"][0][\"it's\"]",
+                                        "$..*[?(@ == 2)]"};
+    static const char* const expected[][2] = {
+        {"$['a/b'][0]['it\\'s']", "/a~1b/0/it's"},
+        {"$['a/b'][1]['x~\\n'][1]", "/a~1b/1/x~0\n/1"}};
+    json_error_t json_error;
+    json_t* json = json_loads(text, 0, &json_error);
+    int ret = 0;
+    size_t i;
+    for (i = 0; i < 2; ++i) {
+        jsonpath_error_t error;
+        jsonpath_t* jsonpath = jsonpath_compile(paths[i], &error);
+        jsonpath_iter_t* iter =
+            error.abort ? NULL : jsonpath_iter_begin(json, jsonpath, NULL, &error);
+        json_t* location = NULL;
+        if (iter && jsonpath_iter_next(iter, &error))
+            location = jsonpath_iter_location(iter);
+        json_t* normalized = jsonpath_location_normalized(location);
+        json_t* pointer = jsonpath_location_pointer(location);
+        if (!normalized || !pointer ||
+            strcmp(json_string_value(normalized), expected[i][0]) ||
+            strcmp(json_string_value(pointer), expected[i][1])) {
+            printf("location: %s gives %s %s\n", paths[i],
+                   normalized ? json_string_value(normalized) : "(null)",
+                   pointer ? json_string_value(pointer) : "(null)");
+            ret = 1;
+        }
+        json_decref(normalized);
+        json_decref(pointer);
+        json_decref(location);
+        jsonpath_iter_end(iter);
+        if (jsonpath) jsonpath_release(jsonpath);
+    }
+    json_decref(json);
+    return ret;
+}
+
+// matches dumped as a json array and as lines are the matches pulled
+static int test_dump(json_t* json, const jsonpath_t* jsonpath,
+                     const char* test_path, json_t* matches) {
+    jsonpath_buffer_t buffer = {NULL, 0, 0};
+    jsonpath_error_t error;
+    json_error_t json_error;
+    int ret = 0;
+    if (jsonpath_dump_buffer(json, jsonpath, &symbols, &buffer, JSON_COMPACT,
+                             JSONPATH_DUMP_ARRAY, &error)) {
+        json_t* loaded = json_loadb(buffer.data, buffer.size, 0, &json_error);
+        ret |= !loaded || !json_equal(loaded, matches);
+        json_decref(loaded);
+    } else {
+        ret = 1;
+    }
+    buffer.size = 0;
+    if (jsonpath_dump_buffer(json, jsonpath, &symbols, &buffer, 0,
+                             JSONPATH_DUMP_LINES, &error)) {
+        const char* line = buffer.data;
+        const char* end = buffer.data + buffer.size;
+        size_t i = 0;
+        while (line < end) {
+            const char* next = memchr(line, '\n', (size_t)(end - line));
+            json_t* loaded =
+                next ? json_loadb(line, (size_t)(next - line), JSON_DECODE_ANY,
+                                  &json_error)
+                     : NULL;
+            ret |= !loaded || !json_equal(loaded, json_array_get(matches, i++));
+            json_decref(loaded);
+            line = next ? next + 1 : end;
+        }
+        ret |= i != json_array_size(matches);
+    } else {
+        ret = 1;
+    }
+    if (ret) {
+        printf("mismatch: %s\n  dump:     %.*s\n", test_path,
+               (int)buffer.size, buffer.data ? buffer.data : "");
+    }
+    jsonpath_buffer_release(&buffer);
+    return ret;
+}
+
+// matches pulled one by one are the elements of the result, or the value if
+// it's not a collection, and an error ends them with the error of the tree
+// walker. then an iteration left early.
+static int test_iterate(json_t* json, const jsonpath_t* jsonpath,
+                        const char* test_path, jsonpath_result_t expected,
+                        jsonpath_error_t expected_error) {
+    jsonpath_error_t error;
+    json_t* matches = json_array();
+    int located = 0;
+    jsonpath_iter_t* iter = jsonpath_iter_begin(json, jsonpath, &symbols, &error);
+    if (iter) {
+        json_t* value;
+        while ((value = jsonpath_iter_next(iter, &error))) {
+            json_array_append(matches, value);
+            located |= check_location(json, iter, value);
+        }
+        jsonpath_iter_end(iter);
+    }
+    int ret = located;
+    if (located) printf("mismatch: %s\n  location\n", test_path);
+    if (expected_error.abort || error.abort) {
+        ret |= expected_error.abort != error.abort ||
+              expected_error.code != error.code;
+    } else if (expected.is_collection) {
+        ret |= !json_equal(matches, expected.value);
+    } else {
+        ret |= json_array_size(matches) != (expected.value ? 1u : 0u) ||
+              (expected.value &&
+               !json_equal(json_array_get(matches, 0), expected.value));
+    }
+    if (ret) {
+        char* out = json_dumps(matches, JSON_COMPACT);
+        printf("mismatch: %s\n  iterate:  code %llx %s\n", test_path,
+               error.code, out ? out : "(null)");
+        free(out);
+    }
+
+    // answers stopping early agree with the matches
+    if (!error.abort) {
+        size_t size = json_array_size(matches);
+        json_t* first = jsonpath_evaluate_first(json, jsonpath, &symbols, &error);
+        json_t* limited = jsonpath_evaluate_limit(json, jsonpath, 2, &symbols, &error);
+        json_t* expected_limited = json_array();
+        size_t i;
+        for (i = 0; i < size && i < 2; ++i)
+            json_array_append(expected_limited, json_array_get(matches, i));
+        if (jsonpath_count(json, jsonpath, &symbols, &error) != size ||
+            jsonpath_exists(json, jsonpath, &symbols, &error) != (size != 0) ||
+            (size ? !first || !json_equal(first, json_array_get(matches, 0))
+                  : first != NULL) ||
+            !json_equal(limited, expected_limited)) {
+            printf("mismatch: %s\n  count, exists, first or limit\n", test_path);
+            ret = 1;
+        }
+        json_decref(first);
+        json_decref(limited);
+        json_decref(expected_limited);
+        ret |= test_dump(json, jsonpath, test_path, matches);
+    }
+    json_decref(matches);
+
+    iter = jsonpath_iter_begin(json, jsonpath, &symbols, &error);
+    if (iter) {
+        jsonpath_iter_next(iter, &error);
+        jsonpath_iter_end(iter);
+    }
+    return ret;
+}
+
+// borrowed results hold what the tree walker gives, and the document is not
+// referenced by them
+static int compare_borrowed(const char* test_path, const char* name,
+                            json_t* json, jsonpath_result_t expected,
+                            jsonpath_error_t expected_error,
+                            jsonpath_borrowed_t result, jsonpath_error_t error,
+                            size_t refcount) {
+    json_t* values = json_array();
+    size_t i;
+    for (i = 0; i < result.size; ++i)
+        json_array_append(values, result.values[i]);
+    int ret = json->refcount != refcount;
+    if (expected_error.abort || error.abort) {
+        ret |= expected_error.abort != error.abort ||
+               expected_error.code != error.code || result.size;
+    } else if (expected.is_collection != result.is_collection ||
+               expected.is_right_value != result.is_right_value ||
+               expected.is_constant != result.is_constant) {
+        ret = 1;
+    } else if (expected.is_collection) {
+        ret |= !json_equal(values, expected.value);
+    } else {
+        ret |= result.size != (expected.value ? 1u : 0u) ||
+               (expected.value && !json_equal(result.values[0], expected.value));
+    }
+    if (ret) {
+        char* out = json_dumps(values, JSON_COMPACT);
+        printf("mismatch: %s\n  %-9s code %llx [%d%d%d] %s refcount %lu\n",
+               test_path, name, error.code, result.is_collection,
+               result.is_right_value, result.is_constant,
+               out ? out : "(null)", (unsigned long)json->refcount);
+        free(out);
+    }
+    json_decref(values);
+    return ret;
+}
+
+// returns 0 if agree, 1 if not
+static int test(json_t* json, const char* test_path) {
+    jsonpath_error_t error;
+    jsonpath_t* jsonpath = jsonpath_compile(test_path, &error);
+    if (error.abort) {
+        printf("failed to compile: %s (%s)\n", test_path, error.reason);
+        return 1;
+    }
+    jsonpath_bytecode_t* bytecode = jsonpath_bytecode_compile(jsonpath);
+    if (!bytecode) {
+        printf("failed to lower: %s\n", test_path);
+        jsonpath_release(jsonpath);
+        return 1;
+    }
+
+    jsonpath_error_t tree_error, other_error;
+    jsonpath_result_t tree_result =
+        jsonpath_evaluate(json, jsonpath, &symbols, &tree_error);
+    jsonpath_result_t other =
+        jsonpath_evaluate_bytecode(json, bytecode, &symbols, &other_error);
+    int ret = compare(test_path, "bytecode:", tree_result, tree_error, other,
+                      other_error);
+    release_result(other, other_error);
+    ret |= test_iterate(json, jsonpath, test_path, tree_result, tree_error);
+
+    size_t refcount = json->refcount;
+    jsonpath_borrowed_t borrowed =
+        jsonpath_evaluate_borrowed(json, jsonpath, &symbols, &other_error);
+    ret |= compare_borrowed(test_path, "borrowed:", json, tree_result,
+                            tree_error, borrowed, other_error, refcount);
+    jsonpath_borrowed_release(&borrowed);
+    borrowed = jsonpath_evaluate_bytecode_borrowed(json, bytecode, &symbols,
+                                                   &other_error);
+    ret |= compare_borrowed(test_path, "borr bc:", json, tree_result,
+                            tree_error, borrowed, other_error, refcount);
+    jsonpath_borrowed_release(&borrowed);
+
+    // filters split among threads agree with the tree walker running them in order
+    jsonpath_set_parallel_filter(1, 3);
+    other = jsonpath_evaluate(json, jsonpath, &symbols, &other_error);
+    ret |= compare(test_path, "parallel:", tree_result, tree_error, other,
+                   other_error);
+    release_result(other, other_error);
+    other = jsonpath_evaluate_bytecode(json, bytecode, &symbols, &other_error);
+    ret |= compare(test_path, "par bc:", tree_result, tree_error, other,
+                   other_error);
+    release_result(other, other_error);
+    ret |= test_batch(json, jsonpath, test_path, true);
+    jsonpath_set_parallel_filter(0, 0);
+    ret |= test_batch(json, jsonpath, test_path, false);
+    jsonpath_bytecode_release(bytecode);
+
+    jsonpath_bind(jsonpath, &bind_symbols);
+    other = jsonpath_evaluate(json, jsonpath, NULL, &other_error);
+    ret |= compare(test_path, "bound:", tree_result, tree_error, other,
+                   other_error);
+    release_result(other, other_error);
+    bytecode = jsonpath_bytecode_compile(jsonpath);
+    other = jsonpath_evaluate_bytecode(json, bytecode, NULL, &other_error);
+    ret |= compare(test_path, "bound bc:", tree_result, tree_error, other,
+                   other_error);
+    release_result(other, other_error);
+
+    release_result(tree_result, tree_error);
+    jsonpath_bytecode_release(bytecode);
+    jsonpath_release(jsonpath);
+    return ret;
+}
+
+// every expression at once through a plan, sharing leading steps
+static int test_plan(json_t* json) {
+    jsonpath_t* jsonpaths[EXPRESSION_N];
+    const char* names[EXPRESSION_N];
+    jsonpath_result_t results[EXPRESSION_N];
+    jsonpath_error_t errors[EXPRESSION_N];
+    size_t size = 0, i;
+    int ret = 0;
+    for (i = 0; i < EXPRESSION_N; ++i) {
+        jsonpath_error_t error;
+        names[size] = expressions[i];
+        jsonpaths[size] = jsonpath_compile(expressions[i], &error);
+        if (!error.abort) ++size;
+    }
+    jsonpath_plan_t* plan =
+        jsonpath_plan_compile((const jsonpath_t* const*)jsonpaths, size);
+    jsonpath_plan_evaluate(json, plan, &symbols, results, errors);
+    for (i = 0; i < size; ++i) {
+        jsonpath_error_t error;
+        jsonpath_result_t expected =
+            jsonpath_evaluate(json, jsonpaths[i], &symbols, &error);
+        ret |= compare(names[i], "plan:", expected, error, results[i],
+                       errors[i]);
+        release_result(expected, error);
+        release_result(results[i], errors[i]);
+        jsonpath_release(jsonpaths[i]);
+    }
+    jsonpath_plan_release(plan);
+    return ret;
+}
+
+// results known ahead, rather than only agreed on by the engines. expected is
+// NULL if missing, code is the error expected, 0 for none.
+static const struct {
+    const char* path;
+    const char* expected;
+    unsigned long long code;
+} checked[] = {
+    // integers which overflow, or are divided by zero, are missing, whether
+    // folded while compiling or evaluated
+    {"(-9223372036854775807 - 1) / -1", NULL, 0},
+    {"(-9223372036854775807 - 1) % -1", "0", 0},
+    {"9223372036854775807 + 1", NULL, 0},
+    {"-9223372036854775807 - 2", NULL, 0},
+    {"4611686018427387904 * 2", NULL, 0},
+    {"-4611686018427387904 * 2", "-9223372036854775808", 0},
+    {"-(-9223372036854775807 - 1)", NULL, 0},
+    {"1 << 63", NULL, 0},
+    {"-1 << 63", "-9223372036854775808", 0},
+    {"1 << 64", NULL, 0},
+    {"1 << -1", NULL, 0},
+    {"-8 >> 1", "-4", 0},
+    {"1 >> 64", NULL, 0},
+    {"7 / 0", NULL, 0},
+    {"$.store.count * 3074457345618258603", NULL, 0},
+    {"$.store.count << 62", NULL, 0},
+    {"$.store.count << 61", "6917529027641081856", 0},
+    {"$.store.count % -1", "0", 0},
+    {"-$.store.nums.* * 4611686018427387904",
+     "[-4611686018427387904,-9223372036854775808]", 0},
+    // && and || skip rhs once lhs decides the result: true for ||, false for
+    // &&, missing if neither number nor boolean. rhs evaluated is checked as
+    // usual, missing if neither number nor boolean, an error if a collection
+    {"$.store.flags[0] || $.store.bicycle.color", "true", 0},
+    {"$.store.flags[1] && $.store.bicycle.color", "false", 0},
+    {"$.store.flags[0] || $.nosuch", "true", 0},
+    {"$.store.flags[0] || $.store.nums.*", "true", 0},
+    {"$.store.flags[1] && $.store.nums.*", "false", 0},
+    {"$.store.bicycle.color && $.store.nums.*", NULL, 0},
+    {"$.store.flags[1] || $.store.bicycle.color", NULL, 0},
+    {"$.store.flags[0] && $.nosuch", NULL, 0},
+    {"$.store.flags[0] && $.store.nums.*", NULL, 0x80000000aull},
+    {"$.store.flags[1] || $.store.nums.*", NULL, 0x80000000aull},
+    {"$.store.flags[1] || $.store.count", "true", 0},
+    {"$.store.flags[0] && 0", "false", 0},
+    {"$.store.nums[?(@ > 1 || @.x)]", "[2,3,4,5]", 0},
+    {"$.store.nums[?(@ < 3 && @.x)]", "[]", 0},
+    // [*] is .*, while a '*' starting anything else inside [] is unary
+    {"$.store.nums[*]", "[1,2,3,4,5]", 0},
+    {"$..flags[*]", "[true,false]", 0},
+    {"$.store.nums[*&$.store.nums[0:2]]", NULL, 0x80000000aull},
+};
+
+#define CHECKED_N (sizeof(checked) / sizeof(checked[0]))
+
+static int check_expected(const char* test_path, const char* name,
+                          const char* expected, unsigned long long code,
+                          jsonpath_result_t result, jsonpath_error_t error) {
+    char* out = !error.abort && result.value
+                    ? json_dumps(result.value, JSON_COMPACT | JSON_ENCODE_ANY)
+                    : NULL;
+    int ret = code ? !error.abort || error.code != code
+                   : error.abort || (expected ? !out || strcmp(out, expected)
+                                              : out != NULL);
+    if (ret)
+        printf("%s %s gives %s, expected %s\n", name, test_path,
+               error.abort ? error.reason : out ? out : "(null)",
+               code ? "an error" : expected ? expected : "(null)");
+    free(out);
+    release_result(result, error);
+    return ret;
+}
+
+static int test_checked(json_t* json) {
+    int ret = 0;
+    size_t i;
+    for (i = 0; i < CHECKED_N; ++i) {
+        jsonpath_error_t error;
+        jsonpath_t* jsonpath = jsonpath_compile(checked[i].path, &error);
+        if (error.abort) {
+            printf("failed to compile: %s\n", checked[i].path);
+            ret = 1;
+            continue;
+        }
+        jsonpath_bytecode_t* bytecode = jsonpath_bytecode_compile(jsonpath);
+        jsonpath_result_t result =
+            jsonpath_evaluate(json, jsonpath, NULL, &error);
+        ret |= check_expected(checked[i].path, "tree:", checked[i].expected,
+                              checked[i].code, result, error);
+        result = jsonpath_evaluate_bytecode(json, bytecode, NULL, &error);
+        ret |= check_expected(checked[i].path, "bytecode:",
+                              checked[i].expected, checked[i].code, result,
+                              error);
+        jsonpath_bytecode_release(bytecode);
+        jsonpath_release(jsonpath);
+    }
+    return ret;
+}
+
+// the tree walker recurses once for every operator in a chain, bytecode
+// does not.
+static int test_long_chain(void) {
+    static const size_t length = 50000;
+    static const char term[] = "$.n+";
+    char* expression = malloc(length * (sizeof(term) - 1) + 2);
+    size_t i;
+    for (i = 0; i < length; ++i)
+        memcpy(expression + i * (sizeof(term) - 1), term, sizeof(term) - 1);
+    strcpy(expression + length * (sizeof(term) - 1), "0");
+
+    int ret = 1;
+    jsonpath_error_t error;
+    jsonpath_t* jsonpath = jsonpath_compile(expression, &error);
+    free(expression);
+    if (error.abort) {
+        printf("long chain: failed to compile\n");
+        return 1;
+    }
+    jsonpath_bytecode_t* bytecode = jsonpath_bytecode_compile(jsonpath);
+    json_t* json = json_object();
+    json_object_set_new(json, "n", json_integer(1));
+    jsonpath_result_t result =
+        jsonpath_evaluate_bytecode(json, bytecode, NULL, &error);
+    if (!error.abort && json_is_integer(result.value) &&
+        json_integer_value(result.value) == (json_int_t)length) {
+        ret = 0;
+    } else {
+        printf("long chain: wrong result\n");
+    }
+    if (!error.abort) jsonpath_decref(result);
+    json_decref(json);
+    jsonpath_bytecode_release(bytecode);
+    jsonpath_release(jsonpath);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    json_error_t error;
+    json_t* json;
+    size_t tested = 0, mismatch = 0;
+    init_symbols();
+    if (argc < 2) {
+        json = json_loads(document, 0, &error);
+        size_t i;
+        for (i = 0; i < EXPRESSION_N; ++i, ++tested)
+            mismatch += test(json, expressions[i]);
+        ++tested;
+        mismatch += test_long_chain();
+        ++tested;
+        mismatch += test_plan(json);
+        ++tested;
+        mismatch += test_location();
+        ++tested;
+        mismatch += test_checked(json);
+    } else {
+        json = json_load_file(argv[1], JSON_DECODE_ANY | JSON_ALLOW_NUL,
+                              &error);
+        if (!json) {
+            printf("failed to load %s: %s\n", argv[1], error.text);
+            return -1;
+        }
+        if (argc > 2) {
+            int i;
+            for (i = 2; i < argc; ++i, ++tested)
+                mismatch += test(json, argv[i]);
+        } else {
+            char buffer[1024];
+            while (scanf(" %1023[^\n]", buffer) > 0) {
+                mismatch += test(json, buffer);
+                ++tested;
+            }
+        }
+    }
+    json_decref(json);
+    json_decref(count_variable);
+    json_decref(variables);
+    printf("%zu tested, %zu mismatches\n", tested, mismatch);
+    return mismatch ? -1 : 0;
+}
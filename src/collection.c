@@ -0,0 +1,130 @@
+#include "private/collection.h"
+#include "private/jansson_memory.h"
+
+struct collection_anchor_t {
+	bool is_collection;
+	union {
+		json_t* value;
+		collection_t* collection;
+	};
+};
+
+// make room for at least one more element of a buffer, there's no realloc in json_malloc_t
+static bool reserve(void** buffer, size_t size, size_t* capacity, size_t element_size) {
+	if (size < *capacity) return true;
+	size_t new_capacity = *capacity ? *capacity * 2 : 4;
+	void* new_buffer = do_malloc(new_capacity * element_size);
+	if (!new_buffer) return false;
+	if (size) memcpy(new_buffer, *buffer, size * element_size);
+	if (*buffer) do_free(*buffer);
+	*buffer = new_buffer;
+	*capacity = new_capacity;
+	return true;
+}
+
+JANSSONPATH_NO_EXPORT collection_t* collection_new(size_t capacity) {
+	collection_t* ret = do_malloc(sizeof(collection_t));
+	if (!ret) return NULL;
+	ret->refcount = 1;
+	ret->items = capacity ? do_malloc(capacity * sizeof(json_t*)) : NULL;
+	ret->size = 0;
+	ret->capacity = ret->items ? capacity : 0;
+	ret->anchors = NULL;
+	ret->anchor_size = 0;
+	ret->anchor_capacity = 0;
+	return ret;
+}
+
+JANSSONPATH_NO_EXPORT collection_t* collection_incref(collection_t* collection) {
+	if (collection) ++collection->refcount;
+	return collection;
+}
+
+void JANSSONPATH_NO_EXPORT collection_decref(collection_t* collection) {
+	if (!collection || --collection->refcount) return;
+	size_t i;
+	for (i = 0; i < collection->anchor_size; ++i) {
+		collection_anchor_t anchor = collection->anchors[i];
+		if (anchor.is_collection) collection_decref(anchor.collection);
+		else json_decref(anchor.value);
+	}
+	if (collection->anchors) do_free(collection->anchors);
+	if (collection->items) do_free(collection->items);
+	do_free(collection);
+}
+
+void JANSSONPATH_NO_EXPORT collection_append(collection_t* collection, json_t* item) {
+	if (!item) return;
+	if (!reserve((void**)&collection->items, collection->size, &collection->capacity, sizeof(json_t*))) return;
+	collection->items[collection->size++] = item;
+}
+
+static void add_anchor(collection_t* collection, collection_anchor_t anchor) {
+	if (!reserve((void**)&collection->anchors, collection->anchor_size, &collection->anchor_capacity, sizeof(collection_anchor_t))) {
+		// can't keep it alive any more, leak it rather than leave dangling items
+		return;
+	}
+	collection->anchors[collection->anchor_size++] = anchor;
+}
+
+void JANSSONPATH_NO_EXPORT collection_anchor_value(collection_t* collection, json_t* value) {
+	if (!value) return;
+	collection_anchor_t anchor = { false, {.value = value} };
+	add_anchor(collection, anchor);
+}
+
+void JANSSONPATH_NO_EXPORT collection_anchor_parent(collection_t* collection, collection_t* parent) {
+	// a parent is usually anchored once for every step mapped over it
+	if (collection->anchor_size) {
+		collection_anchor_t last = collection->anchors[collection->anchor_size - 1];
+		if (last.is_collection && last.collection == parent) return;
+	}
+	collection_anchor_t anchor = { true, {.collection = collection_incref(parent)} };
+	add_anchor(collection, anchor);
+}
+
+void JANSSONPATH_NO_EXPORT collection_append_new(collection_t* collection, json_t* item) {
+	if (!item) return;
+	collection_append(collection, item);
+	collection_anchor_value(collection, item);
+}
+
+void JANSSONPATH_NO_EXPORT collection_merge(collection_t* collection, collection_t* other) {
+	size_t i;
+	if (collection->capacity - collection->size < other->size) {
+		size_t new_capacity = collection->size + other->size;
+		if (new_capacity < collection->capacity * 2) new_capacity = collection->capacity * 2;
+		json_t** items = do_malloc(new_capacity * sizeof(json_t*));
+		if (!items) {
+			collection_decref(other);
+			return;
+		}
+		if (collection->size) memcpy(items, collection->items, collection->size * sizeof(json_t*));
+		if (collection->items) do_free(collection->items);
+		collection->items = items;
+		collection->capacity = new_capacity;
+	}
+	if (other->size) memcpy(collection->items + collection->size, other->items, other->size * sizeof(json_t*));
+	collection->size += other->size;
+
+	bool steal = other->refcount == 1; // nobody else needs anchors of other, move rather than copy them
+	for (i = 0; i < other->anchor_size; ++i) {
+		collection_anchor_t anchor = other->anchors[i];
+		if (anchor.is_collection) {
+			collection_anchor_parent(collection, anchor.collection);
+			if (steal) collection_decref(anchor.collection);
+		}
+		else {
+			collection_anchor_value(collection, steal ? anchor.value : json_incref(anchor.value));
+		}
+	}
+	if (steal) other->anchor_size = 0;
+	collection_decref(other);
+}
+
+JANSSONPATH_NO_EXPORT json_t* collection_to_array(const collection_t* collection) {
+	json_t* ret = json_array();
+	size_t i;
+	for (i = 0; i < collection->size; ++i) json_array_append(ret, collection->items[i]);
+	return ret;
+}
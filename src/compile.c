@@ -7,6 +7,11 @@
 #include "private/jansson_memory.h"
 #include "private/lexeme.h"
 #include "private/error.h"
+#include "private/arena.h"
+#include "private/evaluate_impl.h"
+#ifdef JANSSONPATH_SUPPORT_REGEX
+#include "private/regex_impl.h"
+#endif
 JANSSONPATH_EXPORT jsonpath_t* jsonpath_compile_ranged(
     const char* jsonpath_begin, const char** pjsonpath_end,
     jsonpath_error_t* error);
@@ -30,7 +35,8 @@ void JANSSONPATH_EXPORT jsonpath_release(jsonpath_t* jsonpath);
 
 static int slice_cstr_cmp(string_slice slice, const char* c_str) {
     size_t len = SLICE_SIZE(slice);
-    int cmp = strncmp(slice.begin, c_str, len);
+    // slice at the end of input is NULL, which strncmp must not see even with len 0
+    int cmp = len ? strncmp(slice.begin, c_str, len) : 0;
     if (cmp) return cmp;
     // cmp == 0
     return -(int)(unsigned char)c_str[len];
@@ -39,6 +45,16 @@ static int slice_cstr_cmp(string_slice slice, const char* c_str) {
 // use static to expect inline optimization
 // pass by value for release functions, because them are small to pass, and safe to copy(as they are not referenced by address)
 
+// while parsing, nodes and arrays are allocated from the arena of the parser, and never freed one by one.
+// release functions below only drop references to json_t the nodes hold.
+// the finished tree is packed into one block, see pack_jsonpath.
+
+static jsonpath_t* alloc_node(arena_t* arena, jsonpath_tag_t tag) {
+	jsonpath_t* ret = arena_alloc(arena, sizeof(jsonpath_t));
+	ret->tag = tag;
+	return ret;
+}
+
 static path_index_t build_simple_index(json_t* index){
 	path_index_t ret = { INDEX_SUB_SIMPLE, {.simple_index=index} };
 	return ret;
@@ -72,11 +88,11 @@ static void index_release(path_index_t path){
 		break;
 	case INDEX_SUB_EXP:
 	case INDEX_FILTER:
-		jsonpath_release(path.expression);
+		jsonpath_release_no_free(path.expression);
 		break;
 	case INDEX_SUB_RANGE:
-		jsonpath_release(path.range[0]);
-		jsonpath_release(path.range[1]);
+		jsonpath_release_no_free(path.range[0]);
+		jsonpath_release_no_free(path.range[1]);
 		break;
 	default:{
 		assert(false);
@@ -85,24 +101,22 @@ static void index_release(path_index_t path){
 	}
 }
 
-static jsonpath_t* build_indexes(jsonpath_t* root){
+static jsonpath_t* build_indexes(arena_t* arena, jsonpath_t* root){
 	static const size_t indexes_capacity_default = 4;
-	path_index_t* indexes = do_malloc(sizeof(path_index_t) * indexes_capacity_default);
+	path_index_t* indexes = arena_alloc(arena, sizeof(path_index_t) * indexes_capacity_default);
 	path_indexes_t real_node = { root, indexes, 0, indexes_capacity_default };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_INDEX;
+	jsonpath_t* ret = alloc_node(arena, JSON_INDEX);
 	ret->indexes = real_node;
 	return ret;
 }
 
-static void add_index(jsonpath_t* index_node, path_index_t index) {
+static void add_index(arena_t* arena, jsonpath_t* index_node, path_index_t index) {
 	assert(index_node->tag == JSON_INDEX);
 	path_indexes_t* indexes = &index_node->indexes;
 	if (indexes->size + 1 > indexes->capacity) {
 		indexes->capacity *= 2;
-		path_index_t* new_nodes = do_malloc(sizeof(path_index_t) * indexes->capacity);
+		path_index_t* new_nodes = arena_alloc(arena, sizeof(path_index_t) * indexes->capacity);
 		memcpy(new_nodes, indexes->indexes, sizeof(path_index_t) * indexes->size);
-		do_free(indexes->indexes);
 		indexes->indexes = new_nodes;
 	}
 	indexes->indexes[indexes->size] = index;
@@ -110,57 +124,60 @@ static void add_index(jsonpath_t* index_node, path_index_t index) {
 }
 
 static void indexes_release(path_indexes_t indexes){
-	jsonpath_release(indexes.root_node);
+	jsonpath_release_no_free(indexes.root_node);
 	size_t i;
 	for(i=0;i<indexes.size;++i){
 		index_release(indexes.indexes[i]);
 	}
-	do_free(indexes.indexes);
 }
 
-static jsonpath_t* build_unary(path_unary_tag_t type, jsonpath_t* oprand){
+static jsonpath_t* build_unary(arena_t* arena, path_unary_tag_t type, jsonpath_t* oprand){
 	path_unary_t real_node = { type,oprand };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_UNARY;
+	jsonpath_t* ret = alloc_node(arena, JSON_UNARY);
 	ret->unary = real_node;
 	return ret;
 }
 
 static void unary_release(path_unary_t unary){
-	jsonpath_release(unary.node);
+	jsonpath_release_no_free(unary.node);
 }
 
-static jsonpath_t* build_binary(path_binary_tag_t type, jsonpath_t* lhs, jsonpath_t* rhs) {
-	path_binary_t real_node = { type, lhs, rhs };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_BINARY;
+static jsonpath_t* build_binary(arena_t* arena, path_binary_tag_t type, jsonpath_t* lhs, jsonpath_t* rhs) {
+	path_binary_t real_node = { type, lhs, rhs, NULL };
+	jsonpath_t* ret = alloc_node(arena, JSON_BINARY);
 	ret->binary = real_node;
 	return ret;
 }
 
+// a ++ b ++ c ... is a left deep tree, walk down the left side with a loop so that long chains don't recurse
 static void binary_release(path_binary_t binary) {
-	jsonpath_release(binary.lhs);
-	jsonpath_release(binary.rhs);
+	for (;;) {
+		jsonpath_release_no_free(binary.rhs);
+#ifdef JANSSONPATH_SUPPORT_REGEX
+		regex_release(binary.regex);
+#endif
+		if (!binary.lhs || binary.lhs->tag != JSON_BINARY) break;
+		binary = binary.lhs->binary;
+	}
+	jsonpath_release_no_free(binary.lhs);
 }
 
-static jsonpath_t* build_func_call(json_t* func_name){
+static jsonpath_t* build_func_call(arena_t* arena, json_t* func_name){
 	static const size_t nodes_capacity_default = 4;// it should be sufficient for most call
-	jsonpath_t** nodes = do_malloc(sizeof(jsonpath_t*) * nodes_capacity_default);
-	path_arbitrary_t real_node = { ARB_FUNC, func_name, nodes, 0, nodes_capacity_default };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_ARBITRAY;
+	jsonpath_t** nodes = arena_alloc(arena, sizeof(jsonpath_t*) * nodes_capacity_default);
+	path_arbitrary_t real_node = { ARB_FUNC, func_name, nodes, 0, nodes_capacity_default, NULL };
+	jsonpath_t* ret = alloc_node(arena, JSON_ARBITRAY);
 	ret->arbitrary = real_node;
 	return ret;
 }
 
-static void add_oprand_arbitrary(jsonpath_t* arbitrary_node, jsonpath_t* oprand) {
+static void add_oprand_arbitrary(arena_t* arena, jsonpath_t* arbitrary_node, jsonpath_t* oprand) {
 	assert(arbitrary_node->tag == JSON_ARBITRAY);
 	path_arbitrary_t* arbitrary = &arbitrary_node->arbitrary;
 	if (arbitrary->size + 1 > arbitrary->capacity) {
 		arbitrary->capacity *= 2;
-		jsonpath_t** new_nodes = do_malloc(sizeof(jsonpath_t*) * arbitrary->capacity);
+		jsonpath_t** new_nodes = arena_alloc(arena, sizeof(jsonpath_t*) * arbitrary->capacity);
 		memcpy(new_nodes, arbitrary->nodes, sizeof(jsonpath_t*) * arbitrary->size);
-		do_free(arbitrary->nodes);
 		arbitrary->nodes = new_nodes;
 	}
 	arbitrary->nodes[arbitrary->size] = oprand;
@@ -170,32 +187,29 @@ static void add_oprand_arbitrary(jsonpath_t* arbitrary_node, jsonpath_t* oprand)
 static void arbitray_release(path_arbitrary_t arbitrary){
 	size_t i;
 	for(i=0;i<arbitrary.size;++i){
-		jsonpath_release(arbitrary.nodes[i]);
+		jsonpath_release_no_free(arbitrary.nodes[i]);
 	}
 	json_decref(arbitrary.func_name);
-	do_free(arbitrary.nodes);
+	unbind_symbol(&arbitrary);
 }
 
-static jsonpath_t* make_root(void){
+static jsonpath_t* make_root(arena_t* arena){
 	path_single_t real_node = { SINGLE_ROOT, NULL };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_SINGLE;
+	jsonpath_t* ret = alloc_node(arena, JSON_SINGLE);
 	ret->single = real_node;
 	return ret;
 }
 
-static jsonpath_t* make_curr(void) {
+static jsonpath_t* make_curr(arena_t* arena) {
 	path_single_t real_node = { SINGLE_CURR, NULL };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_SINGLE;
+	jsonpath_t* ret = alloc_node(arena, JSON_SINGLE);
 	ret->single = real_node;
 	return ret;
 }
 
-static jsonpath_t* make_const(json_t* constant) {
+static jsonpath_t* make_const(arena_t* arena, json_t* constant) {
 	path_single_t real_node = { SINGLE_CONST, constant };
-	jsonpath_t* ret = do_malloc(sizeof(jsonpath_t));
-	ret->tag = JSON_SINGLE;
+	jsonpath_t* ret = alloc_node(arena, JSON_SINGLE);
 	ret->single = real_node;
 	return ret;
 }
@@ -223,23 +237,154 @@ void JANSSONPATH_NO_EXPORT jsonpath_release_no_free(jsonpath_t* jsonpath) {
 	case JSON_ARBITRAY:
 		arbitray_release(jsonpath->arbitrary);
 		break;
-#ifdef JANSSONPATH_CONSTANT_FOLD
-	case JSON_CONSTANT:
-		jsonpath_decref(jsonpath->constant_result);
-		break;
-#endif
 	default:
 		break;
 	}
 }
 
+// the whole compiled tree is in one block started by its root
 void JANSSONPATH_EXPORT jsonpath_release(jsonpath_t* jsonpath) {
 	jsonpath_release_no_free(jsonpath);
 	do_free(jsonpath);
 }
 
-#define w_begin (*pw_begin)
-static string_slice word_peek;
+static size_t packed_size(const jsonpath_t* jsonpath) {
+	if (!jsonpath) return 0;
+	size_t ret = ARENA_ALIGN(sizeof(jsonpath_t));
+	size_t i;
+	switch (jsonpath->tag) {
+	case JSON_INDEX:
+		ret += ARENA_ALIGN(sizeof(path_index_t) * jsonpath->indexes.size);
+		ret += packed_size(jsonpath->indexes.root_node);
+		for (i = 0; i < jsonpath->indexes.size; ++i) {
+			path_index_t index = jsonpath->indexes.indexes[i];
+			switch (index.tag) {
+			case INDEX_SUB_EXP:
+			case INDEX_FILTER:
+				ret += packed_size(index.expression);
+				break;
+			case INDEX_SUB_RANGE:
+				ret += packed_size(index.range[0]) + packed_size(index.range[1]);
+				break;
+			default:
+				break;
+			}
+		}
+		break;
+	case JSON_UNARY:
+		ret += packed_size(jsonpath->unary.node);
+		break;
+	case JSON_BINARY: {
+		// walk down the left side with a loop, see binary_release
+		const jsonpath_t* node;
+		for (node = jsonpath; node->binary.lhs && node->binary.lhs->tag == JSON_BINARY; node = node->binary.lhs) {
+			ret += ARENA_ALIGN(sizeof(jsonpath_t)) + packed_size(node->binary.rhs);
+		}
+		ret += packed_size(node->binary.lhs) + packed_size(node->binary.rhs);
+		break;
+	}
+	case JSON_ARBITRAY:
+		ret += ARENA_ALIGN(sizeof(jsonpath_t*) * jsonpath->arbitrary.size);
+		for (i = 0; i < jsonpath->arbitrary.size; ++i) {
+			ret += packed_size(jsonpath->arbitrary.nodes[i]);
+		}
+		break;
+	default:
+		break;
+	}
+	return ret;
+}
+
+// copy in pre-order, so that children are stored right after their parents. references to json_t are moved.
+static jsonpath_t* pack_node(const jsonpath_t* jsonpath, char** pblock) {
+	if (!jsonpath) return NULL;
+	jsonpath_t* ret = (jsonpath_t*)*pblock;
+	*pblock += ARENA_ALIGN(sizeof(jsonpath_t));
+	*ret = *jsonpath;
+	size_t i;
+	switch (ret->tag) {
+	case JSON_INDEX: {
+		path_indexes_t* indexes = &ret->indexes;
+		path_index_t* packed_indexes = (path_index_t*)*pblock;
+		*pblock += ARENA_ALIGN(sizeof(path_index_t) * indexes->size);
+		if (indexes->size) memcpy(packed_indexes, indexes->indexes, sizeof(path_index_t) * indexes->size);
+		indexes->indexes = packed_indexes;
+		indexes->capacity = indexes->size;
+		indexes->root_node = pack_node(indexes->root_node, pblock);
+		for (i = 0; i < indexes->size; ++i) {
+			path_index_t* index = &indexes->indexes[i];
+			switch (index->tag) {
+			case INDEX_SUB_EXP:
+			case INDEX_FILTER:
+				index->expression = pack_node(index->expression, pblock);
+				break;
+			case INDEX_SUB_RANGE:
+				index->range[0] = pack_node(index->range[0], pblock);
+				index->range[1] = pack_node(index->range[1], pblock);
+				break;
+			default:
+				break;
+			}
+		}
+		break;
+	}
+	case JSON_UNARY:
+		ret->unary.node = pack_node(ret->unary.node, pblock);
+		break;
+	case JSON_BINARY: {
+		// walk down the left side with a loop, see binary_release. so rhs is stored before lhs
+		jsonpath_t* node = ret;
+		while (node->binary.lhs && node->binary.lhs->tag == JSON_BINARY) {
+			node->binary.rhs = pack_node(node->binary.rhs, pblock);
+			jsonpath_t* lhs = (jsonpath_t*)*pblock;
+			*pblock += ARENA_ALIGN(sizeof(jsonpath_t));
+			*lhs = *node->binary.lhs;
+			node->binary.lhs = lhs;
+			node = lhs;
+		}
+		node->binary.rhs = pack_node(node->binary.rhs, pblock);
+		node->binary.lhs = pack_node(node->binary.lhs, pblock);
+		break;
+	}
+	case JSON_ARBITRAY: {
+		path_arbitrary_t* arbitrary = &ret->arbitrary;
+		jsonpath_t** packed_nodes = (jsonpath_t**)*pblock;
+		*pblock += ARENA_ALIGN(sizeof(jsonpath_t*) * arbitrary->size);
+		for (i = 0; i < arbitrary->size; ++i) {
+			packed_nodes[i] = pack_node(arbitrary->nodes[i], pblock);
+		}
+		arbitrary->nodes = packed_nodes;
+		arbitrary->capacity = arbitrary->size;
+		break;
+	}
+	default:
+		break;
+	}
+	return ret;
+}
+
+// one allocation for the whole compiled tree. it gets better locality while evaluating, and a single free to release.
+static jsonpath_t* pack_jsonpath(const jsonpath_t* jsonpath) {
+	size_t size = packed_size(jsonpath);
+	char* block = do_malloc(size);
+	if (!block) return NULL;
+	char* iter = block;
+	jsonpath_t* ret = pack_node(jsonpath, &iter);
+	assert(iter == block + size);
+	return ret;
+}
+
+// all states of an ongoing compilation live here, so that compiling is reentrant
+typedef struct parser_t {
+	const char* w_begin;
+	const char* w_end;
+	string_slice word_peek;
+	arena_t arena;
+} parser_t;
+
+#define w_begin (parser->w_begin)
+#define w_end (parser->w_end)
+#define word_peek (parser->word_peek)
 
 // larger the number, higher the precedence
 static const int binary_precedence[BINARY_MAX + 1] = {
@@ -274,7 +419,7 @@ static const path_binary_tag_t mul_op_sequnce_value[] = {
 };
 
 static string_slice next_word_with_merge(
-	const char** pw_begin, const char* w_end, jsonpath_error_t* error
+	parser_t* parser, jsonpath_error_t* error
 ) {
 	string_slice word1 = next_nonspace_lexeme(&w_begin, w_end, error);
 	if (error->abort || is_eof(word1)) return word1;
@@ -303,7 +448,7 @@ static string_slice next_word_with_merge(
 	return word1;
 }
 
-#define go_next() do{word_peek=next_word_with_merge(&w_begin, w_end, error);}while(is_space(word_peek)&&!error->abort)
+#define go_next() do{word_peek=next_word_with_merge(parser, error);}while(is_space(word_peek)&&!error->abort)
 #define init_peek go_next
 
 typedef enum path_indicate{
@@ -346,7 +491,7 @@ static path_binary_tag_t map_to_bin_op(string_slice slice) {
 
 	size_t i;
 	for (i = 0; i < sizeof(single_key) / sizeof(char); ++i) {
-		if (is_punctor(word_peek, single_key[i])) {
+		if (is_punctor(slice, single_key[i])) {
 			return single_value[i];
 		}
 	}
@@ -362,36 +507,36 @@ static path_binary_tag_t map_to_bin_op(string_slice slice) {
 	return BINARY_MAX;
 }
 
-static jsonpath_t* parse_binary(const char** pw_begin, const char* w_end, int precedence, jsonpath_error_t* error);
-static jsonpath_t* match_brackets(const char** pw_begin, const char* w_end, jsonpath_error_t* error) {
+static jsonpath_t* parse_binary(parser_t* parser, int precedence, jsonpath_error_t* error);
+static jsonpath_t* match_brackets(parser_t* parser, jsonpath_error_t* error) {
 	size_t count = 0;
 	while(is_punctor(word_peek, '(')){
 		count++;
 		go_next();
 		if (error->abort) return NULL;
 	}
-	jsonpath_t* ret = parse_binary(&w_begin, w_end, 0, error);
+	jsonpath_t* ret = parse_binary(parser, 0, error);
 	if (!ret) return ret;
 	while (is_punctor(word_peek, ')') && count) {
 		count--;
 		go_next();
 		if (error->abort) {
-			jsonpath_release(ret);
+			jsonpath_release_no_free(ret);
 			return NULL;
 		}
 	}
 	if (count != 0) {
-		jsonpath_release(ret);
+		jsonpath_release_no_free(ret);
 		*error = json_error_unmatched_bracked(w_begin);
 		return NULL;
 	}
 	return ret;
 }
 
-static jsonpath_t* parse_arbitray(const char** pw_begin, const char* w_end, jsonpath_error_t* error) {
+static jsonpath_t* parse_arbitray(parser_t* parser, jsonpath_error_t* error) {
 	assert(is_identifier(word_peek)); // should we accept string/calculated function name?
 	json_t* func_name = json_stringn_nocheck(word_peek.begin, SLICE_SIZE(word_peek));
-	jsonpath_t* func_call = build_func_call(func_name);
+	jsonpath_t* func_call = build_func_call(&parser->arena, func_name);
 	do{
 		go_next();
 		if (error->abort) break;
@@ -401,9 +546,9 @@ static jsonpath_t* parse_arbitray(const char** pw_begin, const char* w_end, json
 		go_next();
 		if (error->abort) break;
 		while (!is_punctor(word_peek, ')')) {
-			jsonpath_t* argument = parse_binary(&w_begin, w_end, 0, error);
+			jsonpath_t* argument = parse_binary(parser, 0, error);
 			if (!argument) break;
-			add_oprand_arbitrary(func_call, argument);
+			add_oprand_arbitrary(&parser->arena, func_call, argument);
 			if (!is_punctor(word_peek, ',') && !is_punctor(word_peek, ')')) { // yes, we accept extra ',' on end of argument list, like func(1,2,)
 				break;
 			}
@@ -416,19 +561,20 @@ static jsonpath_t* parse_arbitray(const char** pw_begin, const char* w_end, json
 		if (error->abort) break;
 	} while (0);
 	if(error->abort){
-		jsonpath_release(func_call);
+		jsonpath_release_no_free(func_call);
+		return NULL;
 	}
 	return func_call;
 }
 
 static const path_index_t error_index = { INDEX_MAX,{.simple_index = NULL} };
 
-static path_index_t parse_index_sub(const char** pw_begin, const char* w_end, jsonpath_error_t* error) {
+static path_index_t parse_index_sub(parser_t* parser, jsonpath_error_t* error) {
 	// brackets in ?(exp) (exp) can be omitted, so they could be treat as simple expressions in grammar
 	if (is_punctor(word_peek, '?')) {
 		go_next();
 		if (error->abort) return error_index;
-		jsonpath_t* filter = parse_binary(&w_begin, w_end, 0, error);
+		jsonpath_t* filter = parse_binary(parser, 0, error);
 		if (!filter) return error_index;
 		path_index_t ret = build_filter_index(filter);
 		return ret;
@@ -438,7 +584,7 @@ static path_index_t parse_index_sub(const char** pw_begin, const char* w_end, js
 		do{
 			bool is_range = false;
 			if (!is_punctor(word_peek, ':')) {
-				range[0] = parse_binary(&w_begin, w_end, 0, error);
+				range[0] = parse_binary(parser, 0, error);
 				if (!range[0]) break;
 			}
 			if (is_punctor(word_peek, ':')) {
@@ -446,20 +592,19 @@ static path_index_t parse_index_sub(const char** pw_begin, const char* w_end, js
 				go_next();
 				if (error->abort) break;
 				if (!is_punctor(word_peek, ']')) { // should we allow [:] ? it's simply a translation from array to collection
-					range[1] = parse_binary(&w_begin, w_end, 0, error);
+					range[1] = parse_binary(parser, 0, error);
 					if (!range[1]) break;
 				}
 			}
 			return is_range ? build_range_index(range[0], range[1]) : build_subexp_index(range[0]);
 		} while (0);
-		jsonpath_release(range[0]);
-		jsonpath_release(range[1]);
+		jsonpath_release_no_free(range[0]);
+		jsonpath_release_no_free(range[1]);
 		return error_index;
 	}
 }
 
-static path_index_t parse_index(path_indicate path_ind, const char** pw_begin,
-                                const char* w_end, jsonpath_error_t* error) {
+static path_index_t parse_index(path_indicate path_ind, parser_t* parser, jsonpath_error_t* error) {
     go_next();
     if (error->abort) return error_index;
     switch (path_ind) {
@@ -486,7 +631,22 @@ static path_index_t parse_index(path_indicate path_ind, const char** pw_begin,
                                           : build_recursive_index(index_simple);
     }
     case PATH_IND_LBR: {
-        path_index_t ret = parse_index_sub(pw_begin, w_end, error);
+        // [*] is .* as most JSONPath implementations write it. a '*' not
+        // followed by ']' is the unary operator, parsed as usual
+        if (is_punctor(word_peek, '*')) {
+            const char* backup_w_begin = w_begin;
+            string_slice backup_word_peek = word_peek;
+            go_next();
+            if (!error->abort && is_punctor(word_peek, ']')) {
+                go_next();
+                if (error->abort) return error_index;
+                return build_simple_index(NULL);
+            }
+            if (error->abort) return error_index;
+            w_begin = backup_w_begin;
+            word_peek = backup_word_peek;
+        }
+        path_index_t ret = parse_index_sub(parser, error);
         if (ret.tag == INDEX_MAX) return ret;
         if (is_punctor(word_peek, ']')) {
             go_next();
@@ -510,37 +670,37 @@ static path_index_t parse_index(path_indicate path_ind, const char** pw_begin,
     }
 }
 
-static jsonpath_t* parse_path(const char** pw_begin, const char* w_end, jsonpath_error_t* error) {
+static jsonpath_t* parse_path(parser_t* parser, jsonpath_error_t* error) {
 	jsonpath_t* root = NULL;
 	bool is_empty = false;
 	if (is_identifier(word_peek)) {
-		root = parse_arbitray(pw_begin, w_end, error);
+		root = parse_arbitray(parser, error);
 	}else if(is_punctor(word_peek, '(')) {
-		root = match_brackets(pw_begin, w_end, error);
+		root = match_brackets(parser, error);
 	}else if (is_punctor(word_peek, '$')) {
 		go_next();
 		if (error->abort) return NULL;
-		root = make_root();
+		root = make_root(&parser->arena);
 	}else if (is_punctor(word_peek, '@')) {
 		go_next();
 		if (error->abort) return NULL;
-		root = make_curr();
+		root = make_curr(&parser->arena);
 	}else{
 		is_empty = true;
-		root = make_curr(); // root node can be omitted and default to @
+		root = make_curr(&parser->arena); // root node can be omitted and default to @
 	}
 	if (!root) return NULL;
-	jsonpath_t* path = build_indexes(root);
+	jsonpath_t* path = build_indexes(&parser->arena, root);
 
 	path_indicate path_ind = map_to_path_ind(word_peek);
 	while(path_ind!=PATH_IND_MAX){
-		path_index_t index = parse_index(path_ind, pw_begin, w_end, error);
+		path_index_t index = parse_index(path_ind, parser, error);
 		if (index.tag == INDEX_MAX) {
-			jsonpath_release(path);
+			jsonpath_release_no_free(path);
 			return NULL; // that's why i prefer exceptions
 		}
 		is_empty = false;
-		add_index(path, index);
+		add_index(&parser->arena, path, index);
 		path_ind = map_to_path_ind(word_peek);
 	}
 	if(is_empty){
@@ -548,7 +708,7 @@ static jsonpath_t* parse_path(const char** pw_begin, const char* w_end, jsonpath
 		error->code = 0x800000008ull;
 		error->reason = "expecting path";
 		error->extra = w_begin;
-		jsonpath_release(root);
+		jsonpath_release_no_free(path);
 		return NULL;
 	}
 	return path;
@@ -676,7 +836,7 @@ static json_t* try_parse_constant(string_slice slice, jsonpath_error_t* error){
 	return NULL;
 }
 
-static jsonpath_t* parse_unary(const char** pw_begin, const char* w_end, jsonpath_error_t* error) {
+static jsonpath_t* parse_unary(parser_t* parser, jsonpath_error_t* error) {
 	path_unary_tag_t unary_op = map_to_unary_op(word_peek);
 	if (unary_op != UNARY_MAX){
 		go_next();
@@ -685,7 +845,7 @@ static jsonpath_t* parse_unary(const char** pw_begin, const char* w_end, jsonpat
 	jsonpath_t* inner = NULL;
 
 	if (map_to_unary_op(word_peek) != UNARY_MAX){
-		inner = parse_unary(pw_begin, w_end, error);
+		inner = parse_unary(parser, error);
 	}else{
 		json_t* constant = try_parse_constant(word_peek, error);
 		if (error->abort) {
@@ -697,39 +857,39 @@ static jsonpath_t* parse_unary(const char** pw_begin, const char* w_end, jsonpat
 				json_decref(constant);
 				return NULL;
 			}
-			inner = make_const(constant);
+			inner = make_const(&parser->arena, constant);
 		}
 		else {
-			inner = parse_path(pw_begin, w_end, error);
+			inner = parse_path(parser, error);
 			if (!inner) return NULL;
 		}
 	}
 	
-	jsonpath_t* ret = unary_op != UNARY_MAX ? build_unary(unary_op, inner) : inner;
+	jsonpath_t* ret = unary_op != UNARY_MAX ? build_unary(&parser->arena, unary_op, inner) : inner;
 	return ret;
 	
 }
 
-#define child_node(down_grade, w_begin, w_end, precedence, error) (down_grade?parse_unary(&w_begin, w_end, error):parse_binary(&w_begin, w_end, precedence + 1, error))
+#define child_node(down_grade, parser, precedence, error) (down_grade?parse_unary(parser, error):parse_binary(parser, precedence + 1, error))
 
 // they have lower precedence than all others
-static jsonpath_t* parse_binary(const char** pw_begin, const char* w_end, int precedence, jsonpath_error_t* error){
+static jsonpath_t* parse_binary(parser_t* parser, int precedence, jsonpath_error_t* error){
 	bool down_grade = binary_precedence_max == precedence;
-	jsonpath_t* left_node = child_node(down_grade, w_begin, w_end, precedence, error);
+	jsonpath_t* left_node = child_node(down_grade, parser, precedence, error);
 	if (!left_node) return NULL;
 	path_binary_tag_t bin_op = map_to_bin_op(word_peek);
 	int curr_precedence = binary_precedence[bin_op];
 	while (curr_precedence == precedence) {
 		go_next();
 		if (error->abort) break;
-		jsonpath_t* right_node = child_node(down_grade, w_begin, w_end, precedence, error);
+		jsonpath_t* right_node = child_node(down_grade, parser, precedence, error);
 		if (!right_node)break;
-		left_node = build_binary(bin_op, left_node, right_node);
+		left_node = build_binary(&parser->arena, bin_op, left_node, right_node);
 		bin_op = map_to_bin_op(word_peek);
 		curr_precedence = binary_precedence[bin_op];
 	}
 	if(error->abort){
-		jsonpath_release(left_node);
+		jsonpath_release_no_free(left_node);
 		return NULL;
 	}
 	return left_node;
@@ -737,26 +897,35 @@ static jsonpath_t* parse_binary(const char** pw_begin, const char* w_end, int pr
 
 JANSSONPATH_EXPORT jsonpath_t* jsonpath_compile_ranged_cond(const char* jsonpath_begin, const char** pjsonpath_end, jsonpath_error_t* error, bool classical) {
 	*error = jsonpath_error_ok;
-	const char** pw_begin = &jsonpath_begin;
-	const char* w_end = pjsonpath_end ? *pjsonpath_end : NULL;
+	parser_t parser_ = { jsonpath_begin, pjsonpath_end ? *pjsonpath_end : NULL, { NULL, NULL }, { NULL } };
+	parser_t* parser = &parser_;
 	init_peek();
 	jsonpath_t* ret = NULL;
+	jsonpath_t* parsed = NULL;
 
 	// do ... while(0) works as try, break as throw, below as finally
 	do {
 		if (error->abort) break;
-		if (classical) ret = parse_path(&w_begin, w_end, error);
-		else ret = parse_binary(&w_begin, w_end, 0, error);
-		if (!ret) break;
+		if (classical) parsed = parse_path(parser, error);
+		else parsed = parse_binary(parser, 0, error);
+		if (!parsed) break;
 		if (!IS_SLICE_EMPTY(word_peek)) {
-			jsonpath_release(ret);
-			ret = NULL;
+			jsonpath_release_no_free(parsed);
 			error->abort = true;
 			error->code = 0x800000001ull;
 			error->reason = "jsonpath not ended correctly";
 			error->extra = (void*)w_begin;
+			break;
+		}
+		jsonpath_optimize(parsed);
+		ret = pack_jsonpath(parsed);
+		if (!ret) {
+			jsonpath_release_no_free(parsed);
+			*error = jsonpath_error_unknown;
+			break;
 		}
 	} while (0);
+	arena_release(&parser->arena);
 	if(pjsonpath_end){
 		*pjsonpath_end = w_begin;
 	}
@@ -0,0 +1,188 @@
+#include "janssonpath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+#define THREAD_PROC DWORD WINAPI
+#define thread_create(thread, proc, arg) \
+	((*(thread) = CreateThread(NULL, 0, proc, arg, 0, NULL)) != NULL)
+#define thread_join(thread) (WaitForSingleObject(thread, INFINITE), CloseHandle(thread))
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+#define THREAD_PROC void*
+#define thread_create(thread, proc, arg) (!pthread_create(thread, NULL, proc, arg))
+#define thread_join(thread) pthread_join(thread, NULL)
+#endif
+
+// Compile (and evaluate) the same expressions on many threads at once, also
+// evaluate jsonpaths compiled once and shared by all threads, and jsonpaths
+// from the cache while it's cleared now and then. check every thread sees
+// exactly what a single threaded run sees.
+
+static const char document[] =
+	"{\"store\":{\"book\":[{\"title\":\"a\",\"price\":8.95},{\"title\":\"b\",\"price\":12.99},"
+	"{\"title\":\"c\",\"price\":22.99,\"isbn\":\"x\"}],\"bicycle\":{\"color\":\"red\",\"price\":19.95}}}";
+
+static const char* expressions[] = {
+	"$.store.book[0].title",
+	"$..price",
+	"$.store.book[?(@.price > 10)].title",
+	"$.store.book[?(@.isbn)].title",
+	"$.store.book[1:2].title",
+	"$.store.book[-1]",
+	"$.store.book[(@.# - 1)].price",
+	"$.store.*",
+	"$..*",
+	"1 + 2 * 3 - 4 / 2 % 3",
+	"\"a\" ++ \"b\"",
+	"(&$.store.book[0:1]) ++ (&$.store.book[2:])",
+	"!true || false && 1 << 3 >= 8",
+	"-$..price.# == ~1",
+	"'\\t\\x41\\101'",
+	"$.store.book[?(@.price < $.store.bicycle.price && @.title != \"b\")].title",
+	"1.5 * $.store.book.#",
+	"$.store.book[",
+	"$.store.book[0:1",
+	"((1 + 2)",
+	"$.",
+	"1 +",
+	"missing_function(1, 2)",
+	"$.store.book[?(@.price > 10)]..title",
+	// patterns are cached and shared by threads, they fail to compile without regular expression
+	"$.store.book[?(@.title =~ \"^[ab]$\")].price",
+	"$.store.book[?(\"abc\" =~ @.title)].price",
+	"$.store.bicycle.color =~ \"(\"",
+};
+
+#define EXPRESSION_N (sizeof(expressions) / sizeof(expressions[0]))
+
+typedef struct outcome_t {
+	unsigned long long code;
+	bool compiled;
+	char* text;
+} outcome_t;
+
+static outcome_t expected[EXPRESSION_N];
+static jsonpath_t* shared[EXPRESSION_N];
+static size_t iterations = 200;
+
+static outcome_t run_compiled(json_t* json, const jsonpath_t* jsonpath) {
+	outcome_t ret = { 0, true, NULL };
+	jsonpath_error_t error;
+	jsonpath_result_t result = jsonpath_evaluate(json, jsonpath, NULL, &error);
+	ret.code = error.code;
+	if (!error.abort) {
+		ret.text = result.value ? json_dumps(result.value, JSON_COMPACT | JSON_ENCODE_ANY) : NULL;
+		jsonpath_decref(result);
+	}
+	return ret;
+}
+
+static outcome_t run_expression(json_t* json, const char* expression) {
+	outcome_t ret = { 0, false, NULL };
+	jsonpath_error_t error;
+	jsonpath_t* jsonpath = jsonpath_compile(expression, &error);
+	ret.code = error.code;
+	if (error.abort) return ret;
+	ret = run_compiled(json, jsonpath);
+	jsonpath_release(jsonpath);
+	return ret;
+}
+
+static outcome_t run_cached(json_t* json, const char* expression) {
+	outcome_t ret = { 0, false, NULL };
+	jsonpath_error_t error;
+	jsonpath_cache_entry_t* cached = jsonpath_cache_acquire(expression, false, &error);
+	ret.code = error.code;
+	if (error.abort) return ret;
+	ret = run_compiled(json, jsonpath_cache_get(cached));
+	jsonpath_cache_release(cached);
+	return ret;
+}
+
+static bool same_outcome(outcome_t lhs, outcome_t rhs) {
+	if (lhs.code != rhs.code || lhs.compiled != rhs.compiled) return false;
+	if (!lhs.text || !rhs.text) return lhs.text == rhs.text;
+	return !strcmp(lhs.text, rhs.text);
+}
+
+typedef struct worker_t {
+	size_t id;
+	size_t mismatch;
+} worker_t;
+
+static THREAD_PROC worker(void* arg) {
+	worker_t* self = arg;
+	json_error_t json_error;
+	json_t* json = json_loads(document, 0, &json_error);
+	size_t i, j;
+	for (i = 0; i < iterations; ++i) {
+		for (j = 0; j < EXPRESSION_N; ++j) {
+			// interleave expressions differently on every thread
+			size_t index = (j + i + self->id) % EXPRESSION_N;
+			outcome_t outcome = run_expression(json, expressions[index]);
+			if (!same_outcome(outcome, expected[index])) ++self->mismatch;
+			free(outcome.text);
+			outcome = run_cached(json, expressions[index]);
+			if (!same_outcome(outcome, expected[index])) ++self->mismatch;
+			free(outcome.text);
+			if (!self->id && j == i % EXPRESSION_N) jsonpath_cache_clear();
+			if (!shared[index]) continue;
+			outcome = run_compiled(json, shared[index]);
+			if (!same_outcome(outcome, expected[index])) ++self->mismatch;
+			free(outcome.text);
+		}
+	}
+	json_decref(json);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	size_t thread_n = 8;
+	if (argc > 1) thread_n = (size_t)strtoul(argv[1], NULL, 10);
+	if (argc > 2) iterations = (size_t)strtoul(argv[2], NULL, 10);
+	if (!thread_n) thread_n = 1;
+
+	json_error_t json_error;
+	json_t* json = json_loads(document, 0, &json_error);
+	if (!json) {
+		printf("failed to load document: %s\n", json_error.text);
+		return -1;
+	}
+	size_t i;
+	for (i = 0; i < EXPRESSION_N; ++i) {
+		jsonpath_error_t error;
+		expected[i] = run_expression(json, expressions[i]);
+		shared[i] = jsonpath_compile(expressions[i], &error);
+	}
+	json_decref(json);
+
+	thread_t* threads = malloc(sizeof(thread_t) * thread_n);
+	worker_t* workers = calloc(thread_n, sizeof(worker_t));
+	size_t started;
+	for (started = 0; started < thread_n; ++started) {
+		workers[started].id = started;
+		if (!thread_create(&threads[started], worker, &workers[started])) break;
+	}
+	size_t total = 0;
+	for (i = 0; i < started; ++i) {
+		thread_join(threads[i]);
+		total += workers[i].mismatch;
+	}
+	printf("%zu threads * %zu iterations * %zu expressions, %zu mismatches\n",
+		started, iterations, (size_t)EXPRESSION_N, total);
+
+	for (i = 0; i < EXPRESSION_N; ++i) {
+		free(expected[i].text);
+		jsonpath_release(shared[i]);
+	}
+	jsonpath_cache_clear();
+	free(threads);
+	free(workers);
+	return (started == thread_n && !total) ? 0 : -1;
+}
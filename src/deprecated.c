@@ -2,14 +2,16 @@
 #include "janssonpath_deprecated.h"
 #include "janssonpath.h"
 
+// compiled jsonpaths are kept in the cache of janssonpath.h, as these are usually called with a few paths again and again
+
 JANSSONPATH_DEPRECATED_EXPORT path_result json_path_get_distinct_cond(json_t* json, const char* path, bool classical){
 	path_result ret = { NULL,false };
 
 	jsonpath_error_t error;
-	jsonpath_t* jsonpath = jsonpath_compile_ranged_cond(path, NULL, &error, classical);
+	jsonpath_cache_entry_t* cached = jsonpath_cache_acquire(path, classical, &error);
 	if (error.abort) return ret;
 
-	jsonpath_result_t result = jsonpath_evaluate(json, jsonpath, NULL, &error);
+	jsonpath_result_t result = jsonpath_evaluate(json, jsonpath_cache_get(cached), NULL, &error);
 	if (error.abort) {
 		goto jsonpath_;
 	}
@@ -17,7 +19,7 @@ JANSSONPATH_DEPRECATED_EXPORT path_result json_path_get_distinct_cond(json_t* js
 	ret.result = result.value;
 	ret.is_collection = result.is_collection;
 jsonpath_:
-	jsonpath_release(jsonpath);
+	jsonpath_cache_release(cached);
 	return ret;
 }
 
@@ -33,17 +35,17 @@ JANSSONPATH_DEPRECATED_EXPORT json_t* json_path_get_cond(json_t* json, const cha
 	json_t* ret = NULL;
 
 	jsonpath_error_t error;
-	jsonpath_t* jsonpath = jsonpath_compile_ranged_cond(path, NULL, &error, classical);
+	jsonpath_cache_entry_t* cached = jsonpath_cache_acquire(path, classical, &error);
 	if (error.abort) return ret;
 
-	jsonpath_result_t result = jsonpath_evaluate(json, jsonpath, NULL, &error);
+	jsonpath_result_t result = jsonpath_evaluate(json, jsonpath_cache_get(cached), NULL, &error);
 	if (error.abort) {
 		goto jsonpath_;
 	}
 
 	ret = result.value;
 jsonpath_:
-	jsonpath_release(jsonpath);
+	jsonpath_cache_release(cached);
 	return ret;
 }
 
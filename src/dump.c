@@ -0,0 +1,118 @@
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+
+// matches pulled from the iterator are dumped one by one into the sink, so neither a collection of them nor the text
+// of all of them is ever built. jansson hands text out in small pieces, which go straight to a callback or buffer
+// given, and are gathered into blocks for a file descriptor.
+
+#define FD_BLOCK_SIZE 16384
+
+typedef struct fd_sink_t {
+	int fd;
+	size_t size;
+	char block[FD_BLOCK_SIZE];
+} fd_sink_t;
+
+static bool write_all(int fd, const char* text, size_t size) {
+	while (size) {
+#ifdef _WIN32
+		int written = _write(fd, text, (unsigned)(size > 0x40000000u ? 0x40000000u : size));
+#else
+		ssize_t written = write(fd, text, size);
+		if (written < 0 && errno == EINTR) continue;
+#endif
+		if (written <= 0) return false;
+		text += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+static int fd_append(const char* text, size_t size, void* data) {
+	fd_sink_t* sink = data;
+	if (sink->size + size > FD_BLOCK_SIZE) {
+		if (!write_all(sink->fd, sink->block, sink->size)) return -1;
+		sink->size = 0;
+		if (size > FD_BLOCK_SIZE) return write_all(sink->fd, text, size) ? 0 : -1;
+	}
+	memcpy(sink->block + sink->size, text, size);
+	sink->size += size;
+	return 0;
+}
+
+static int buffer_append(const char* text, size_t size, void* data) {
+	jsonpath_buffer_t* buffer = data;
+	if (buffer->size + size > buffer->capacity) {
+		size_t capacity = buffer->capacity ? buffer->capacity : 256;
+		while (capacity < buffer->size + size) capacity *= 2;
+		char* grown = do_malloc(capacity);
+		if (!grown) return -1;
+		if (buffer->size) memcpy(grown, buffer->data, buffer->size);
+		if (buffer->data) do_free(buffer->data);
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->data + buffer->size, text, size);
+	buffer->size += size;
+	return 0;
+}
+
+JANSSONPATH_EXPORT bool jsonpath_dump_callback(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, json_dump_callback_t callback, void* data, size_t flags, jsonpath_dump_format_t format, jsonpath_error_t* error) {
+	jsonpath_iter_t* iter = jsonpath_iter_begin(root, jsonpath, symbols, error);
+	if (!iter) return false;
+	bool lines = format == JSONPATH_DUMP_LINES;
+	const char* separator = (flags & JSON_COMPACT) ? "," : ", ";
+	bool ok = lines || !callback("[", 1, data), first = true;
+	json_t* value;
+	while (ok && (value = jsonpath_iter_next(iter, error))) {
+		if (!lines && !first && callback(separator, strlen(separator), data)) ok = false;
+		else if (json_dump_callback(value, callback, data, flags | JSON_ENCODE_ANY)) ok = false;
+		else if (lines && callback("\n", 1, data)) ok = false;
+		first = false;
+	}
+	jsonpath_iter_end(iter);
+	if (error->abort) return false;
+	if (ok && !lines) ok = !callback("]", 1, data);
+	if (!ok) *error = jsonpath_error_write_failed;
+	return ok;
+}
+
+JANSSONPATH_EXPORT bool jsonpath_dump_fd(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, int fd, size_t flags, jsonpath_dump_format_t format, jsonpath_error_t* error) {
+	fd_sink_t* sink = do_malloc(sizeof(fd_sink_t));
+	if (!sink) {
+		*error = jsonpath_error_unknown;
+		return false;
+	}
+	sink->fd = fd;
+	sink->size = 0;
+	bool ret = jsonpath_dump_callback(root, jsonpath, symbols, fd_append, sink, flags, format, error);
+	// what's dumped before an error is written too, like to the other sinks
+	if (!write_all(fd, sink->block, sink->size) && ret) {
+		*error = jsonpath_error_write_failed;
+		ret = false;
+	}
+	do_free(sink);
+	return ret;
+}
+
+JANSSONPATH_EXPORT bool jsonpath_dump_buffer(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_buffer_t* buffer, size_t flags, jsonpath_dump_format_t format, jsonpath_error_t* error) {
+	bool ret = jsonpath_dump_callback(root, jsonpath, symbols, buffer_append, buffer, flags, format, error);
+	if (!ret && error->code == jsonpath_error_write_failed.code) *error = jsonpath_error_unknown;
+	return ret;
+}
+
+void JANSSONPATH_EXPORT jsonpath_buffer_release(jsonpath_buffer_t* buffer) {
+	if (buffer->data) do_free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = buffer->capacity = 0;
+}
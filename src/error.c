@@ -13,6 +13,9 @@ jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_to_array_non_collection =
     {true, 0xa3, "to_array(&) expecting collection oprand", NULL};
 jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_from_array_collection = {
     true, 0xa4, "to_array(&) expecting collection oprand", NULL};
+jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_collection_oprand = {
+    true, 0x80000000Aull, "Collection used as oprand in incompatible opration",
+    NULL};
 
 // 0x600000000 for grammar error
 jsonpath_error_t JANSSONPATH_NO_EXPORT
@@ -59,4 +62,22 @@ jsonpath_error_function_not_found(const char* function_name) {
                             "Function not found in the table",
                             (void*)function_name};
     return ret;
-}
\ No newline at end of file
+}
+// 0x700000000 for json text streamed in or out
+JANSSONPATH_NO_EXPORT jsonpath_error_t
+jsonpath_error_not_streamable(const char* reason) {
+    jsonpath_error_t ret = {true, 0x700000001u, reason, NULL};
+    return ret;
+}
+
+JANSSONPATH_NO_EXPORT jsonpath_error_t
+jsonpath_error_malformed_json(const char* reason) {
+    jsonpath_error_t ret = {true, 0x700000002u, reason, NULL};
+    return ret;
+}
+
+jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_read_failed = {
+    true, 0x700000003u, "failed to read json text", NULL};
+
+jsonpath_error_t JANSSONPATH_NO_EXPORT jsonpath_error_write_failed = {
+    true, 0x700000004u, "failed to write matches", NULL};
@@ -1,3 +1,5 @@
+#include <limits.h>
+#include <math.h>
 #include <string.h>
 #include "jansson.h"
 #include "janssonpath_evaluate.h"
@@ -5,31 +7,13 @@
 #include "private/error.h"
 #include "private/jansson_memory.h"
 #include "private/jsonpath_ast.h"
+#include "private/evaluate_impl.h"
+#include "private/parallel.h"
 
 #ifdef JANSSONPATH_SUPPORT_REGEX
 #include "private/regex_impl.h"
 #endif
 
-static const jsonpath_error_t jsonpath_error_collection_oprand = {
-	true, 0x80000000Aull, "Collection used as oprand in incompatible opration", NULL
-};
-
-typedef struct jsonpath_callable_t{
-	jsonpath_callable_tag_t tag;
-	union{
-		jsonpath_callable_bind_t bind;
-		jsonpath_callable_plain_t plain;
-	};
-} jsonpath_callable_t;
-
-typedef struct jsonpath_symbol_t {
-	enum { SYMBOL_CALLABLE, SYMBOL_VARIABLE, SYMBOL_MAX } tag;
-	union {
-		jsonpath_callable_t callable;
-		json_t* variable;
-	};
-} jsonpath_symbol_t;
-
 static json_t* invoke_callable(jsonpath_callable_t callable, json_t** args, size_t arg_n){
 	switch (callable.tag) {
 	case JSONPATH_CALLABLE_PLAIN:
@@ -48,7 +32,7 @@ static json_t* invoke_callable(jsonpath_callable_t callable, json_t** args, size
 	return NULL;
 }
 
-static json_t* evaluate_symbol(jsonpath_symbol_t symbol, json_t** args, size_t arg_n){
+JANSSONPATH_NO_EXPORT json_t* evaluate_symbol(jsonpath_symbol_t symbol, json_t** args, size_t arg_n){
 	switch(symbol.tag){
 	case SYMBOL_CALLABLE:
 		return invoke_callable(symbol.callable, args, arg_n);
@@ -60,7 +44,12 @@ static json_t* evaluate_symbol(jsonpath_symbol_t symbol, json_t** args, size_t a
 	}
 }
 
-static void release_symbol(jsonpath_symbol_t symbol) {
+JANSSONPATH_NO_EXPORT jsonpath_symbol_t symbol_incref(jsonpath_symbol_t symbol) {
+	if (symbol.tag == SYMBOL_VARIABLE) json_incref(symbol.variable);
+	return symbol;
+}
+
+void JANSSONPATH_NO_EXPORT release_symbol(jsonpath_symbol_t symbol) {
 	switch (symbol.tag) {
 	case SYMBOL_CALLABLE:
 		return;
@@ -75,12 +64,15 @@ static void release_symbol(jsonpath_symbol_t symbol) {
 // note that variable with the same name of function would overide the definition.
 // variable can be get with function call like grammar, and function with no parameter can be involked with variable like grammar.
 // this is useful when you want to implement "rand" "time" "data" etc.
-static jsonpath_symbol_t get_symbol(jsonpath_symbol_lookup_t* symbols, const char* name){
+JANSSONPATH_NO_EXPORT jsonpath_symbol_t get_symbol(jsonpath_symbol_lookup_t* symbols, const char* name){
 	jsonpath_symbol_t ret = { SYMBOL_MAX, {.variable = NULL} };
 	if (!symbols) return ret;
 
-	jsonpath_variable_lookup_t variable_lookup = symbols->variable_lookup;
-	json_t* variable = variable_lookup(name);
+	json_t* variable = NULL;
+	if (symbols->variable_tag == JSONPATH_VARIABLE_BIND) {
+		if (symbols->variable_lookup_bind) variable = symbols->variable_lookup_bind(name, symbols->variable_context);
+	}
+	else if (symbols->variable_lookup) variable = symbols->variable_lookup(name);
 	if (variable) {
 		ret.tag = SYMBOL_VARIABLE;
 		ret.variable = variable;
@@ -117,87 +109,144 @@ static jsonpath_symbol_t get_symbol(jsonpath_symbol_lookup_t* symbols, const cha
 	return ret;
 }
 
-static const jsonpath_result_t error_result = { NULL,false,false,false };
+static const result_t error_result = { {.value = NULL}, false, false, false, false };
+
+static result_t jsonpath_evaluate_impl_basic(json_t* root, result_t curr_element, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
 
-static jsonpath_result_t jsonpath_evaluate_impl_basic(json_t* root, jsonpath_result_t curr_element, jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
-#ifdef JANSSONPATH_CONSTANT_FOLD
-void JANSSONPATH_NO_EXPORT jsonpath_release_no_free(jsonpath_t* jsonpath);
-static void jsonpath_constant_fold(jsonpath_t* jsonpath, jsonpath_result_t value) {
-	assert (jsonpath);
-	jsonpath_release_no_free(jsonpath);
-	jsonpath->tag = JSON_CONSTANT;
-	jsonpath->constant_result = value;
+// condition of a filter run in parallel
+typedef struct filter_context_t {
+	json_t* root;
+	const jsonpath_t* expression;
+	jsonpath_symbol_lookup_t* symbols;
+} filter_context_t;
+
+static result_t filter_predicate(void* context, json_t* element, jsonpath_error_t* error) {
+	const filter_context_t* filter = context;
+	return evaluate_condition(filter->root, element, filter->expression, filter->symbols, error);
 }
 
-static jsonpath_result_t jsonpath_evaluate_impl_constant_fold(json_t* root, jsonpath_result_t curr_element, jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
-	if(jsonpath->tag == JSON_CONSTANT){
-		return jsonpath_incref(jsonpath->constant_result);
-	}
-	jsonpath_result_t ret = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath, symbols, error);
-	if (!error->abort && ret.is_constant) {
-		jsonpath_constant_fold(jsonpath, jsonpath_incref(ret));
-	}
+JANSSONPATH_NO_EXPORT result_t evaluate_condition(json_t* root, json_t* element, const jsonpath_t* expression, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	return jsonpath_evaluate_impl_basic(root, make_result_borrow(element, false, false), expression, symbols, error);
+}
+
+JANSSONPATH_NO_EXPORT result_t make_result_new(json_t *value, bool is_right_value, bool is_constant){
+	result_t ret = { {.value = value}, false, is_right_value, is_constant, false };
 	return ret;
 }
-#define jsonpath_evaluate_impl jsonpath_evaluate_impl_constant_fold
-#else
-#define jsonpath_evaluate_impl jsonpath_evaluate_impl_basic
-#endif
 
-static jsonpath_result_t make_result_new(json_t *value, bool is_collection, bool is_right_value, bool is_constant){
-	jsonpath_result_t ret = { value,is_collection,is_right_value,is_constant };
+static result_t make_result(json_t* value, bool is_right_value, bool is_constant) {
+	return make_result_new(json_incref(value), is_right_value, is_constant);
+}
+
+JANSSONPATH_NO_EXPORT result_t make_result_borrow(json_t* value, bool is_right_value, bool is_constant) {
+	result_t ret = { {.value = value}, false, is_right_value, is_constant, true };
 	return ret;
 }
 
-static jsonpath_result_t make_result(json_t* value, bool is_collection, bool is_right_value, bool is_constant) {
-	return make_result_new(json_incref(value), is_collection, is_right_value, is_constant);
+JANSSONPATH_NO_EXPORT result_t make_result_collection(collection_t* collection, bool is_right_value, bool is_constant) {
+	result_t ret = { {.collection = collection}, true, is_right_value, is_constant, false };
+	return ret;
 }
 
-#define make_result_borrow make_result_new
+JANSSONPATH_NO_EXPORT result_t result_incref(result_t in) {
+	if (in.is_collection) collection_incref(in.collection);
+	else json_incref(in.value);
+	in.is_borrowed = false;
+	return in;
+}
+
+JANSSONPATH_NO_EXPORT jsonpath_result_t result_export(result_t in) {
+	jsonpath_result_t ret = { NULL, in.is_collection, in.is_right_value, in.is_constant };
+	if (in.is_collection) {
+		ret.value = collection_to_array(in.collection);
+		collection_decref(in.collection);
+	}
+	else {
+		ret.value = in.is_borrowed ? json_incref(in.value) : in.value;
+	}
+	return ret;
+}
 
-static json_t* json_object_to_array(json_t *object){
-	assert(json_is_object(object));
-	const char* key; json_t* value;
-	json_t* ret=json_array();
-	json_object_foreach(object, key, value){
-		json_array_append(ret, value);
+JANSSONPATH_NO_EXPORT jsonpath_borrowed_t result_export_borrowed(result_t in) {
+	jsonpath_borrowed_t ret = { NULL, 0, in.is_collection, in.is_right_value, in.is_constant, NULL };
+	if (!in.is_collection && !in.value) return ret; // missing, or failed
+	// a single value is held like one element of a collection
+	collection_t* owner = in.is_collection ? in.collection : collection_new(1);
+	if (!owner) {
+		result_decref(in);
+		return ret;
 	}
+	if (!in.is_collection) {
+		if (in.is_borrowed) collection_append(owner, in.value);
+		else collection_append_new(owner, in.value);
+	}
+	ret.values = owner->items;
+	ret.size = owner->size;
+	ret.owner = owner;
+	return ret;
+}
+
+JANSSONPATH_NO_EXPORT collection_t* derived_collection(result_t node, size_t capacity) {
+	collection_t* ret = collection_new(capacity);
+	if (node.is_collection) collection_anchor_parent(ret, node.collection);
+	else if (!node.is_borrowed) collection_anchor_value(ret, json_incref(node.value));
 	return ret;
 }
 
-static jsonpath_result_t path_deal_with_collection(
-	json_t* root, jsonpath_result_t curr_element,
-	path_index_t operator_, jsonpath_result_t node, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error
-);
+// child of node, it's borrowed if node is
+static result_t make_result_child(result_t node, json_t* child) {
+	if (node.is_borrowed) return make_result_borrow(child, node.is_right_value, node.is_constant);
+	return make_result(child, node.is_right_value, node.is_constant);
+}
 
-static json_t* json_get_all_property(json_t* node){
-	if (json_is_array(node)) return json_incref(node); // simple optimization
-	else if (json_is_object(node)) return json_object_to_array(node);
-	else return json_array();
+static collection_t* json_get_all_property(result_t node){
+	json_t* value = node.value;
+	size_t size = json_is_array(value) ? json_array_size(value) : json_is_object(value) ? json_object_size(value) : 0;
+	collection_t* ret = derived_collection(node, size);
+	if (json_is_array(value)) {
+		size_t index;
+		for (index = 0; index < size; ++index) collection_append(ret, json_array_get(value, index));
+	}
+	else if (json_is_object(value)) {
+		const char* key; json_t* child;
+		json_object_foreach(value, key, child) {
+			collection_append(ret, child);
+		}
+	}
+	return ret;
 }
 
-// for empty array it returns -1
-static long long json_array_index_translate(json_int_t index, size_t array_size){
+JANSSONPATH_NO_EXPORT long long json_array_index_translate(json_int_t index, size_t array_size){
 	if (index < 0) index = array_size + index; // for -n
 	long long ret = (index < 0) ? 0 : index;
 	if ((size_t)ret >= array_size) ret = array_size - 1;
 	return ret;
 }
 
-static jsonpath_result_t jsonpath_evaluate_impl_simple_index(jsonpath_result_t node, json_t* simple_index){
+// member named by a string simple index. jansson keeps length of strings, and since 2.14 it takes the length of key
+// too, which spares strlen of the key for every node indexed.
+static json_t* object_get_key(const json_t* object, const json_t* key) {
+#if JANSSON_VERSION_HEX >= 0x020e00
+	return json_object_getn(object, json_string_value(key), json_string_length(key));
+#else
+	return json_object_get(object, json_string_value(key));
+#endif
+}
+
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_simple_index(result_t node, json_t* simple_index){
 	assert(!node.is_collection);
 	if (!simple_index) { // *
-		return make_result_new(json_get_all_property(node.value), true, node.is_right_value, node.is_constant);
+		return make_result_collection(json_get_all_property(node), node.is_right_value, node.is_constant);
 	}
 	else if (json_is_string(simple_index)) {
-		return make_result(json_object_get(node.value, json_string_value(simple_index)), false, node.is_right_value, node.is_constant);
+		return make_result_child(node, object_get_key(node.value, simple_index));
 	}
 	else if (json_is_number(simple_index)) {
 		if (!json_is_array(node.value)) return error_result;
 		json_int_t index = json_is_integer(simple_index) ? json_integer_value(simple_index) : (json_int_t)json_real_value(simple_index);
 		size_t array_size = json_array_size(node.value);
 		long long translated_index = json_array_index_translate(index, array_size);
-		return make_result(translated_index >= 0 ? json_array_get(node.value, translated_index) : NULL, false, node.is_right_value, node.is_constant);
+		return make_result_child(node, translated_index >= 0 ? json_array_get(node.value, translated_index) : NULL);
 	}
 	else if (json_is_null(simple_index)) {// #
 		size_t size;
@@ -210,65 +259,31 @@ static jsonpath_result_t jsonpath_evaluate_impl_simple_index(jsonpath_result_t n
 		else {
 			size = 0;
 		}
-		return make_result_new(json_integer(size), false, true, node.is_constant);
+		return make_result_new(json_integer(size), true, node.is_constant);
 	}else{
 		return error_result;
 	}
 }
 
-static jsonpath_result_t jsonpath_evaluate_impl_path_single(json_t* root, jsonpath_result_t curr_element, jsonpath_result_t node, path_index_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+static result_t jsonpath_evaluate_impl_path_single(json_t* root, result_t curr_element, result_t node, path_index_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
 	assert(!node.is_collection);
 	switch (jsonpath.tag) {
 	case INDEX_SUB_SIMPLE:
 		return jsonpath_evaluate_impl_simple_index(node, jsonpath.simple_index);
-	case INDEX_DOT_RECURSIVE: {
-		json_t* layer = json_get_all_property(node.value);
-		json_t* all_node = json_array();
-		json_array_append(all_node, node.value);
-		json_array_append(all_node, layer);
-		while(json_array_size(layer)){
-			json_t* new_layer = json_array();
-			size_t index; json_t* value;
-			json_array_foreach(layer, index, value) {
-				json_t* get = json_get_all_property(value);
-				json_array_extend(new_layer, get);
-				json_decref(get);
-			}
-			json_decref(layer);
-			layer = new_layer;
-			json_array_extend(all_node, layer);
-		}
-		json_decref(layer);
-		jsonpath_result_t all_node_result = { all_node, true, true, node.is_constant };
-
-		path_index_t fake_path_index = jsonpath; // no need to release
-		fake_path_index.tag = INDEX_SUB_SIMPLE;
-		jsonpath_result_t ret = path_deal_with_collection(root, curr_element, fake_path_index, all_node_result, symbols, error);
-		jsonpath_decref(all_node_result);
-		return ret;
-	}
+	case INDEX_DOT_RECURSIVE:
+		return jsonpath_evaluate_impl_recursive(node, jsonpath.simple_index);
 	case INDEX_SUB_EXP: {
-		jsonpath_result_t ret = error_result;
-		jsonpath_result_t sub_exp_result = jsonpath_evaluate_impl(root, curr_element, jsonpath.expression, symbols, error);
-		if (error->abort) return ret;
-		if (!sub_exp_result.is_collection) {
-			ret = jsonpath_evaluate_impl_simple_index(node, sub_exp_result.value);
-		}else {
-			*error = jsonpath_error_collection_oprand;
-		}
-
-		// don't mix up with .* 
-		if (!sub_exp_result.value) return make_result_new(NULL, node.is_collection, node.is_right_value, node.is_constant && sub_exp_result.is_constant);
-		jsonpath_decref(sub_exp_result);
-		return ret;
+		result_t sub_exp_result = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath.expression, symbols, error);
+		if (error->abort) return error_result;
+		return jsonpath_evaluate_impl_sub_exp(node, sub_exp_result, error);
 	}
 	case INDEX_SUB_RANGE:{
 		if (!json_is_array(node.value)) return error_result;
 
-		jsonpath_result_t ret = error_result;
-		jsonpath_result_t range_json[2] = { { NULL,false,true,true }, { NULL,false,true,true } };
+		result_t ret = error_result;
+		result_t range_json[2] = { make_result_new(NULL, true, true), make_result_new(NULL, true, true) };
 		if (jsonpath.range[0]) {
-			range_json[0] = jsonpath_evaluate_impl(root, curr_element, jsonpath.range[0], symbols, error);
+			range_json[0] = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath.range[0], symbols, error);
 			if (error->abort) return error_result;
 			if (range_json[0].is_collection) {
 				*error = jsonpath_error_collection_oprand;
@@ -276,7 +291,7 @@ static jsonpath_result_t jsonpath_evaluate_impl_path_single(json_t* root, jsonpa
 			}
 		}
 		if (jsonpath.range[1]) {
-			range_json[1] = jsonpath_evaluate_impl(root, curr_element, jsonpath.range[1], symbols, error);
+			range_json[1] = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath.range[1], symbols, error);
 			if (error->abort) goto range0;
 			if (range_json[1].is_collection) {
 				*error = jsonpath_error_collection_oprand;
@@ -284,54 +299,34 @@ static jsonpath_result_t jsonpath_evaluate_impl_path_single(json_t* root, jsonpa
 			}
 		}
 
-		size_t array_size = json_array_size(node.value);
-		json_int_t index[2] = { 0, array_size };
-		if(range_json[0].value){
-			if (!json_is_number(range_json[0].value)) goto range1;
-			index[0] = json_is_integer(range_json[0].value) ? json_integer_value(range_json[0].value) : (json_int_t)json_real_value(range_json[0].value);
-		}
-		if (range_json[1].value) {
-			if (!json_is_number(range_json[1].value)) goto range1;
-			index[1] = json_is_integer(range_json[1].value) ? json_integer_value(range_json[1].value) : (json_int_t)json_real_value(range_json[1].value);
-		}
-		
-		// doesn't matter if it returns -1
-		// note that [from, to] is inclusive
-		long long from = json_array_index_translate(index[0], array_size), to = json_array_index_translate(index[1], array_size);
-		
-		ret = make_result_new(json_array(), true, true, node.is_constant && range_json[0].is_constant && range_json[1].is_constant);
-		long long i;
-		for(i=from;i<=to;++i){
-			json_array_append(ret.value, json_array_get(node.value, (size_t)i));
-		}
-
+		ret = jsonpath_evaluate_impl_range(node, range_json[0], range_json[1]);
 	range1:
-		jsonpath_decref(range_json[1]);
+		result_decref(range_json[1]);
 	range0:
-		jsonpath_decref(range_json[0]);
+		result_decref(range_json[0]);
 		return ret;
 	}
 	case INDEX_FILTER: {
 
 #define for_body {\
-		jsonpath_result_t curr = make_result_borrow(value, false, false, false);\
-		jsonpath_result_t cond = jsonpath_evaluate_impl(root, curr, jsonpath.expression, symbols, error);\
+		result_t curr = make_result_borrow(value, false, false);\
+		result_t cond = jsonpath_evaluate_impl_basic(root, curr, jsonpath.expression, symbols, error);\
 		if (error->abort)goto fail;\
-		if (cond.is_collection) {\
-			jsonpath_decref(curr);\
-			*error = jsonpath_error_collection_oprand;\
-			goto fail;\
-		}\
-		if (json_is_true(cond.value))json_array_append(ret.value, value);\
-		jsonpath_decref(cond);\
+		if (!filter_accumulate(&ret, value, cond, error)) goto fail;\
 		}
 
-		jsonpath_result_t ret = make_result_new(json_array(), true, true, node.is_constant);
+		size_t size = json_is_object(node.value) ? json_object_size(node.value) : json_is_array(node.value) ? json_array_size(node.value) : 0;
+		result_t ret = make_result_collection(derived_collection(node, size), true, node.is_constant);
 		if(json_is_object(node.value)){
 			const char* key; json_t* value;
 			json_object_foreach(node.value, key, value) for_body
 			return ret;
 		}else if (json_is_array(node.value)) {
+			if (parallel_filter_wanted(size)) {
+				filter_context_t context = { root, jsonpath.expression, symbols };
+				if (!parallel_filter(&ret, node.value, filter_predicate, &context, error)) goto fail;
+				return ret;
+			}
 			size_t index; json_t* value;
 			json_array_foreach(node.value, index, value) for_body
 			return ret;
@@ -340,7 +335,7 @@ static jsonpath_result_t jsonpath_evaluate_impl_path_single(json_t* root, jsonpa
 		}
 #undef for_body
 	fail:
-		jsonpath_decref(ret);
+		result_decref(ret);
 		return error_result;
 	}
 	default:
@@ -348,384 +343,754 @@ static jsonpath_result_t jsonpath_evaluate_impl_path_single(json_t* root, jsonpa
 	}
 }
 
-static jsonpath_result_t path_deal_with_collection(
-	json_t* root, jsonpath_result_t curr_element,
-	path_index_t operator_, jsonpath_result_t node, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error
+// apply simple index to one node visited by recursive descent
+static void recursive_visit(result_t* ret, json_t* value, json_t* simple_index, bool is_constant) {
+	if (!simple_index) { // *, children are appended directly without a temporary collection
+		if (json_is_array(value)) {
+			size_t index, size = json_array_size(value);
+			for (index = 0; index < size; ++index) collection_append(ret->collection, json_array_get(value, index));
+		}
+		else if (json_is_object(value)) {
+			const char* key; json_t* child;
+			json_object_foreach(value, key, child) {
+				collection_append(ret->collection, child);
+			}
+		}
+		return;
+	}
+	// visited nodes are kept alive by anchors of ret
+	collection_accumulate(ret, jsonpath_evaluate_impl_simple_index(make_result_borrow(value, true, is_constant), simple_index));
+}
+
+typedef struct recursive_frame_t {
+	json_t* container;
+	size_t index; // for json array
+	void* iter; // for json object
+} recursive_frame_t;
+
+#define RECURSIVE_LOCAL_FRAMES 32
+
+// visit node and all of its descendants depth first in document order, and test simple index while walking.
+// only matched nodes are kept, and memory used is proportional to depth of the tree.
+void JANSSONPATH_NO_EXPORT recursive_accumulate(result_t* ret, result_t node, json_t* simple_index) {
+	recursive_frame_t local_frames[RECURSIVE_LOCAL_FRAMES];
+	recursive_frame_t* frames = local_frames;
+	size_t depth = 0, capacity = RECURSIVE_LOCAL_FRAMES;
+	json_t* value = node.value;
+	while (value) {
+		recursive_visit(ret, value, simple_index, node.is_constant);
+		if ((json_is_array(value) && json_array_size(value)) || (json_is_object(value) && json_object_size(value))) {
+			if (depth == capacity) {
+				recursive_frame_t* new_frames = do_malloc(sizeof(recursive_frame_t) * capacity * 2);
+				if (!new_frames) break;
+				memcpy(new_frames, frames, sizeof(recursive_frame_t) * depth);
+				if (frames != local_frames) do_free(frames);
+				frames = new_frames;
+				capacity *= 2;
+			}
+			recursive_frame_t frame = { value, 0, json_is_object(value) ? json_object_iter(value) : NULL };
+			frames[depth++] = frame;
+		}
+		// next node is the next sibling of the deepest container which still has one
+		value = NULL;
+		while (depth && !value) {
+			recursive_frame_t* top = &frames[depth - 1];
+			if (json_is_array(top->container)) {
+				if (top->index < json_array_size(top->container)) value = json_array_get(top->container, top->index++);
+			}
+			else if (top->iter) {
+				value = json_object_iter_value(top->iter);
+				top->iter = json_object_iter_next(top->container, top->iter);
+			}
+			if (!value) --depth;
+		}
+	}
+	if (frames != local_frames) do_free(frames);
+}
+
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_recursive(result_t node, json_t* simple_index) {
+	result_t ret = make_result_collection(derived_collection(node, 0), true, node.is_constant);
+	recursive_accumulate(&ret, node, simple_index);
+	return ret;
+}
+
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_sub_exp(result_t node, result_t sub_exp_result, jsonpath_error_t* error) {
+	assert(!node.is_collection);
+	result_t ret = error_result;
+	if (!sub_exp_result.is_collection) {
+		// don't mix up with .* 
+		if (!sub_exp_result.value) return make_result_new(NULL, node.is_right_value, node.is_constant && sub_exp_result.is_constant);
+		ret = jsonpath_evaluate_impl_simple_index(node, sub_exp_result.value);
+		ret.is_constant = ret.is_constant && sub_exp_result.is_constant;
+	}else {
+		*error = jsonpath_error_collection_oprand;
+	}
+
+	result_decref(sub_exp_result);
+	return ret;
+}
+
+JANSSONPATH_NO_EXPORT bool range_bounds(size_t array_size, result_t from, result_t to, long long* first, long long* last) {
+	json_int_t index[2] = { 0, array_size };
+	if(from.value){
+		if (!json_is_number(from.value)) return false;
+		index[0] = json_is_integer(from.value) ? json_integer_value(from.value) : (json_int_t)json_real_value(from.value);
+	}
+	if (to.value) {
+		if (!json_is_number(to.value)) return false;
+		index[1] = json_is_integer(to.value) ? json_integer_value(to.value) : (json_int_t)json_real_value(to.value);
+	}
+
+	// doesn't matter if it returns -1
+	// note that [from, to] is inclusive
+	*first = json_array_index_translate(index[0], array_size);
+	*last = json_array_index_translate(index[1], array_size);
+	return true;
+}
+
+JANSSONPATH_NO_EXPORT result_t jsonpath_evaluate_impl_range(result_t node, result_t from, result_t to) {
+	assert(json_is_array(node.value));
+	long long first, last;
+	if (!range_bounds(json_array_size(node.value), from, to, &first, &last)) return error_result;
+
+	collection_t* items = derived_collection(node, first <= last ? (size_t)(last - first + 1) : 0);
+	long long i;
+	for(i=first;i<=last;++i){
+		collection_append(items, json_array_get(node.value, (size_t)i));
+	}
+	result_t ret = make_result_collection(items, true, node.is_constant && from.is_constant && to.is_constant);
+	return ret;
+}
+
+JANSSONPATH_NO_EXPORT bool filter_test(result_t cond, bool* keep, jsonpath_error_t* error) {
+	if (cond.is_collection) {
+		result_decref(cond);
+		*error = jsonpath_error_collection_oprand;
+		return false;
+	}
+	*keep = json_is_true(cond.value);
+	result_decref(cond);
+	return true;
+}
+
+JANSSONPATH_NO_EXPORT bool filter_accumulate(result_t* ret, json_t* value, result_t cond, jsonpath_error_t* error) {
+	bool keep, is_constant = cond.is_constant;
+	if (!filter_test(cond, &keep, error)) return false;
+	if (keep) collection_append(ret->collection, value);
+	if (!is_constant) ret->is_constant = false;
+	return true;
+}
+
+void JANSSONPATH_NO_EXPORT collection_accumulate(result_t* ret, result_t mapped_element) {
+	if (!mapped_element.is_constant) ret->is_constant = false;
+	if(!mapped_element.is_collection){
+		if (mapped_element.is_borrowed) collection_append(ret->collection, mapped_element.value);
+		else collection_append_new(ret->collection, mapped_element.value);
+	}else{
+		collection_merge(ret->collection, mapped_element.collection);
+	}
+}
+
+static result_t path_deal_with_collection(
+	json_t* root, result_t curr_element,
+	path_index_t operator_, result_t node, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error
 ) {
 	if (!node.is_collection) {
 		return jsonpath_evaluate_impl_path_single(root, curr_element, node, operator_, symbols, error);
 	}
 	else {
-		size_t index; json_t* value;
-		jsonpath_result_t ret = make_result_new(json_array(), true, true, node.is_constant);
-		json_array_foreach(node.value, index, value) {
-			jsonpath_result_t mapped_element = jsonpath_evaluate_impl_path_single(root, curr_element, make_result_borrow(value,false,node.is_right_value,node.is_constant), operator_, symbols, error);
+		collection_t* items = node.collection;
+		size_t index;
+		// elements are borrowed, so are results derived from them. ret keeps node alive for them.
+		result_t ret = make_result_collection(derived_collection(node, items->size), true, node.is_constant);
+		for (index = 0; index < items->size; ++index) {
+			result_t mapped_element = jsonpath_evaluate_impl_path_single(root, curr_element, make_result_borrow(items->items[index], node.is_right_value, node.is_constant), operator_, symbols, error);
 			if (error->abort) {
-				jsonpath_decref(ret);
+				result_decref(ret);
 				return error_result;
 			}
-			if (mapped_element.is_constant) ret.is_constant = false;
-			if(!mapped_element.is_collection){
-				json_array_append_new(ret.value, mapped_element.value);
-			}else{
-				json_array_extend(ret.value, mapped_element.value);
-				jsonpath_decref(mapped_element);
-			}
+			collection_accumulate(&ret, mapped_element);
 		}
 		return ret;
 	}
 }
 
+JANSSONPATH_NO_EXPORT result_t evaluate_path_index(json_t* root, result_t node, path_index_t index, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	return path_deal_with_collection(root, node, index, node, symbols, error);
+}
+
 // note that root is relative, thus second $ in (*$.a[1:20])[$.index] refers to (*$.a[1:20])
-static jsonpath_result_t jsonpath_evaluate_impl_path(json_t* root, jsonpath_result_t curr_element, path_indexes_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error){
+static result_t jsonpath_evaluate_impl_path(json_t* root, result_t curr_element, path_indexes_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error){
 	// inner expression will take curr_root as their curr_element
-	jsonpath_result_t new_root = jsonpath_evaluate_impl(root, curr_element, jsonpath.root_node, symbols, error);
-	jsonpath_result_t ret = jsonpath_incref(new_root);
+	result_t new_root = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath.root_node, symbols, error);
 	if (error->abort) return error_result;
+	result_t ret = result_share(new_root);
+	// $ is a plain json node, a collection is seen as a json_array. it's made only if some index refers to $.
+	json_t* root_array = NULL;
 
 	size_t i;
 	for (i = 0; i < jsonpath.size; ++i) {
-		jsonpath_result_t new_ret = path_deal_with_collection(new_root.value, ret, jsonpath.indexes[i], ret, symbols, error);
-		jsonpath_decref(ret);
-		if (error->abort) return error_result;
+		path_index_t index = jsonpath.indexes[i];
+		if (new_root.is_collection && !root_array && index.tag != INDEX_SUB_SIMPLE && index.tag != INDEX_DOT_RECURSIVE) {
+			root_array = collection_to_array(new_root.collection);
+		}
+		result_t new_ret = path_deal_with_collection(new_root.is_collection ? root_array : new_root.value, ret, index, ret, symbols, error);
+		result_decref(ret);
+		if (error->abort) {
+			ret = error_result;
+			break;
+		}
 		ret = new_ret;
 	}
 
+	json_decref(root_array);
+	result_decref(new_root);
 	return ret;
 }
 
-static json_t* json_binary(path_binary_tag_t operator_, json_t* lhs, json_t* rhs, jsonpath_error_t* error) {
-	(void)(error); // disable warning for build without regex
-	// we don't abort at type error. instead we return NULL
-	switch(operator_){
-	case BINARY_ADD: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_real(json_number_value(lhs) + json_number_value(rhs));
-		}else {
-			return json_integer(json_integer_value(lhs) + json_integer_value(rhs));
-		}
-	}
-	case BINARY_MNU: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_real(json_number_value(lhs) - json_number_value(rhs));
-		}else {
-			return json_integer(json_integer_value(lhs) - json_integer_value(rhs));
-		}
-	}
-	case BINARY_MUL: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_real(json_number_value(lhs) * json_number_value(rhs));
-		}else {
-			return json_integer(json_integer_value(lhs) * json_integer_value(rhs));
-		}
-	}
-	case BINARY_DIV: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_real(json_number_value(lhs) / json_number_value(rhs));
-		}else {
-			return json_integer(json_integer_value(lhs) / json_integer_value(rhs));
-		}
+// a value while evaluating operators. integers, reals and booleans are held inline, so that operators nested in one
+// another(like @.price * @.qty > 100) don't make a json_t at every step; a json_t is made only when the value leaves
+// the operators, by value_box. anything else, missing values and collections stay in result. an operator mapped over
+// a collection gives a vector of values, which the next operator maps in place, and it becomes a collection only
+// when it leaves the operators as well.
+typedef enum value_tag_t {
+	VALUE_RESULT, VALUE_INTEGER, VALUE_REAL, VALUE_BOOLEAN, VALUE_VECTOR
+} value_tag_t;
+
+typedef struct value_t value_t;
+typedef struct value_vector_t value_vector_t;
+
+// laid out like result_t, which it holds if VALUE_RESULT, so that it's still small enough to be passed in registers
+struct value_t {
+	union {
+		json_t* value;
+		collection_t* collection;
+		json_int_t integer;
+		double real;
+		bool boolean;
+		value_vector_t* vector;
+	};
+	unsigned tag : 3;
+	bool is_collection : 1;
+	bool is_right_value : 1;
+	bool is_constant : 1;
+	bool is_borrowed : 1;
+};
+
+// items are owned, none of them missing, borrowed or vectors
+struct value_vector_t {
+	size_t size;
+	value_t items[];
+};
+
+static value_t value_result(result_t result) {
+	value_t ret = { {.value = result.value}, VALUE_RESULT, result.is_collection, result.is_right_value, result.is_constant, result.is_borrowed };
+	return ret;
+}
+
+// in is VALUE_RESULT
+static result_t value_as_result(value_t in) {
+	result_t ret = { {.value = in.value}, in.is_collection, in.is_right_value, in.is_constant, in.is_borrowed };
+	return ret;
+}
+
+static value_t value_missing(bool is_constant) {
+	value_t ret = { {.value = NULL}, VALUE_RESULT, false, true, is_constant, false };
+	return ret;
+}
+
+static value_t value_integer(json_int_t integer, bool is_constant) {
+	value_t ret = { {.integer = integer}, VALUE_INTEGER, false, true, is_constant, false };
+	return ret;
+}
+
+// like json_real, infinity and nan are missing
+static value_t value_real(double real, bool is_constant) {
+	if (!isfinite(real)) return value_missing(is_constant);
+	value_t ret = { {.real = real}, VALUE_REAL, false, true, is_constant, false };
+	return ret;
+}
+
+static value_t value_boolean(bool boolean, bool is_constant) {
+	value_t ret = { {.boolean = boolean}, VALUE_BOOLEAN, false, true, is_constant, false };
+	return ret;
+}
+
+// json is read inline if it's a number or boolean, otherwise it's borrowed
+static value_t value_view(json_t* json, bool is_constant) {
+	switch (json ? json_typeof(json) : JSON_NULL) {
+	case JSON_INTEGER: return value_integer(json_integer_value(json), is_constant);
+	case JSON_REAL: return value_real(json_real_value(json), is_constant);
+	case JSON_TRUE: return value_boolean(true, is_constant);
+	case JSON_FALSE: return value_boolean(false, is_constant);
+	default: {
+		value_t ret = { {.value = json}, VALUE_RESULT, false, true, is_constant, true };
+		return ret;
 	}
-	case BINARY_REMINDER: {
-		if (json_is_integer(lhs) && json_is_integer(rhs)) {
-			return json_integer(json_integer_value(lhs) % json_integer_value(rhs));
-		}else {
-			return NULL;
-		}
 	}
-	case BINARY_BITAND: {
-		if (json_is_integer(lhs) && json_is_integer(rhs)) {
-			return json_integer(json_integer_value(lhs) & json_integer_value(rhs));
-		}else if (json_is_boolean(lhs) && json_is_boolean(rhs)) {
-			return json_boolean(json_boolean_value(lhs) && json_boolean_value(rhs));
-		}else {
-			return NULL;
-		}
+}
+
+// what operators see of in, which still holds its result
+static value_t value_peek(value_t in) {
+	if (in.tag != VALUE_RESULT || in.is_collection) return in;
+	return value_view(in.value, in.is_constant);
+}
+
+static json_t* value_json(value_t in) {
+	switch (in.tag) {
+	case VALUE_INTEGER: return json_integer(in.integer);
+	case VALUE_REAL: return json_real(in.real);
+	case VALUE_BOOLEAN: return json_boolean(in.boolean);
+	default: return in.value;
 	}
-	case BINARY_BITXOR: {
-		if (json_is_integer(lhs) && json_is_integer(rhs)) {
-			return json_integer(json_integer_value(lhs) ^ json_integer_value(rhs));
-		}
-		else if (json_is_boolean(lhs) && json_is_boolean(rhs)) {
-			unsigned lhs_ = json_boolean_value(lhs) ? 1u : 0u;
-			unsigned rhs_ = json_boolean_value(rhs) ? 1u : 0u;
-			return json_boolean(lhs_^rhs_);
-		}
-		else {
-			return NULL;
-		}
+}
+
+static result_t vector_box(value_vector_t* vector, bool is_constant) {
+	collection_t* boxed = collection_new(vector->size);
+	size_t i;
+	for (i = 0; i < vector->size; ++i) collection_append_new(boxed, value_json(vector->items[i]));
+	do_free(vector);
+	return make_result_collection(boxed, true, is_constant);
+}
+
+static result_t value_box(value_t in) {
+	if (in.tag == VALUE_RESULT) return value_as_result(in);
+	if (in.tag == VALUE_VECTOR) return vector_box(in.vector, in.is_constant);
+	return make_result_new(value_json(in), true, in.is_constant);
+}
+
+static void vector_release(value_vector_t* vector) {
+	size_t i;
+	for (i = 0; i < vector->size; ++i) {
+		if (vector->items[i].tag == VALUE_RESULT) json_decref(vector->items[i].value);
 	}
-	case BINARY_BITOR: {
-		if (json_is_integer(lhs) && json_is_integer(rhs)) {
-			return json_integer(json_integer_value(lhs) | json_integer_value(rhs));
-		}
-		else if (json_is_boolean(lhs) && json_is_boolean(rhs)) {
-			return json_boolean(json_boolean_value(lhs) || json_boolean_value(rhs));
-		}
-		else {
-			return NULL;
-		}
+	do_free(vector);
+}
+
+static void value_release(value_t in) {
+	if (in.tag == VALUE_RESULT) result_decref(in);
+	else if (in.tag == VALUE_VECTOR) vector_release(in.vector);
+}
+
+#define value_is_mapped(in) ((in).tag == VALUE_VECTOR || ((in).tag == VALUE_RESULT && (in).is_collection))
+#define value_is_missing(in) ((in).tag == VALUE_RESULT && !(in).is_collection && !(in).value)
+
+// a vector to hold what's mapped from in, the vector of in itself if it is one. NULL if out of memory.
+static value_vector_t* vector_for(value_t in) {
+	if (in.tag == VALUE_VECTOR) return in.vector;
+	value_vector_t* ret = do_malloc(sizeof(value_vector_t) + in.collection->size * sizeof(value_t));
+	if (ret) ret->size = 0;
+	return ret;
+}
+
+#define vector_size(in) ((in).tag == VALUE_VECTOR ? (in).vector->size : (in).collection->size)
+// i-th item of in, a vector or a collection, for reading
+#define vector_item(in, i) ((in).tag == VALUE_VECTOR ? value_peek((in).vector->items[i]) : value_view((in).collection->items[i], (in).is_constant))
+#define value_is_number(in) ((in).tag == VALUE_INTEGER || (in).tag == VALUE_REAL)
+#define value_number(in) ((in).tag == VALUE_REAL ? (in).real : (double)(in).integer)
+
+// numbers are true unless zero. returns false if in is neither number nor boolean
+static bool value_truth(value_t in, bool* truth) {
+	if (in.tag == VALUE_BOOLEAN) *truth = in.boolean;
+	else if (value_is_number(in)) *truth = value_number(in) != 0;
+	else return false;
+	return true;
+}
+
+// as json_equal does
+static bool value_equal(value_t lhs, value_t rhs) {
+	if (lhs.tag != rhs.tag) return false;
+	switch (lhs.tag) {
+	case VALUE_INTEGER: return lhs.integer == rhs.integer;
+	case VALUE_REAL: return lhs.real == rhs.real;
+	case VALUE_BOOLEAN: return lhs.boolean == rhs.boolean;
+	default: return json_equal(lhs.value, rhs.value);
 	}
-	case BINARY_AND: {
-		bool lhs_, rhs_; // silly MSVC can not figure out that they must be assigned
-		if (json_is_number(lhs)) {
-			lhs_ = json_number_value(lhs);
-		}else if(json_is_boolean(lhs)){
-			lhs_ = json_boolean_value(lhs);
-		}else {
-			return NULL;
-		}
-		if (json_is_number(rhs)) {
-			rhs_ = json_number_value(rhs);
-		}
-		else if (json_is_boolean(rhs)) {
-			rhs_ = json_boolean_value(rhs);
-		}
-		else {
-			return NULL;
-		}
-		return json_boolean(lhs_ && rhs_);
+}
+
+#define JSON_INT_BITS ((json_int_t)(sizeof(json_int_t) * CHAR_BIT))
+#define JSON_INT_MAX ((json_int_t)((1ull << (JSON_INT_BITS - 1)) - 1))
+#define JSON_INT_MIN (-JSON_INT_MAX - 1)
+
+// integer arithmetic which overflows is missing, like a real which does, rather than undefined: it runs on literals
+// while compiling, so any jsonpath text must be safe to compile. each returns false if the result does not fit.
+static bool integer_add(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (rhs > 0 ? lhs > JSON_INT_MAX - rhs : lhs < JSON_INT_MIN - rhs) return false;
+	*ret = lhs + rhs;
+	return true;
+}
+
+static bool integer_sub(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (rhs < 0 ? lhs > JSON_INT_MAX + rhs : lhs < JSON_INT_MIN + rhs) return false;
+	*ret = lhs - rhs;
+	return true;
+}
+
+static bool integer_mul(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (lhs > 0) {
+		if (rhs > 0 ? lhs > JSON_INT_MAX / rhs : rhs < JSON_INT_MIN / lhs) return false;
+	} else if (rhs > 0) {
+		if (lhs < JSON_INT_MIN / rhs) return false;
+	} else if (lhs && rhs < JSON_INT_MAX / lhs) {
+		return false;
 	}
+	*ret = lhs * rhs;
+	return true;
+}
+
+// by zero as well
+static bool integer_div(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (!rhs || (lhs == JSON_INT_MIN && rhs == -1)) return false;
+	*ret = lhs / rhs;
+	return true;
+}
+
+static bool integer_rem(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (!rhs) return false;
+	*ret = rhs == -1 ? 0 : lhs % rhs;
+	return true;
+}
+
+// a shift by a negative count, or by the width or more, is missing as well
+static bool integer_lsh(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (rhs < 0 || rhs >= JSON_INT_BITS) return false;
+	if (lhs >= 0 ? lhs > JSON_INT_MAX >> rhs : lhs < JSON_INT_MIN >> rhs) return false;
+	*ret = (json_int_t)((unsigned long long)lhs << rhs);
+	return true;
+}
+
+static bool integer_rsh(json_int_t lhs, json_int_t rhs, json_int_t* ret) {
+	if (rhs < 0 || rhs >= JSON_INT_BITS) return false;
+	*ret = lhs >> rhs;
+	return true;
+}
+
+// lhs and rhs are peeked, neither of them a collection. regex is the pattern of =~ compiled ahead, if rhs is a literal
+static value_t value_binary(path_binary_tag_t operator_, value_t lhs, value_t rhs, bool is_constant, jsonpath_regex_t* regex, jsonpath_error_t* error) {
+	(void)(error); (void)(regex); // disable warning for build without regex
+	// we don't abort at type error. instead we return missing value
+	bool is_real = lhs.tag == VALUE_REAL || rhs.tag == VALUE_REAL;
+	bool is_integer = lhs.tag == VALUE_INTEGER && rhs.tag == VALUE_INTEGER;
+	bool is_boolean = lhs.tag == VALUE_BOOLEAN && rhs.tag == VALUE_BOOLEAN;
+	bool is_number = value_is_number(lhs) && value_is_number(rhs);
+	json_int_t integer;
+	switch(operator_){
+	case BINARY_ADD:
+		if (!is_number) break;
+		if (is_real) return value_real(value_number(lhs) + value_number(rhs), is_constant);
+		if (!integer_add(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_MNU:
+		if (!is_number) break;
+		if (is_real) return value_real(value_number(lhs) - value_number(rhs), is_constant);
+		if (!integer_sub(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_MUL:
+		if (!is_number) break;
+		if (is_real) return value_real(value_number(lhs) * value_number(rhs), is_constant);
+		if (!integer_mul(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_DIV:
+		if (!is_number) break;
+		if (is_real) return value_real(value_number(lhs) / value_number(rhs), is_constant);
+		if (!integer_div(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_REMINDER:
+		if (!is_integer || !integer_rem(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_BITAND:
+		if (is_integer) return value_integer(lhs.integer & rhs.integer, is_constant);
+		if (is_boolean) return value_boolean(lhs.boolean && rhs.boolean, is_constant);
+		break;
+	case BINARY_BITXOR:
+		if (is_integer) return value_integer(lhs.integer ^ rhs.integer, is_constant);
+		if (is_boolean) return value_boolean(lhs.boolean != rhs.boolean, is_constant);
+		break;
+	case BINARY_BITOR:
+		if (is_integer) return value_integer(lhs.integer | rhs.integer, is_constant);
+		if (is_boolean) return value_boolean(lhs.boolean || rhs.boolean, is_constant);
+		break;
+	case BINARY_AND:
 	case BINARY_OR: {
 		bool lhs_, rhs_;
-		if (json_is_number(lhs)) {
-			lhs_ = json_number_value(lhs);
-		}
-		else if (json_is_boolean(lhs)) {
-			lhs_ = json_boolean_value(lhs);
-		}
-		else {
-			return NULL;
-		}
-		if (json_is_number(rhs)) {
-			rhs_ = json_number_value(rhs);
-		}
-		else if (json_is_boolean(rhs)) {
-			rhs_ = json_boolean_value(rhs);
-		}
-		else {
-			return NULL;
-		}
-		return json_boolean(lhs_ || rhs_);
-	}
-	case BINARY_LSH: {
-		if (json_is_integer(lhs) && json_is_integer(rhs)) {
-			return json_integer(json_integer_value(lhs) << json_integer_value(rhs));
-		}else {
-			return NULL;
-		}
-	}
-	case BINARY_RSH: {
-		if (json_is_integer(lhs) && json_is_integer(rhs)) {
-			return json_integer(json_integer_value(lhs) >> json_integer_value(rhs));
-		}
-		else {
-			return NULL;
-		}
-	}
-	case BINARY_EQ: {
-		return json_boolean(json_equal(lhs, rhs));
-	}
-	case BINARY_NE: {
-		return json_boolean(!json_equal(lhs, rhs));
-	}
-	case BINARY_LT: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_boolean(json_number_value(lhs) < json_number_value(rhs));
-		}
-		else {
-			return json_boolean(json_integer_value(lhs) < json_integer_value(rhs));
-		}
-	}
-	case BINARY_GT: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_boolean(json_number_value(lhs) > json_number_value(rhs));
-		}
-		else {
-			return json_boolean(json_integer_value(lhs) > json_integer_value(rhs));
-		}
-	}
-	case BINARY_LE: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_boolean(json_number_value(lhs) <= json_number_value(rhs));
-		}
-		else {
-			return json_boolean(json_integer_value(lhs) <= json_integer_value(rhs));
-		}
-	}
-	case BINARY_GE: {
-		if (!json_is_number(lhs) || !json_is_number(rhs)) return NULL;
-		if (json_is_real(lhs) || json_is_real(rhs)) {
-			return json_boolean(json_number_value(lhs) >= json_number_value(rhs));
-		}
-		else {
-			return json_boolean(json_integer_value(lhs) >= json_integer_value(rhs));
-		}
+		if (!value_truth(lhs, &lhs_) || !value_truth(rhs, &rhs_)) break;
+		return value_boolean(operator_ == BINARY_AND ? lhs_ && rhs_ : lhs_ || rhs_, is_constant);
 	}
+	case BINARY_LSH:
+		if (!is_integer || !integer_lsh(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_RSH:
+		if (!is_integer || !integer_rsh(lhs.integer, rhs.integer, &integer)) break;
+		return value_integer(integer, is_constant);
+	case BINARY_EQ:
+		return value_boolean(value_equal(lhs, rhs), is_constant);
+	case BINARY_NE:
+		return value_boolean(!value_equal(lhs, rhs), is_constant);
+	case BINARY_LT:
+		if (!is_number) break;
+		if (is_real) return value_boolean(value_number(lhs) < value_number(rhs), is_constant);
+		return value_boolean(lhs.integer < rhs.integer, is_constant);
+	case BINARY_GT:
+		if (!is_number) break;
+		if (is_real) return value_boolean(value_number(lhs) > value_number(rhs), is_constant);
+		return value_boolean(lhs.integer > rhs.integer, is_constant);
+	case BINARY_LE:
+		if (!is_number) break;
+		if (is_real) return value_boolean(value_number(lhs) <= value_number(rhs), is_constant);
+		return value_boolean(lhs.integer <= rhs.integer, is_constant);
+	case BINARY_GE:
+		if (!is_number) break;
+		if (is_real) return value_boolean(value_number(lhs) >= value_number(rhs), is_constant);
+		return value_boolean(lhs.integer >= rhs.integer, is_constant);
 	case BINARY_ARRAY_CON: {
-		if (!json_is_array(lhs) || !json_is_array(rhs)) return NULL;
-		json_t* ret = json_copy(lhs);
-		if(!json_array_extend(ret, rhs)) return NULL;
-		return ret;
+		if (lhs.tag != VALUE_RESULT || rhs.tag != VALUE_RESULT || !json_is_array(lhs.value) || !json_is_array(rhs.value)) break;
+		json_t* ret = json_copy(lhs.value);
+		if (json_array_extend(ret, rhs.value)) {
+			json_decref(ret);
+			break;
+		}
+		return value_result(make_result_new(ret, true, is_constant));
 	}
 #ifdef JANSSONPATH_SUPPORT_REGEX
 	case BINARY_REGEX: {
-		if (!json_is_string(lhs) || !json_is_string(rhs)) return NULL;
-		jansson_regex_t* regex = regex_compile(json_string_value(rhs), error);
-		if(error->abort) return NULL;
-		json_t* ret = json_boolean(regex_match(json_string_value(lhs), regex)); // TODO: cache regex for constant
-		regex_free(regex);
-		return ret;
+		if (lhs.tag != VALUE_RESULT || rhs.tag != VALUE_RESULT || !json_is_string(lhs.value) || !json_is_string(rhs.value)) break;
+		if (regex) return value_boolean(regex_test(json_string_value(lhs.value), regex), is_constant);
+		jsonpath_regex_t* runtime_regex = regex_acquire(json_string_value(rhs.value), error);
+		if(error->abort) break;
+		bool matched = regex_test(json_string_value(lhs.value), runtime_regex);
+		regex_release(runtime_regex);
+		return value_boolean(matched, is_constant);
 	}
 #endif
 	default:
 		assert(false);
-		return NULL;
+		break;
 	}
+	return value_missing(is_constant);
 }
 
+static json_t* json_binary(path_binary_tag_t operator_, json_t* lhs, json_t* rhs, jsonpath_regex_t* regex, jsonpath_error_t* error) {
+	return value_box(value_binary(operator_, value_view(lhs, false), value_view(rhs, false), false, regex, error)).value;
+}
 
-static jsonpath_result_t binary_deal_with_collection(
-	path_binary_tag_t operator_, jsonpath_result_t lhs, jsonpath_result_t rhs, jsonpath_error_t* error
+JANSSONPATH_NO_EXPORT result_t binary_deal_with_collection(
+	path_binary_tag_t operator_, result_t lhs, result_t rhs, jsonpath_regex_t* regex, jsonpath_error_t* error
 ) {
 	if (!lhs.is_collection) {
-		return make_result_new(json_binary(operator_, lhs.value, rhs.value, error), false, true, lhs.is_constant && rhs.is_constant);
+		return make_result_new(json_binary(operator_, lhs.value, rhs.value, regex, error), true, lhs.is_constant && rhs.is_constant);
 	}
 	else {
-		size_t index; json_t* value;
-		jsonpath_result_t ret = make_result_new(json_array(), true, true, lhs.is_constant && rhs.is_constant);
-		json_array_foreach(lhs.value, index, value) {
-			json_t* mapped_element = json_binary(operator_, value, rhs.value, error);
-			json_array_append_new(ret.value, mapped_element);
+		const collection_t* items = lhs.collection;
+		collection_t* mapped = collection_new(items->size);
+		size_t index;
+		for (index = 0; index < items->size; ++index) {
+			collection_append_new(mapped, json_binary(operator_, items->items[index], rhs.value, regex, error));
 		}
-		return ret;
+		return make_result_collection(mapped, true, lhs.is_constant && rhs.is_constant);
 	}
 }
 
+// lhs is not released
+static bool value_short_circuit(path_binary_tag_t operator_, value_t lhs, value_t* decided) {
+	if ((operator_ != BINARY_AND && operator_ != BINARY_OR) || value_is_mapped(lhs)) return false;
+	bool lhs_;
+	// lhs neither number nor boolean makes the result missing whatever rhs is
+	if (!value_truth(value_peek(lhs), &lhs_)) *decided = value_missing(lhs.is_constant);
+	else if (lhs_ != (operator_ == BINARY_OR)) return false;
+	else *decided = value_boolean(lhs_, lhs.is_constant);
+	return true;
+}
+
+JANSSONPATH_NO_EXPORT bool logical_short_circuit(path_binary_tag_t operator_, result_t lhs, result_t* decided) {
+	value_t value;
+	if (!value_short_circuit(operator_, value_result(lhs), &value)) return false;
+	*decided = value_box(value);
+	return true;
+}
+
+// every item of lhs(a collection or vector) with rhs, items missing dropped like a collection does. lhs is released.
+static value_t vector_binary(path_binary_tag_t operator_, value_t lhs, value_t rhs, bool is_constant, jsonpath_regex_t* regex, jsonpath_error_t* error) {
+	value_vector_t* vector = vector_for(lhs);
+	if (!vector) {
+		value_release(lhs);
+		*error = jsonpath_error_unknown;
+		return value_result(error_result);
+	}
+	size_t i, size = 0, n = vector_size(lhs);
+	// in place for a vector, what's mapped never outnumbers what's read
+	for (i = 0; i < n; ++i) {
+		value_t mapped = value_binary(operator_, vector_item(lhs, i), rhs, is_constant, regex, error);
+		if (lhs.tag == VALUE_VECTOR) value_release(lhs.vector->items[i]);
+		if (!value_is_missing(mapped)) vector->items[size++] = mapped;
+	}
+	vector->size = size;
+	if (lhs.tag != VALUE_VECTOR) value_release(lhs);
+	value_t ret = { {.vector = vector}, VALUE_VECTOR, false, true, is_constant, false };
+	return ret;
+}
+
+static value_t evaluate_value(json_t* root, result_t curr_element, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error);
+
+// an operand never leaves the operator, so a literal is read from the jsonpath in place, without a reference
+static value_t evaluate_operand(json_t* root, result_t curr_element, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	if (jsonpath->tag == JSON_SINGLE && jsonpath->single.tag == SINGLE_CONST) return value_view(jsonpath->single.constant, true);
+	return evaluate_value(root, curr_element, jsonpath, symbols, error);
+}
+
 // we don't accept right oprand to be collection
 // to do something like 1-$.*, you can translate it into -$.*+1
-static jsonpath_result_t jsonpath_evaluate_impl_binary(json_t* root, jsonpath_result_t curr_element, path_binary_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
-	jsonpath_result_t ret = error_result;
+static value_t evaluate_binary_value(json_t* root, result_t curr_element, path_binary_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	value_t ret = value_result(error_result);
 	
-	jsonpath_result_t lhs_result = jsonpath_evaluate_impl(root, curr_element, jsonpath.lhs, symbols, error);
+	value_t lhs = evaluate_operand(root, curr_element, jsonpath.lhs, symbols, error);
 	if (error->abort) goto lhs_release;
-	jsonpath_result_t rhs_result = jsonpath_evaluate_impl(root, curr_element, jsonpath.rhs, symbols, error);
+	if (value_short_circuit(jsonpath.tag, lhs, &ret)) goto lhs_release;
+	value_t rhs = evaluate_operand(root, curr_element, jsonpath.rhs, symbols, error);
 	if (error->abort) {
 		goto lhs_release;
 	}
-	if(rhs_result.is_collection){
+	if (value_is_mapped(rhs)) {
 		*error = jsonpath_error_collection_oprand;
 		goto rhs_release;
 	}
 
-	ret = binary_deal_with_collection(jsonpath.tag, lhs_result, rhs_result, error);
+	if (value_is_mapped(lhs)) {
+		ret = vector_binary(jsonpath.tag, lhs, value_peek(rhs), lhs.is_constant && rhs.is_constant, jsonpath.regex, error);
+		value_release(rhs);
+		return ret;
+	}
+	ret = value_binary(jsonpath.tag, value_peek(lhs), value_peek(rhs), lhs.is_constant && rhs.is_constant, jsonpath.regex, error);
 rhs_release:
-	jsonpath_decref(rhs_result);
+	value_release(rhs);
 lhs_release:
-	jsonpath_decref(lhs_result);
+	value_release(lhs);
 	return ret;
 }
 
 // we simply forbid to call function against collection
 // if you want to deal with collection, you can cast it into json_array with to_array
-static jsonpath_result_t jsonpath_evaluate_impl_arbitrary(json_t* root, jsonpath_result_t curr_element, path_arbitrary_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+static result_t jsonpath_evaluate_impl_arbitrary(json_t* root, result_t curr_element, path_arbitrary_t jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
 	assert(json_is_string(jsonpath.func_name));
 
-	jsonpath_result_t ret = error_result;
-	jsonpath_symbol_t symbol = get_symbol(symbols, json_string_value(jsonpath.func_name));
+	result_t ret = error_result;
+	jsonpath_symbol_t symbol = jsonpath.symbol ? symbol_incref(*jsonpath.symbol) : get_symbol(symbols, json_string_value(jsonpath.func_name));
 	if (symbol.tag == SYMBOL_MAX) {
 		*error = jsonpath_error_function_not_found(json_string_value(jsonpath.func_name));
 		return error_result;
 	}
 
 	size_t arg_n;
-	json_t** args = do_malloc(jsonpath.size * sizeof(json_t*));
+	// args, followed by whether each of them is borrowed
+	json_t** args = do_malloc(jsonpath.size * (sizeof(json_t*) + sizeof(bool)));
+	bool* borrowed = (bool*)(args + jsonpath.size);
 
 	// we don't assume functon call to be stateless and pure functional, so it's not constant even if all arguments are constant.
 	for (arg_n = 0; arg_n < jsonpath.size; ++arg_n) {
-		jsonpath_result_t arg = jsonpath_evaluate_impl(root, curr_element, jsonpath.nodes[arg_n], symbols, error);
+		result_t arg = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath.nodes[arg_n], symbols, error);
 		if (!error->abort && arg.is_collection) {
 			*error = jsonpath_error_collection_oprand;
-			jsonpath_decref(arg);
+			result_decref(arg);
 		}
 		if (error->abort) goto release;
 		args[arg_n] = arg.value;
+		borrowed[arg_n] = arg.is_borrowed;
 	}
 
-	ret = make_result_new(evaluate_symbol(symbol, args, jsonpath.size), false, true, false);
+	ret = make_result_new(evaluate_symbol(symbol, args, jsonpath.size), true, false);
 	size_t i;
 release: // simple dumb C have no label break, so even do{}while(0); does not work here
 	release_symbol(symbol);
-	for(i=0;i<arg_n;++i) json_decref(args[i]);
+	for(i=0;i<arg_n;++i) if (!borrowed[i]) json_decref(args[i]);
 	do_free(args);
 	return ret;
 }
 
+// in is peeked, not a collection
+static value_t value_unary(path_unary_tag_t op, value_t in, bool is_constant) {
+	switch (op) {
+	case UNARY_NOT:
+		if (in.tag == VALUE_BOOLEAN) return value_boolean(!in.boolean, is_constant);
+		if (value_is_number(in)) return value_boolean(!value_number(in), is_constant); // should we allow number to be negatived?
+		break;
+	case UNARY_NEG:
+		if (in.tag == VALUE_BOOLEAN) return value_boolean(!in.boolean, is_constant);
+		if (in.tag == VALUE_INTEGER && in.integer != JSON_INT_MIN) return value_integer(-in.integer, is_constant);
+		if (in.tag == VALUE_REAL) return value_real(-in.real, is_constant);
+		break;
+	case UNARY_BITNOT:
+		if (in.tag == VALUE_BOOLEAN) return value_boolean(!in.boolean, is_constant);
+		if (in.tag == VALUE_INTEGER) return value_integer(~in.integer, is_constant);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+	return value_missing(is_constant);
+}
+
+// every item of in(a collection or vector), like vector_binary. in is released.
+static value_t vector_unary(path_unary_tag_t op, value_t in, jsonpath_error_t* error) {
+	value_vector_t* vector = vector_for(in);
+	if (!vector) {
+		value_release(in);
+		*error = jsonpath_error_unknown;
+		return value_result(error_result);
+	}
+	size_t i, size = 0, n = vector_size(in);
+	for (i = 0; i < n; ++i) {
+		value_t mapped = value_unary(op, vector_item(in, i), in.is_constant);
+		if (in.tag == VALUE_VECTOR) value_release(in.vector->items[i]);
+		if (!value_is_missing(mapped)) vector->items[size++] = mapped;
+	}
+	vector->size = size;
+	if (in.tag != VALUE_VECTOR) value_release(in);
+	value_t ret = { {.vector = vector}, VALUE_VECTOR, false, true, in.is_constant, false };
+	return ret;
+}
+
 static json_t* json_not(json_t* in){
-	if (json_is_boolean(in)) return json_boolean(!json_boolean_value(in));
-	else if (json_is_number(in)) return json_boolean(!json_number_value(in)); // should we allow number to be negatived?
-	else return NULL;
-} 
+	return value_box(value_unary(UNARY_NOT, value_view(in, false), false)).value;
+}
 
 static json_t* json_neg(json_t* in) {
-	if (json_is_boolean(in)) {
-		return json_boolean(!json_boolean_value(in));
-	}else if (json_is_integer(in)) {
-		return json_integer(-json_integer_value(in));
-	}else if (json_is_real(in)) {
-		return json_real(-json_real_value(in));
-	}else {
-		return NULL;
-	}
+	return value_box(value_unary(UNARY_NEG, value_view(in, false), false)).value;
 }
 
 static json_t* json_bitnot(json_t* in) {
-	if (json_is_boolean(in)) return json_boolean(!json_boolean_value(in));
-	else if (json_is_integer(in)) {
-		return json_integer(~json_integer_value(in));
-	}else {
-		return NULL;
-	}
+	return value_box(value_unary(UNARY_BITNOT, value_view(in, false), false)).value;
 }
 
-static jsonpath_result_t unary_deal_with_collection(
-	jsonpath_result_t origin_result, json_t* (*operator_)(json_t*)
+static result_t unary_deal_with_collection(
+	result_t origin_result, json_t* (*operator_)(json_t*)
 ){
 	if (!origin_result.is_collection) {
-		return make_result_new(operator_(origin_result.value), false, true, origin_result.is_constant);
+		return make_result_new(operator_(origin_result.value), true, origin_result.is_constant);
 	}else{
-		size_t index; json_t* value;
-		jsonpath_result_t ret = make_result_new(json_array(), true, true, origin_result.is_constant);
-		json_array_foreach(origin_result.value,index,value){
-			json_t* mapped_element = operator_(value);
-			json_array_append_new(ret.value, mapped_element);
+		const collection_t* items = origin_result.collection;
+		collection_t* mapped = collection_new(items->size);
+		size_t index;
+		for (index = 0; index < items->size; ++index) {
+			collection_append_new(mapped, operator_(items->items[index]));
 		}
-		return ret;
+		return make_result_collection(mapped, true, origin_result.is_constant);
 	}
 }
 
-static jsonpath_result_t evaluate_unary(path_unary_tag_t op,
-                                        jsonpath_result_t oprand,
+JANSSONPATH_NO_EXPORT result_t evaluate_unary(path_unary_tag_t op,
+                                        result_t oprand,
                                         jsonpath_error_t* error) {
-    jsonpath_result_t ret = error_result;
+    result_t ret = error_result;
     switch (op) {
     case UNARY_NOT:
         return unary_deal_with_collection(oprand, json_not);
     case UNARY_POS:
-        return jsonpath_incref(oprand);
+        return result_share(oprand);
     case UNARY_NEG:
         return unary_deal_with_collection(oprand, json_neg);
     case UNARY_TO_ARRAY:
         if (oprand.is_collection)
-            ret = make_result(
-                oprand.value, false, true,
+            ret = make_result_new(
+                collection_to_array(oprand.collection), true,
                 oprand.is_constant);  // its content can be left value and it
                                       // cannot be recovered by from_list
         else {
@@ -735,8 +1100,9 @@ static jsonpath_result_t evaluate_unary(path_unary_tag_t op,
     // should not apply to collection, as it breaks rule of *&x = x = &* x
     case UNARY_FROM_ARRAY:
         if (!oprand.is_collection && json_is_array(oprand.value))
-            ret = make_result(oprand.value, true, oprand.is_right_value,
-                              oprand.is_constant);
+            ret = make_result_collection(json_get_all_property(oprand),
+                                         oprand.is_right_value,
+                                         oprand.is_constant);
         else {
             *error = jsonpath_error_from_array_collection;
         }
@@ -749,29 +1115,52 @@ static jsonpath_result_t evaluate_unary(path_unary_tag_t op,
     return ret;
 }
 
-static jsonpath_result_t jsonpath_evaluate_impl_basic(json_t* root, jsonpath_result_t curr_element, jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+// operators are evaluated on values, and so are their operands, so nothing is boxed between them
+static value_t evaluate_value(json_t* root, result_t curr_element, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	switch (jsonpath->tag) {
+	case JSON_UNARY: {
+		path_unary_tag_t op = jsonpath->unary.tag;
+		if (op == UNARY_POS) return evaluate_value(root, curr_element, jsonpath->unary.node, symbols, error);
+		if (op != UNARY_NOT && op != UNARY_NEG && op != UNARY_BITNOT) break;
+		value_t node = evaluate_operand(root, curr_element, jsonpath->unary.node, symbols, error);
+		if (error->abort) return node;
+		if (value_is_mapped(node)) return vector_unary(op, node, error);
+		value_t ret = value_unary(op, value_peek(node), node.is_constant);
+		value_release(node);
+		return ret;
+	}
+	case JSON_BINARY:
+		return evaluate_binary_value(root, curr_element, jsonpath->binary, symbols, error);
+	default: break;
+	}
+	return value_result(jsonpath_evaluate_impl_basic(root, curr_element, jsonpath, symbols, error));
+}
+
+static result_t jsonpath_evaluate_impl_basic(json_t* root, result_t curr_element, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
 	switch (jsonpath->tag) {
 	case JSON_SINGLE:// single does not promote to collection
 		switch (jsonpath->single.tag) {
 		case SINGLE_ROOT:
-			return make_result(root, false, false, false);
+			return make_result_borrow(root, false, false);
 		case SINGLE_CURR:
-			return jsonpath_incref(curr_element);
+			return result_share(curr_element);
 		case SINGLE_CONST:
-			return make_result(jsonpath->single.constant, false, true, true);
+			return make_result(jsonpath->single.constant, true, true);
 		default: break;
 		}
 	case JSON_INDEX:
 		return jsonpath_evaluate_impl_path(root, curr_element, jsonpath->indexes, symbols, error);
 	case JSON_UNARY: {
-		jsonpath_result_t node = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath->unary.node, symbols, error);
+		path_unary_tag_t op = jsonpath->unary.tag;
+		if (op != UNARY_TO_ARRAY && op != UNARY_FROM_ARRAY) return value_box(evaluate_value(root, curr_element, jsonpath, symbols, error));
+		result_t node = jsonpath_evaluate_impl_basic(root, curr_element, jsonpath->unary.node, symbols, error);
 		if (error->abort) return node;
-		jsonpath_result_t ret = evaluate_unary(jsonpath->unary.tag, node, error);
-		jsonpath_decref(node);
+		result_t ret = evaluate_unary(op, node, error);
+		result_decref(node);
 		return ret;
 	}
 	case JSON_BINARY:
-		return jsonpath_evaluate_impl_binary(root, curr_element, jsonpath->binary, symbols, error);
+		return value_box(evaluate_binary_value(root, curr_element, jsonpath->binary, symbols, error));
 	case JSON_ARBITRAY:
 		return jsonpath_evaluate_impl_arbitrary(root, curr_element, jsonpath->arbitrary, symbols, error);
 	default: break;
@@ -780,9 +1169,83 @@ static jsonpath_result_t jsonpath_evaluate_impl_basic(json_t* root, jsonpath_res
 	return error_result;
 }
 
-JANSSONPATH_EXPORT jsonpath_result_t jsonpath_evaluate(json_t* root, jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_evaluate(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
 	*error = jsonpath_error_ok;
-	jsonpath_result_t root_curr = make_result_new(root, false, false, false);
-	jsonpath_result_t ret = jsonpath_evaluate_impl(root, root_curr, jsonpath, symbols, error);
-	return ret;
+	result_t root_curr = make_result_borrow(root, false, false);
+	return result_export(jsonpath_evaluate_impl_basic(root, root_curr, jsonpath, symbols, error));
+}
+
+JANSSONPATH_EXPORT jsonpath_borrowed_t jsonpath_evaluate_borrowed(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	*error = jsonpath_error_ok;
+	result_t root_curr = make_result_borrow(root, false, false);
+	return result_export_borrowed(jsonpath_evaluate_impl_basic(root, root_curr, jsonpath, symbols, error));
+}
+
+void JANSSONPATH_EXPORT jsonpath_borrowed_release(jsonpath_borrowed_t* result) {
+	if (result->owner) collection_decref(result->owner);
+	result->owner = NULL;
+	result->values = NULL;
+	result->size = 0;
+}
+
+void JANSSONPATH_NO_EXPORT unbind_symbol(path_arbitrary_t* arbitrary) {
+	if (!arbitrary->symbol) return;
+	release_symbol(*arbitrary->symbol);
+	do_free(arbitrary->symbol);
+	arbitrary->symbol = NULL;
+}
+
+static void bind_symbols(jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols);
+
+static void bind_symbols_index(path_index_t index, jsonpath_symbol_lookup_t* symbols) {
+	switch (index.tag) {
+	case INDEX_SUB_EXP:
+	case INDEX_FILTER:
+		bind_symbols(index.expression, symbols);
+		return;
+	case INDEX_SUB_RANGE:
+		bind_symbols(index.range[0], symbols);
+		bind_symbols(index.range[1], symbols);
+		return;
+	default:
+		return;
+	}
+}
+
+static void bind_symbols(jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols) {
+	if (!jsonpath) return;
+	size_t i;
+	switch (jsonpath->tag) {
+	case JSON_INDEX:
+		bind_symbols(jsonpath->indexes.root_node, symbols);
+		for (i = 0; i < jsonpath->indexes.size; ++i) bind_symbols_index(jsonpath->indexes.indexes[i], symbols);
+		return;
+	case JSON_UNARY:
+		bind_symbols(jsonpath->unary.node, symbols);
+		return;
+	case JSON_BINARY: {
+		// walk down the left side with a loop, so that long chains don't recurse
+		jsonpath_t* node;
+		for (node = jsonpath; node->tag == JSON_BINARY; node = node->binary.lhs) bind_symbols(node->binary.rhs, symbols);
+		bind_symbols(node, symbols);
+		return;
+	}
+	case JSON_ARBITRAY: {
+		path_arbitrary_t* arbitrary = &jsonpath->arbitrary;
+		for (i = 0; i < arbitrary->size; ++i) bind_symbols(arbitrary->nodes[i], symbols);
+		unbind_symbol(arbitrary);
+		jsonpath_symbol_t symbol = get_symbol(symbols, json_string_value(arbitrary->func_name));
+		if (symbol.tag == SYMBOL_MAX) return;
+		arbitrary->symbol = do_malloc(sizeof(jsonpath_symbol_t));
+		if (arbitrary->symbol) *arbitrary->symbol = symbol;
+		else release_symbol(symbol); // it's just looked up at evaluation
+		return;
+	}
+	default:
+		return;
+	}
+}
+
+void JANSSONPATH_EXPORT jsonpath_bind(jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols) {
+	bind_symbols(jsonpath, symbols);
 }
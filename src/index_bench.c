@@ -0,0 +1,81 @@
+#include "janssonpath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Time .name steps over a large array of objects, which is what filters
+// spend most of their time on, by both engines.
+// usage: index_bench [object_count [repeat]]
+
+#define FIELD_N 16
+
+static const char* expressions[] = {
+	"$.items[?(@.a_rather_long_property_name_15 > 50)].a_rather_long_property_name_00",
+	"$.items.*.a_rather_long_property_name_07",
+	"$..a_rather_long_property_name_03",
+};
+
+static json_t* make_document(size_t count) {
+	json_t* items = json_array();
+	char key[64];
+	size_t i;
+	int j;
+	srand(1);
+	for (i = 0; i < count; ++i) {
+		json_t* item = json_object();
+		for (j = 0; j < FIELD_N; ++j) {
+			snprintf(key, sizeof(key), "a_rather_long_property_name_%02d", j);
+			json_object_set_new(item, key, json_integer(rand() % 100));
+		}
+		json_array_append_new(items, item);
+	}
+	json_t* ret = json_object();
+	json_object_set_new(ret, "items", items);
+	return ret;
+}
+
+static double elapsed_ms(clock_t begin) {
+	return (double)(clock() - begin) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 100000;
+	int repeat = argc > 2 ? atoi(argv[2]) : 5;
+	json_t* document = make_document(count);
+	size_t i;
+	printf("%lu objects of %d members, best of %d\n", (unsigned long)count, FIELD_N, repeat);
+
+	for (i = 0; i < sizeof(expressions) / sizeof(*expressions); ++i) {
+		jsonpath_error_t error;
+		jsonpath_t* path = jsonpath_compile(expressions[i], &error);
+		if (!path) {
+			printf("%s: does not compile: %s\n", expressions[i], error.reason);
+			continue;
+		}
+		jsonpath_bytecode_t* bytecode = jsonpath_bytecode_compile(path);
+		double best_tree = -1, best_bytecode = -1;
+		size_t matched = 0;
+		int r;
+		for (r = 0; r < repeat; ++r) {
+			clock_t begin = clock();
+			jsonpath_result_t result = jsonpath_evaluate(document, path, NULL, &error);
+			double ms = elapsed_ms(begin);
+			if (best_tree < 0 || ms < best_tree) best_tree = ms;
+			matched = json_is_array(result.value) ? json_array_size(result.value) : 0;
+			jsonpath_decref(result);
+
+			if (!bytecode) continue;
+			begin = clock();
+			result = jsonpath_evaluate_bytecode(document, bytecode, NULL, &error);
+			ms = elapsed_ms(begin);
+			if (best_bytecode < 0 || ms < best_bytecode) best_bytecode = ms;
+			jsonpath_decref(result);
+		}
+		printf("%-82s %8lu matched  tree %9.3f ms  bytecode %9.3f ms\n", expressions[i], (unsigned long)matched, best_tree, best_bytecode);
+		jsonpath_bytecode_release(bytecode);
+		jsonpath_release(path);
+	}
+	json_decref(document);
+	return 0;
+}
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <string.h>
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+#include "private/jsonpath_ast.h"
+#include "private/evaluate_impl.h"
+
+// paths from $(or the outermost @) are evaluated lazily: every index is a stage holding the node it's applied to and
+// a cursor into what it gives for that node, and asking for the next match pulls from the last stage, which pulls
+// from the stage before it when its node is used up. as an index applied to a collection is the same as applied to
+// each element in order, matches come in the order jsonpath_evaluate gives. memory is a cursor per index, plus a
+// frame per level of the tree under .. steps. other jsonpaths are evaluated at once, and matches handed out from the
+// result.
+// each stage also keeps the key or index of the node it gave last, so the stages are a chain of steps from $ to the
+// match, which makes the location of the match when asked for.
+
+typedef struct cursor_t {
+	json_t* container;
+	size_t index; // for json array
+	void* iter; // for json object
+	const char* key; // of the member taken last, NULL for json array
+} cursor_t;
+
+// the key, or the index in json array if key is NULL, a node is taken from its parent by
+typedef struct location_step_t {
+	const char* key;
+	size_t index;
+} location_step_t;
+
+typedef struct iter_stage_t {
+	path_index_t index;
+	result_t node; // being indexed, valid if the stage is below the depth of the iterator
+	bool started;
+	cursor_t cursor; // children of node, or of the node visited for ..*
+	long long last; // of a range
+	location_step_t step; // of the node given last
+	json_t* step_key; // held for step, if the key is the value of [()]
+	// for .., the node visited, whether the index is tested on it, and the containers it's nested in
+	json_t* visiting;
+	bool tested;
+	cursor_t* frames;
+	size_t depth;
+	size_t capacity;
+} iter_stage_t;
+
+struct jsonpath_iter_t {
+	json_t* root;
+	jsonpath_symbol_lookup_t* symbols;
+	result_t current; // handed out last time
+	// lazy
+	iter_stage_t* stages;
+	size_t size;
+	size_t depth; // stages with a node
+	bool root_taken;
+	// evaluated at once
+	jsonpath_result_t result;
+	size_t next;
+	bool is_lazy;
+};
+
+static void cursor_start(cursor_t* cursor, json_t* container) {
+	cursor->container = container;
+	cursor->index = 0;
+	cursor->iter = json_is_object(container) ? json_object_iter(container) : NULL;
+}
+
+static json_t* cursor_next(cursor_t* cursor) {
+	cursor->key = NULL;
+	if (json_is_array(cursor->container)) return json_array_get(cursor->container, cursor->index++);
+	if (!cursor->iter) return NULL;
+	json_t* ret = json_object_iter_value(cursor->iter);
+	cursor->key = json_object_iter_key(cursor->iter);
+	cursor->iter = json_object_iter_next(cursor->container, cursor->iter);
+	return ret;
+}
+
+static location_step_t cursor_step(const cursor_t* cursor) {
+	location_step_t ret = { cursor->key, cursor->index - 1 };
+	return ret;
+}
+
+// step of a string or number simple index to container
+static location_step_t simple_step(const json_t* container, const json_t* simple_index) {
+	location_step_t ret = { NULL, 0 };
+	if (json_is_string(simple_index)) {
+		ret.key = json_string_value(simple_index);
+	} else if (json_is_number(simple_index)) {
+		json_int_t index = json_is_integer(simple_index) ? json_integer_value(simple_index) : (json_int_t)json_real_value(simple_index);
+		ret.index = (size_t)json_array_index_translate(index, json_array_size(container));
+	}
+	return ret;
+}
+
+static bool refers_current(const jsonpath_t* jsonpath);
+
+static bool index_refers_current(const path_index_t* index) {
+	switch (index->tag) {
+	case INDEX_SUB_EXP:
+		return refers_current(index->expression);
+	case INDEX_SUB_RANGE:
+		return refers_current(index->range[0]) || refers_current(index->range[1]);
+	default: // @ in a filter is the element tested
+		return false;
+	}
+}
+
+static bool refers_current(const jsonpath_t* jsonpath) {
+	if (!jsonpath) return false;
+	size_t i;
+	switch (jsonpath->tag) {
+	case JSON_SINGLE:
+		return jsonpath->single.tag == SINGLE_CURR;
+	case JSON_INDEX:
+		if (refers_current(jsonpath->indexes.root_node)) return true;
+		for (i = 0; i < jsonpath->indexes.size; ++i) {
+			if (index_refers_current(&jsonpath->indexes.indexes[i])) return true;
+		}
+		return false;
+	case JSON_UNARY:
+		return refers_current(jsonpath->unary.node);
+	case JSON_BINARY: {
+		// walk down the left side with a loop, so that long chains don't recurse
+		const jsonpath_t* node;
+		for (node = jsonpath; node->tag == JSON_BINARY; node = node->binary.lhs) {
+			if (refers_current(node->binary.rhs)) return true;
+		}
+		return refers_current(node);
+	}
+	case JSON_ARBITRAY:
+		for (i = 0; i < jsonpath->arbitrary.size; ++i) {
+			if (refers_current(jsonpath->arbitrary.nodes[i])) return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+static bool makes_collection(const path_index_t* index) {
+	return (index->tag == INDEX_SUB_SIMPLE && !index->simple_index) || index->tag == INDEX_DOT_RECURSIVE || index->tag == INDEX_SUB_RANGE
+		|| index->tag == INDEX_FILTER;
+}
+
+// @ in [()] and in bounds of ranges is the whole result so far, which is known by each stage only while there's
+// just one node
+static bool is_lazy(const jsonpath_t* jsonpath) {
+	if (jsonpath->tag != JSON_INDEX) return false;
+	const jsonpath_t* root_node = jsonpath->indexes.root_node;
+	if (root_node->tag != JSON_SINGLE || (root_node->single.tag != SINGLE_ROOT && root_node->single.tag != SINGLE_CURR)) return false;
+	bool single = true;
+	size_t i;
+	for (i = 0; i < jsonpath->indexes.size; ++i) {
+		const path_index_t* index = &jsonpath->indexes.indexes[i];
+		if (!single && index_refers_current(index)) return false;
+		if (makes_collection(index)) single = false;
+	}
+	return true;
+}
+
+// a sub expression or bound of a range, with @ being node
+static result_t evaluate_operand(const jsonpath_iter_t* iter, const iter_stage_t* stage, const jsonpath_t* expression, jsonpath_error_t* error) {
+	return evaluate_condition(iter->root, stage->node.value, expression, iter->symbols, error);
+}
+
+static bool start_range(const jsonpath_iter_t* iter, iter_stage_t* stage, jsonpath_error_t* error) {
+	result_t bounds[2] = { make_result_new(NULL, true, true), make_result_new(NULL, true, true) };
+	long long first = 0;
+	size_t i;
+	stage->last = -1;
+	for (i = 0; i < 2 && !error->abort; ++i) {
+		if (!stage->index.range[i]) continue;
+		bounds[i] = evaluate_operand(iter, stage, stage->index.range[i], error);
+		if (!error->abort && bounds[i].is_collection) *error = jsonpath_error_collection_oprand;
+	}
+	// bounds which are not numbers take nothing
+	if (!error->abort && !range_bounds(json_array_size(stage->node.value), bounds[0], bounds[1], &first, &stage->last)) stage->last = -1;
+	result_decref(bounds[1]);
+	result_decref(bounds[0]);
+	stage->cursor.index = first < 0 ? 0 : (size_t)first;
+	return !error->abort;
+}
+
+// the index applied to one node visited by .., which gives one node at most unless it's *
+static result_t recursive_next(iter_stage_t* stage, jsonpath_error_t* error) {
+	for (;;) {
+		if (stage->visiting) {
+			if (!stage->index.simple_index) {
+				json_t* child = cursor_next(&stage->cursor);
+				if (child) {
+					stage->step = cursor_step(&stage->cursor);
+					return make_result_borrow(child, true, stage->node.is_constant);
+				}
+			} else if (!stage->tested) {
+				stage->tested = true;
+				result_t ret = jsonpath_evaluate_impl_simple_index(make_result_borrow(stage->visiting, true, stage->node.is_constant), stage->index.simple_index);
+				stage->step = simple_step(stage->visiting, stage->index.simple_index);
+				if (ret.value) return ret;
+			}
+			json_t* value = stage->visiting;
+			stage->visiting = NULL;
+			if ((json_is_array(value) && json_array_size(value)) || (json_is_object(value) && json_object_size(value))) {
+				if (stage->depth == stage->capacity) {
+					size_t capacity = stage->capacity ? stage->capacity * 2 : 16;
+					cursor_t* frames = do_malloc(sizeof(cursor_t) * capacity);
+					if (!frames) {
+						*error = jsonpath_error_unknown;
+						return make_result_new(NULL, true, true);
+					}
+					if (stage->depth) memcpy(frames, stage->frames, sizeof(cursor_t) * stage->depth);
+					if (stage->frames) do_free(stage->frames);
+					stage->frames = frames;
+					stage->capacity = capacity;
+				}
+				cursor_start(&stage->frames[stage->depth++], value);
+			}
+		}
+		// the next node is the next sibling of the deepest container which still has one
+		while (stage->depth && !stage->visiting) {
+			stage->visiting = cursor_next(&stage->frames[stage->depth - 1]);
+			if (!stage->visiting) --stage->depth;
+		}
+		if (!stage->visiting) return make_result_new(NULL, true, true);
+		stage->tested = false;
+		cursor_start(&stage->cursor, stage->visiting);
+	}
+}
+
+// next of what stage gives for its node, NULL value when used up
+static result_t stage_next(const jsonpath_iter_t* iter, iter_stage_t* stage, jsonpath_error_t* error) {
+	result_t node = stage->node;
+	bool started = stage->started;
+	stage->started = true;
+	switch (stage->index.tag) {
+	case INDEX_SUB_SIMPLE:
+		if (!stage->index.simple_index) {
+			if (!started) cursor_start(&stage->cursor, node.value);
+			json_t* child = cursor_next(&stage->cursor);
+			stage->step = cursor_step(&stage->cursor);
+			return child ? make_result_borrow(child, node.is_right_value, node.is_constant) : make_result_new(NULL, true, true);
+		}
+		if (started) break;
+		stage->step = simple_step(node.value, stage->index.simple_index);
+		return jsonpath_evaluate_impl_simple_index(node, stage->index.simple_index);
+	case INDEX_DOT_RECURSIVE:
+		if (!started) {
+			stage->visiting = node.value;
+			stage->depth = 0;
+			stage->tested = false;
+			cursor_start(&stage->cursor, node.value);
+		}
+		return recursive_next(stage, error);
+	case INDEX_SUB_EXP: {
+		if (started) break;
+		result_t sub_exp_result = evaluate_operand(iter, stage, stage->index.expression, error);
+		if (error->abort) break;
+		if (!sub_exp_result.is_collection) {
+			stage->step = simple_step(node.value, sub_exp_result.value);
+			if (stage->step.key) stage->step_key = json_incref(sub_exp_result.value);
+		}
+		return jsonpath_evaluate_impl_sub_exp(node, sub_exp_result, error);
+	}
+	case INDEX_SUB_RANGE:
+		if (!json_is_array(node.value)) break;
+		if (!started && !start_range(iter, stage, error)) break;
+		if ((long long)stage->cursor.index > stage->last) break;
+		stage->step.key = NULL;
+		stage->step.index = stage->cursor.index;
+		return make_result_borrow(json_array_get(node.value, stage->cursor.index++), node.is_right_value, node.is_constant);
+	case INDEX_FILTER: {
+		if (!started) cursor_start(&stage->cursor, node.value);
+		json_t* child;
+		while ((child = cursor_next(&stage->cursor))) {
+			bool keep;
+			result_t cond = evaluate_condition(iter->root, child, stage->index.expression, iter->symbols, error);
+			if (error->abort || !filter_test(cond, &keep, error)) break;
+			if (keep) {
+				stage->step = cursor_step(&stage->cursor);
+				return make_result_borrow(child, node.is_right_value, node.is_constant);
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return make_result_new(NULL, true, true);
+}
+
+static void stage_drop(iter_stage_t* stage) {
+	result_decref(stage->node);
+	stage->node = make_result_new(NULL, true, true);
+	json_decref(stage->step_key);
+	stage->step_key = NULL;
+}
+
+JANSSONPATH_EXPORT jsonpath_iter_t* jsonpath_iter_begin(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	*error = jsonpath_error_ok;
+	bool lazy = is_lazy(jsonpath);
+	size_t size = lazy ? jsonpath->indexes.size : 0, i;
+	jsonpath_iter_t* iter = do_malloc(sizeof(jsonpath_iter_t) + sizeof(iter_stage_t) * size);
+	if (!iter) {
+		*error = jsonpath_error_unknown;
+		return NULL;
+	}
+	iter->root = root;
+	iter->symbols = symbols;
+	iter->current = make_result_new(NULL, true, true);
+	iter->stages = (iter_stage_t*)(iter + 1);
+	iter->size = size;
+	iter->depth = 0;
+	iter->root_taken = false;
+	iter->next = 0;
+	iter->is_lazy = lazy;
+	if (lazy) {
+		memset(iter->stages, 0, sizeof(iter_stage_t) * size);
+		for (i = 0; i < size; ++i) iter->stages[i].index = jsonpath->indexes.indexes[i];
+		return iter;
+	}
+	iter->result = jsonpath_evaluate(root, jsonpath, symbols, error);
+	if (error->abort) {
+		do_free(iter);
+		return NULL;
+	}
+	return iter;
+}
+
+JANSSONPATH_EXPORT json_t* jsonpath_iter_next(jsonpath_iter_t* iter, jsonpath_error_t* error) {
+	*error = jsonpath_error_ok;
+	result_decref(iter->current);
+	iter->current = make_result_new(NULL, true, true);
+	if (!iter->is_lazy) {
+		if (!iter->result.is_collection) return iter->next++ ? NULL : iter->result.value;
+		return json_array_get(iter->result.value, iter->next++);
+	}
+
+	for (;;) {
+		result_t got;
+		if (!iter->depth) {
+			if (iter->root_taken) return NULL;
+			iter->root_taken = true;
+			got = make_result_borrow(iter->root, false, false);
+		} else {
+			iter_stage_t* stage = &iter->stages[iter->depth - 1];
+			got = stage_next(iter, stage, error);
+			if (error->abort) {
+				result_decref(got);
+				// the iteration ends with the error
+				while (iter->depth) stage_drop(&iter->stages[--iter->depth]);
+				iter->root_taken = true;
+				return NULL;
+			}
+			if (!got.value) {
+				stage_drop(stage);
+				--iter->depth;
+				continue;
+			}
+		}
+		if (!got.value) continue;
+		if (iter->depth == iter->size) {
+			iter->current = got;
+			return got.value;
+		}
+		iter_stage_t* stage = &iter->stages[iter->depth++];
+		stage->node = got;
+		stage->started = false;
+	}
+}
+
+void JANSSONPATH_EXPORT jsonpath_iter_end(jsonpath_iter_t* iter) {
+	if (!iter) return;
+	size_t i;
+	result_decref(iter->current);
+	if (iter->is_lazy) {
+		while (iter->depth) stage_drop(&iter->stages[--iter->depth]);
+		for (i = 0; i < iter->size; ++i) {
+			if (iter->stages[i].frames) do_free(iter->stages[i].frames);
+		}
+	} else {
+		jsonpath_decref(iter->result);
+	}
+	do_free(iter);
+}
+
+static bool append_step(json_t* location, location_step_t step) {
+	return !json_array_append_new(location, step.key ? json_string(step.key) : json_integer((json_int_t)step.index));
+}
+
+JANSSONPATH_EXPORT json_t* jsonpath_iter_location(const jsonpath_iter_t* iter) {
+	// only nodes of the document are borrowed
+	if (!iter->is_lazy || !iter->current.value || !iter->current.is_borrowed) return NULL;
+	json_t* ret = json_array();
+	bool ok = ret != NULL;
+	size_t i, j;
+	for (i = 0; ok && i < iter->size; ++i) {
+		const iter_stage_t* stage = &iter->stages[i];
+		if (stage->index.tag == INDEX_DOT_RECURSIVE) {
+			for (j = 0; ok && j < stage->depth; ++j) ok = append_step(ret, cursor_step(&stage->frames[j]));
+		}
+		ok = ok && append_step(ret, stage->step);
+	}
+	if (!ok) {
+		json_decref(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+// text of location written to out if it's not NULL, returns its length
+static size_t format_location(const json_t* location, bool pointer, char* out) {
+	size_t size = 0, i;
+#define put(c) do { if (out) out[size] = (c); ++size; } while (0)
+	if (!pointer) put('$');
+	for (i = 0; i < json_array_size(location); ++i) {
+		const json_t* step = json_array_get(location, i);
+		if (!json_is_string(step)) {
+			char number[32];
+			int length = snprintf(number, sizeof(number), "%" JSON_INTEGER_FORMAT, json_integer_value(step)), k;
+			put(pointer ? '/' : '[');
+			for (k = 0; k < length; ++k) put(number[k]);
+			if (!pointer) put(']');
+			continue;
+		}
+		const char* key = json_string_value(step);
+		size_t key_size = json_string_length(step), k;
+		if (pointer) {
+			// ~ and / escaped as ~0 and ~1
+			put('/');
+			for (k = 0; k < key_size; ++k) {
+				if (key[k] == '~') { put('~'); put('0'); }
+				else if (key[k] == '/') { put('~'); put('1'); }
+				else put(key[k]);
+			}
+			continue;
+		}
+		// normalized path: ' and \ escaped, control characters as in json
+		put('[');
+		put('\'');
+		for (k = 0; k < key_size; ++k) {
+			unsigned char c = (unsigned char)key[k];
+			if (c == '\'' || c == '\\') { put('\\'); put((char)c); }
+			else if (c == '\b') { put('\\'); put('b'); }
+			else if (c == '\f') { put('\\'); put('f'); }
+			else if (c == '\n') { put('\\'); put('n'); }
+			else if (c == '\r') { put('\\'); put('r'); }
+			else if (c == '\t') { put('\\'); put('t'); }
+			else if (c < 0x20) {
+				static const char hex[] = "0123456789abcdef";
+				put('\\'); put('u'); put('0'); put('0'); put(hex[c >> 4]); put(hex[c & 0xf]);
+			}
+			else put((char)c);
+		}
+		put('\'');
+		put(']');
+	}
+#undef put
+	return size;
+}
+
+static json_t* location_string(const json_t* location, bool pointer) {
+	if (!json_is_array(location)) return NULL;
+	size_t size = format_location(location, pointer, NULL);
+	char* text = do_malloc(size + 1);
+	if (!text) return NULL;
+	format_location(location, pointer, text);
+	json_t* ret = json_stringn(text, size);
+	do_free(text);
+	return ret;
+}
+
+JANSSONPATH_EXPORT json_t* jsonpath_location_normalized(const json_t* location) {
+	return location_string(location, false);
+}
+
+JANSSONPATH_EXPORT json_t* jsonpath_location_pointer(const json_t* location) {
+	return location_string(location, true);
+}
+
+JANSSONPATH_EXPORT bool jsonpath_exists(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	jsonpath_iter_t* iter = jsonpath_iter_begin(root, jsonpath, symbols, error);
+	if (!iter) return false;
+	bool ret = jsonpath_iter_next(iter, error) != NULL;
+	jsonpath_iter_end(iter);
+	return ret;
+}
+
+JANSSONPATH_EXPORT json_t* jsonpath_evaluate_first(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	jsonpath_iter_t* iter = jsonpath_iter_begin(root, jsonpath, symbols, error);
+	if (!iter) return NULL;
+	json_t* ret = json_incref(jsonpath_iter_next(iter, error));
+	jsonpath_iter_end(iter);
+	return ret;
+}
+
+JANSSONPATH_EXPORT json_t* jsonpath_evaluate_limit(json_t* root, const jsonpath_t* jsonpath, size_t limit, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	jsonpath_iter_t* iter = jsonpath_iter_begin(root, jsonpath, symbols, error);
+	if (!iter) return NULL;
+	json_t* ret = json_array();
+	json_t* value;
+	while (json_array_size(ret) < limit && (value = jsonpath_iter_next(iter, error))) json_array_append(ret, value);
+	jsonpath_iter_end(iter);
+	if (error->abort) {
+		json_decref(ret);
+		return NULL;
+	}
+	return ret;
+}
+
+JANSSONPATH_EXPORT size_t jsonpath_count(json_t* root, const jsonpath_t* jsonpath, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	jsonpath_iter_t* iter = jsonpath_iter_begin(root, jsonpath, symbols, error);
+	if (!iter) return 0;
+	size_t ret = 0;
+	while (jsonpath_iter_next(iter, error)) ++ret;
+	jsonpath_iter_end(iter);
+	return error->abort ? 0 : ret;
+}
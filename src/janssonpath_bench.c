@@ -0,0 +1,432 @@
+#include "janssonpath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Benchmark suite: compile throughput, evaluation latency(p50/p99) and allocations per query of representative
+// expressions, with both engines, on the bookstore document of Goessner's JSONPath article and on generated
+// documents of given sizes. jsonpaths which can be streamed are also timed from json text, loaded and then evaluated
+// and streamed. many fields of each document are also taken one by one and with one plan. results are written as
+// JSON, so that runs of different releases can be compared.
+// usage: janssonpath_bench [--sizes 1K,1M,...] [--time seconds_per_case] [--threads n] [--output file]
+// --threads runs filters over arrays of 1024 elements or more with n threads besides the evaluating one.
+// sizes take K M G suffixes. generated documents are built in memory, 1G needs tens of GB of it.
+
+static const char bookstore[] =
+	"{\"store\":{\"book\":[{\"category\":\"reference\",\"author\":\"Nigel Rees\",\"title\":\"Sayings of the Century\",\"price\":8.95},"
+	"{\"category\":\"fiction\",\"author\":\"Evelyn Waugh\",\"title\":\"Sword of Honour\",\"price\":12.99},"
+	"{\"category\":\"fiction\",\"author\":\"Herman Melville\",\"title\":\"Moby Dick\",\"isbn\":\"0-553-21311-3\",\"price\":8.99},"
+	"{\"category\":\"fiction\",\"author\":\"J. R. R. Tolkien\",\"title\":\"The Lord of the Rings\",\"isbn\":\"0-395-19395-8\",\"price\":22.99}],"
+	"\"bicycle\":{\"color\":\"red\",\"price\":19.95}}}";
+
+typedef struct bench_case_t {
+	const char* name;
+	const char* expression;
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+	{ "dot_chain", "$.store.bicycle.color" },
+	{ "index", "$.store.book[-1].title" },
+	{ "descent", "$..author" },
+	{ "descent_wildcard", "$.store..*" },
+	{ "filter", "$.store.book[?(@.price < 10)].title" },
+	{ "filter_and", "$.store.book[?(@.price > 10 && @.category == \"fiction\")].author" },
+	{ "filter_arithmetic", "$.store.book[?(@.price * 2 - 1 > 20)].title" },
+	{ "range", "$.store.book[1:3].price" },
+	{ "sub_expression", "$.store.book[(@.# - 1)].author" },
+#ifdef JANSSONPATH_SUPPORT_REGEX
+	{ "regex", "$.store.book[?(@.author =~ \"^J\")].title" },
+#endif
+	{ "function", "$.store.book[?(max(@.price, 10) > 10)].title" },
+	{ "concat", "$.store.book ++ $.store.book" },
+	{ "arithmetic", "-$.store.book.*.price * 2 + 1" },
+};
+#define CASE_N (sizeof(cases) / sizeof(cases[0]))
+
+// many fields pulled out of one document, evaluated one by one and with one plan for all of them
+static const char* const plan_fields[] = {
+	"$.store.bicycle.color", "$.store.bicycle.price",
+	"$.store.book[0].category", "$.store.book[0].author", "$.store.book[0].title", "$.store.book[0].price",
+	"$.store.book[1].category", "$.store.book[1].author", "$.store.book[1].title", "$.store.book[1].price",
+	"$.store.book[2].category", "$.store.book[2].author", "$.store.book[2].title", "$.store.book[2].price",
+	"$.store.book[3].category", "$.store.book[3].author", "$.store.book[3].title", "$.store.book[3].price",
+	"$.store.book[2].isbn", "$.store.book[3].isbn",
+};
+#define PLAN_FIELD_N (sizeof(plan_fields) / sizeof(plan_fields[0]))
+
+// allocations of both jansson and janssonpath are counted. with --threads the count is not exact.
+static size_t allocations;
+
+static void* counting_malloc(size_t size) {
+	++allocations;
+	return malloc(size);
+}
+
+static void counting_free(void* p) {
+	free(p);
+}
+
+static double now_seconds(void) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static json_t* max_function(json_t** args, size_t arg_n) {
+	json_t* ret = NULL;
+	size_t i;
+	for (i = 0; i < arg_n; ++i) {
+		if (!json_is_number(args[i])) return NULL;
+		if (!ret || json_number_value(args[i]) > json_number_value(ret)) ret = args[i];
+	}
+	return json_incref(ret);
+}
+
+static const char* function_names[] = { "max" };
+static const jsonpath_callable_plain_t functions[] = { max_function };
+
+static const char* authors[] = { "Nigel Rees", "Evelyn Waugh", "Herman Melville", "J. R. R. Tolkien", "Jane Austen" };
+static const char* categories[] = { "reference", "fiction", "poetry" };
+
+// bookstore grown to about size bytes of JSON text, every book takes about 120
+static json_t* generate_document(size_t size) {
+	size_t count = size / 120 ? size / 120 : 1, i;
+	json_t* books = json_array();
+	char buffer[64];
+	srand(1);
+	for (i = 0; i < count; ++i) {
+		json_t* book = json_object();
+		json_object_set_new(book, "category", json_string(categories[rand() % 3]));
+		json_object_set_new(book, "author", json_string(authors[rand() % 5]));
+		snprintf(buffer, sizeof(buffer), "Title %lu", (unsigned long)i);
+		json_object_set_new(book, "title", json_string(buffer));
+		if (i % 2) {
+			snprintf(buffer, sizeof(buffer), "0-%03d-%05d-%d", rand() % 1000, rand() % 100000, rand() % 10);
+			json_object_set_new(book, "isbn", json_string(buffer));
+		}
+		json_object_set_new(book, "price", json_real((rand() % 3000) / 100.0));
+		json_array_append_new(books, book);
+	}
+	json_t* bicycle = json_object();
+	json_object_set_new(bicycle, "color", json_string("red"));
+	json_object_set_new(bicycle, "price", json_real(19.95));
+	json_t* store = json_object();
+	json_object_set_new(store, "book", books);
+	json_object_set_new(store, "bicycle", bicycle);
+	json_t* ret = json_object();
+	json_object_set_new(ret, "store", store);
+	return ret;
+}
+
+static size_t parse_size(const char* text) {
+	char* end;
+	double value = strtod(text, &end);
+	switch (*end) {
+	case 'k': case 'K': value *= 1024; break;
+	case 'm': case 'M': value *= 1024 * 1024; break;
+	case 'g': case 'G': value *= 1024.0 * 1024 * 1024; break;
+	default: break;
+	}
+	return (size_t)value;
+}
+
+static int compare_double(const void* lhs, const void* rhs) {
+	double l = *(const double*)lhs, r = *(const double*)rhs;
+	return l < r ? -1 : l > r;
+}
+
+static double percentile(const double* sorted, size_t n, double p) {
+	size_t index = (size_t)(p * (double)(n - 1) + 0.5);
+	return sorted[index];
+}
+
+// compiles of the expression in a second, and what one compile allocates
+static json_t* bench_compile(const char* expression, double budget) {
+	size_t n = 0, allocated = 0;
+	double begin = now_seconds(), elapsed;
+	do {
+		jsonpath_error_t error;
+		size_t before = allocations;
+		jsonpath_t* jsonpath = jsonpath_compile(expression, &error);
+		allocated += allocations - before;
+		jsonpath_release(jsonpath);
+		++n;
+		elapsed = now_seconds() - begin;
+	} while (elapsed < budget);
+	json_t* ret = json_object();
+	json_object_set_new(ret, "per_second", json_real((double)n / elapsed));
+	json_object_set_new(ret, "allocations", json_real((double)allocated / (double)n));
+	return ret;
+}
+
+// a case which fails is still reported, with the error in place of its figures
+static json_t* error_report(jsonpath_error_t error) {
+	json_t* ret = json_object();
+	json_object_set_new(ret, "error", json_string(error.reason ? error.reason : "unknown"));
+	json_object_set_new(ret, "code", json_integer((json_int_t)error.code));
+	return ret;
+}
+
+#define MAX_SAMPLES 100000
+#define MIN_SAMPLES 3
+
+static json_t* bench_evaluate(json_t* document, const jsonpath_t* jsonpath, const jsonpath_bytecode_t* bytecode,
+	jsonpath_symbol_lookup_t* symbols, double budget, double* samples) {
+	size_t n = 0, allocated = 0, result_size = 0;
+	double begin = now_seconds();
+	while (n < MAX_SAMPLES && (n < MIN_SAMPLES || now_seconds() - begin < budget)) {
+		jsonpath_error_t error;
+		size_t before = allocations;
+		double start = now_seconds();
+		jsonpath_result_t result = bytecode ? jsonpath_evaluate_bytecode(document, bytecode, symbols, &error)
+			: jsonpath_evaluate(document, jsonpath, symbols, &error);
+		samples[n++] = now_seconds() - start;
+		allocated += allocations - before;
+		if (error.abort) return error_report(error);
+		result_size = result.is_collection ? json_array_size(result.value) : result.value != NULL;
+		jsonpath_decref(result);
+	}
+	qsort(samples, n, sizeof(double), compare_double);
+	json_t* ret = json_object();
+	json_object_set_new(ret, "samples", json_integer((json_int_t)n));
+	json_object_set_new(ret, "p50_us", json_real(percentile(samples, n, 0.5) * 1e6));
+	json_object_set_new(ret, "p99_us", json_real(percentile(samples, n, 0.99) * 1e6));
+	json_object_set_new(ret, "allocations", json_real((double)allocated / (double)n));
+	json_object_set_new(ret, "results", json_integer((json_int_t)result_size));
+	return ret;
+}
+
+// answering from json text: loading it and evaluating, or streaming if stream is given
+static json_t* bench_text(const char* text, size_t text_size, const jsonpath_t* jsonpath, const jsonpath_stream_t* stream,
+	jsonpath_symbol_lookup_t* symbols, double budget, double* samples) {
+	size_t n = 0, allocated = 0, result_size = 0;
+	double begin = now_seconds();
+	while (n < MAX_SAMPLES && (n < MIN_SAMPLES || now_seconds() - begin < budget)) {
+		jsonpath_error_t error;
+		jsonpath_result_t result;
+		size_t before = allocations;
+		double start = now_seconds();
+		if (stream) {
+			result = jsonpath_stream_evaluate_buffer(text, text_size, stream, symbols, &error);
+		} else {
+			json_error_t json_error;
+			json_t* document = json_loadb(text, text_size, 0, &json_error);
+			result = jsonpath_evaluate(document, jsonpath, symbols, &error);
+			json_decref(document);
+		}
+		samples[n++] = now_seconds() - start;
+		allocated += allocations - before;
+		if (error.abort) return error_report(error);
+		result_size = result.is_collection ? json_array_size(result.value) : result.value != NULL;
+		jsonpath_decref(result);
+	}
+	qsort(samples, n, sizeof(double), compare_double);
+	json_t* ret = json_object();
+	json_object_set_new(ret, "samples", json_integer((json_int_t)n));
+	json_object_set_new(ret, "p50_us", json_real(percentile(samples, n, 0.5) * 1e6));
+	json_object_set_new(ret, "p99_us", json_real(percentile(samples, n, 0.99) * 1e6));
+	json_object_set_new(ret, "allocations", json_real((double)allocated / (double)n));
+	json_object_set_new(ret, "results", json_integer((json_int_t)result_size));
+	return ret;
+}
+
+// all fields, each by jsonpath_evaluate, or by the plan if given
+static json_t* bench_fields(json_t* document, jsonpath_t* const* jsonpaths, const jsonpath_plan_t* plan,
+	jsonpath_symbol_lookup_t* symbols, double budget, double* samples) {
+	jsonpath_result_t results[PLAN_FIELD_N];
+	jsonpath_error_t errors[PLAN_FIELD_N];
+	size_t n = 0, allocated = 0, result_size = 0, i;
+	double begin = now_seconds();
+	while (n < MAX_SAMPLES && (n < MIN_SAMPLES || now_seconds() - begin < budget)) {
+		size_t before = allocations;
+		double start = now_seconds();
+		if (plan) {
+			jsonpath_plan_evaluate(document, plan, symbols, results, errors);
+		} else {
+			for (i = 0; i < PLAN_FIELD_N; ++i) results[i] = jsonpath_evaluate(document, jsonpaths[i], symbols, &errors[i]);
+		}
+		samples[n++] = now_seconds() - start;
+		allocated += allocations - before;
+		result_size = 0;
+		for (i = 0; i < PLAN_FIELD_N; ++i) {
+			if (errors[i].abort) continue;
+			result_size += results[i].is_collection ? json_array_size(results[i].value) : results[i].value != NULL;
+			jsonpath_decref(results[i]);
+		}
+		for (i = 0; i < PLAN_FIELD_N; ++i) {
+			if (errors[i].abort) return error_report(errors[i]);
+		}
+	}
+	qsort(samples, n, sizeof(double), compare_double);
+	json_t* ret = json_object();
+	json_object_set_new(ret, "samples", json_integer((json_int_t)n));
+	json_object_set_new(ret, "p50_us", json_real(percentile(samples, n, 0.5) * 1e6));
+	json_object_set_new(ret, "p99_us", json_real(percentile(samples, n, 0.99) * 1e6));
+	json_object_set_new(ret, "allocations", json_real((double)allocated / (double)n));
+	json_object_set_new(ret, "results", json_integer((json_int_t)result_size));
+	return ret;
+}
+
+static json_t* bench_plan(json_t* document, double budget, double* samples, jsonpath_symbol_lookup_t* symbols) {
+	jsonpath_t* jsonpaths[PLAN_FIELD_N];
+	size_t i;
+	json_t* ret = json_object();
+	json_object_set_new(ret, "case", json_string("plan"));
+	for (i = 0; i < PLAN_FIELD_N; ++i) {
+		jsonpath_error_t error;
+		jsonpaths[i] = jsonpath_compile(plan_fields[i], &error);
+		if (error.abort) {
+			fprintf(stderr, "%s does not compile: %s\n", plan_fields[i], error.reason);
+			json_object_set_new(ret, "compile", error_report(error));
+			while (i-- > 0) jsonpath_release(jsonpaths[i]);
+			return ret;
+		}
+	}
+	jsonpath_plan_t* plan = jsonpath_plan_compile((const jsonpath_t* const*)jsonpaths, PLAN_FIELD_N);
+	json_object_set_new(ret, "fields", json_integer((json_int_t)PLAN_FIELD_N));
+	json_object_set_new(ret, "tree", bench_fields(document, jsonpaths, NULL, symbols, budget, samples));
+	if (plan) json_object_set_new(ret, "plan", bench_fields(document, jsonpaths, plan, symbols, budget, samples));
+	jsonpath_plan_release(plan);
+	for (i = 0; i < PLAN_FIELD_N; ++i) jsonpath_release(jsonpaths[i]);
+	return ret;
+}
+
+static json_t* bench_document(const char* name, json_t* document, size_t size, double budget, double* samples,
+	jsonpath_symbol_lookup_t* symbols) {
+	char* text = json_dumps(document, JSON_COMPACT);
+	size_t text_size = text ? strlen(text) : 0;
+	json_t* ret = json_object();
+	json_object_set_new(ret, "document", json_string(name));
+	json_object_set_new(ret, "bytes", json_integer((json_int_t)size));
+	json_t* results = json_array();
+	size_t i;
+	for (i = 0; i < CASE_N; ++i) {
+		jsonpath_error_t error;
+		json_t* result = json_object();
+		json_object_set_new(result, "case", json_string(cases[i].name));
+		json_array_append_new(results, result);
+		jsonpath_t* jsonpath = jsonpath_compile(cases[i].expression, &error);
+		if (error.abort) {
+			fprintf(stderr, "%s does not compile: %s\n", cases[i].expression, error.reason);
+			json_object_set_new(result, "compile", error_report(error));
+			continue;
+		}
+		jsonpath_bytecode_t* bytecode = jsonpath_bytecode_compile(jsonpath);
+		jsonpath_stream_t* stream = jsonpath_stream_compile(jsonpath, &error);
+		json_object_set_new(result, "tree", bench_evaluate(document, jsonpath, NULL, symbols, budget, samples));
+		if (bytecode) json_object_set_new(result, "bytecode", bench_evaluate(document, NULL, bytecode, symbols, budget, samples));
+		if (stream && text) {
+			json_object_set_new(result, "load_and_tree", bench_text(text, text_size, jsonpath, NULL, symbols, budget, samples));
+			json_object_set_new(result, "stream", bench_text(text, text_size, jsonpath, stream, symbols, budget, samples));
+		}
+		fprintf(stderr, "%s %s done\n", name, cases[i].name);
+		jsonpath_stream_release(stream);
+		jsonpath_bytecode_release(bytecode);
+		jsonpath_release(jsonpath);
+	}
+	json_array_append_new(results, bench_plan(document, budget, samples, symbols));
+	fprintf(stderr, "%s plan done\n", name);
+	json_object_set_new(ret, "cases", results);
+	free(text);
+	return ret;
+}
+
+int main(int argc, char** argv) {
+	const char* sizes = "1K,64K,1M,16M";
+	const char* output = NULL;
+	double budget = 0.2;
+	size_t threads = 0;
+	int i;
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "--sizes")) sizes = argv[i + 1];
+		else if (!strcmp(argv[i], "--time")) budget = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--threads")) threads = (size_t)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--output")) output = argv[i + 1];
+		else break;
+	}
+	if (i < argc) {
+		fprintf(stderr, "usage: %s [--sizes 1K,1M,...] [--time seconds_per_case] [--threads n] [--output file]\n", argv[0]);
+		return -1;
+	}
+	if (threads && !jsonpath_set_parallel_filter(1024, threads)) {
+		fprintf(stderr, "failed to start %lu threads\n", (unsigned long)threads);
+		return -1;
+	}
+
+	json_set_alloc_funcs(counting_malloc, counting_free);
+	jsonpath_set_alloc_funcs(counting_malloc, counting_free);
+	double* samples = malloc(sizeof(double) * MAX_SAMPLES);
+
+	jsonpath_symbol_lookup_t symbols;
+	memset(&symbols, 0, sizeof(symbols));
+	symbols.function_lookup.tag = JSONPATH_CALLABLE_PLAIN;
+	symbols.function_lookup.plain_table.names = function_names;
+	symbols.function_lookup.plain_table.functions = functions;
+	symbols.function_lookup.plain_table.size = 1;
+
+	json_t* report = json_object();
+	json_t* version = json_object();
+	json_object_set_new(version, "major", json_integer(JANSSONPATH_VERSION_MAJOR));
+	json_object_set_new(version, "minor", json_integer(JANSSONPATH_VERSION_MINOR));
+	json_object_set_new(report, "version", version);
+	json_object_set_new(report, "time_per_case", json_real(budget));
+	json_object_set_new(report, "threads", json_integer((json_int_t)threads));
+
+	size_t c;
+	json_t* compile = json_array();
+	for (c = 0; c < CASE_N; ++c) {
+		json_t* result = bench_compile(cases[c].expression, budget);
+		json_object_set_new(result, "case", json_string(cases[c].name));
+		json_object_set_new(result, "expression", json_string(cases[c].expression));
+		json_array_append_new(compile, result);
+	}
+	json_object_set_new(report, "compile", compile);
+
+	json_t* evaluate = json_array();
+	json_error_t json_error;
+	json_t* document = json_loads(bookstore, 0, &json_error);
+	json_array_append_new(evaluate, bench_document("bookstore", document, sizeof(bookstore) - 1, budget, samples, &symbols));
+	json_decref(document);
+
+	const char* iter = sizes;
+	while (*iter) {
+		size_t size = parse_size(iter);
+		char name[32];
+		size_t length = strcspn(iter, ",");
+		snprintf(name, sizeof(name), "generated_%.*s", (int)(length < 16 ? length : 16), iter);
+		iter += length;
+		if (*iter == ',') ++iter;
+		if (!size) continue;
+		document = generate_document(size);
+		json_array_append_new(evaluate, bench_document(name, document, size, budget, samples, &symbols));
+		json_decref(document);
+	}
+	json_object_set_new(report, "evaluate", evaluate);
+
+	FILE* out = output ? fopen(output, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "cannot open %s\n", output);
+		return -1;
+	}
+	json_dumpf(report, out, JSON_INDENT(2));
+	fputc('\n', out);
+	if (out != stdout) fclose(out);
+	json_decref(report);
+	free(samples);
+	jsonpath_set_parallel_filter(0, 0);
+	return 0;
+}
@@ -0,0 +1,365 @@
+#include "janssonpath.h"
+#include "private/thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Query JSON Lines files: every line is a json document, and what jsonpath gives for it is printed, one value per line
+// (elements of a collection each on their own line, lines giving nothing print nothing).
+// usage: janssonpath_jsonl [--threads n] [--unordered] [--stream] jsonpath file.jsonl...
+// files are mapped into memory and cut into chunks at line ends, which are parsed and evaluated by n threads(all the
+// cores by default). output is in the order of the input, unless --unordered, which prints chunks as they are done.
+// --stream evaluates with the streaming engine if jsonpath is accepted by it, so only the values matched are built.
+// lines failing to parse or evaluate are reported to stderr by file and byte offset, and the exit code is 1 then.
+
+#define CHUNK_SIZE (1 << 20)
+// ordered output holds chunks done until those before them are, at most this many per thread
+#define CHUNKS_AHEAD 4
+
+typedef struct buffer_t {
+	char* data;
+	size_t size;
+	size_t capacity;
+} buffer_t;
+
+typedef struct input_t {
+	const char* name;
+	const char* text;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+} input_t;
+
+typedef struct chunk_t {
+	size_t input;
+	size_t begin;
+	size_t end;
+	buffer_t out;
+	buffer_t err;
+	size_t failed;
+	bool done;
+} chunk_t;
+
+typedef struct query_t {
+	const jsonpath_t* jsonpath;
+	const jsonpath_bytecode_t* bytecode;
+	const jsonpath_stream_t* stream;
+	const input_t* inputs;
+	chunk_t* chunks;
+	size_t chunk_n;
+	bool ordered;
+	size_t window;
+	// guarded by mutex
+	jsonpath_mutex_t mutex;
+	jsonpath_cond_t written;
+	size_t next_claimed;
+	size_t next_written;
+	size_t failed;
+	bool write_failed;
+} query_t;
+
+static bool buffer_reserve(buffer_t* buffer, size_t size) {
+	if (buffer->size + size <= buffer->capacity) return true;
+	size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+	while (capacity < buffer->size + size) capacity *= 2;
+	char* data = realloc(buffer->data, capacity);
+	if (!data) return false;
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return true;
+}
+
+static int buffer_append(const char* text, size_t size, void* data) {
+	buffer_t* buffer = data;
+	if (!buffer_reserve(buffer, size)) return -1;
+	memcpy(buffer->data + buffer->size, text, size);
+	buffer->size += size;
+	return 0;
+}
+
+static void buffer_release(buffer_t* buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = buffer->capacity = 0;
+}
+
+static void report(chunk_t* chunk, const input_t* input, const char* line, const char* what, const char* reason) {
+	char head[64];
+	snprintf(head, sizeof(head), ": byte %lu: %s: ", (unsigned long)(line - input->text), what);
+	buffer_append(input->name, strlen(input->name), &chunk->err);
+	buffer_append(head, strlen(head), &chunk->err);
+	buffer_append(reason ? reason : "unknown error", reason ? strlen(reason) : 13, &chunk->err);
+	buffer_append("\n", 1, &chunk->err);
+	++chunk->failed;
+}
+
+static bool output_value(chunk_t* chunk, json_t* value) {
+	return !json_dump_callback(value, buffer_append, &chunk->out, JSON_COMPACT | JSON_ENCODE_ANY) &&
+		!buffer_append("\n", 1, &chunk->out);
+}
+
+static void output_result(chunk_t* chunk, const input_t* input, const char* line, jsonpath_result_t result) {
+	bool ok = true;
+	if (result.is_collection) {
+		size_t i;
+		for (i = 0; ok && i < json_array_size(result.value); ++i) ok = output_value(chunk, json_array_get(result.value, i));
+	} else if (result.value) {
+		ok = output_value(chunk, result.value);
+	}
+	if (!ok) report(chunk, input, line, "output", "out of memory");
+}
+
+static void run_line(const query_t* query, chunk_t* chunk, const char* line, size_t size) {
+	const input_t* input = &query->inputs[chunk->input];
+	jsonpath_error_t error;
+	jsonpath_result_t result;
+	if (query->stream) {
+		result = jsonpath_stream_evaluate_buffer(line, size, query->stream, NULL, &error);
+	} else {
+		json_error_t json_error;
+		json_t* document = json_loadb(line, size, JSON_DECODE_ANY, &json_error);
+		if (!document) {
+			report(chunk, input, line, "parse", json_error.text);
+			return;
+		}
+		result = query->bytecode ? jsonpath_evaluate_bytecode(document, query->bytecode, NULL, &error)
+			: jsonpath_evaluate(document, query->jsonpath, NULL, &error);
+		json_decref(document);
+	}
+	if (error.abort) {
+		report(chunk, input, line, "evaluate", error.reason);
+		return;
+	}
+	output_result(chunk, input, line, result);
+	jsonpath_decref(result);
+}
+
+static void run_chunk(const query_t* query, chunk_t* chunk) {
+	const char* text = query->inputs[chunk->input].text;
+	const char* line = text + chunk->begin;
+	const char* end = text + chunk->end;
+	while (line < end) {
+		const char* next = memchr(line, '\n', (size_t)(end - line));
+		const char* line_end = next ? next : end;
+		const char* last = line_end;
+		while (last > line && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) --last;
+		if (last > line) run_line(query, chunk, line, (size_t)(last - line));
+		line = next ? next + 1 : end;
+	}
+}
+
+// with mutex held
+static void write_chunk(query_t* query, chunk_t* chunk) {
+	if (chunk->out.size && fwrite(chunk->out.data, 1, chunk->out.size, stdout) != chunk->out.size) query->write_failed = true;
+	if (chunk->err.size) fwrite(chunk->err.data, 1, chunk->err.size, stderr);
+	query->failed += chunk->failed;
+	buffer_release(&chunk->out);
+	buffer_release(&chunk->err);
+}
+
+static JSONPATH_THREAD_PROC worker(void* context) {
+	query_t* query = context;
+	mutex_lock(&query->mutex);
+	for (;;) {
+		while (query->ordered && query->next_claimed < query->chunk_n &&
+			query->next_claimed - query->next_written >= query->window)
+			cond_wait(&query->written, &query->mutex);
+		if (query->next_claimed == query->chunk_n) break;
+		chunk_t* chunk = &query->chunks[query->next_claimed++];
+		mutex_unlock(&query->mutex);
+		run_chunk(query, chunk);
+		mutex_lock(&query->mutex);
+		chunk->done = true;
+		if (!query->ordered) {
+			write_chunk(query, chunk);
+			continue;
+		}
+		bool wrote = false;
+		while (query->next_written < query->chunk_n && query->chunks[query->next_written].done) {
+			write_chunk(query, &query->chunks[query->next_written++]);
+			wrote = true;
+		}
+		if (wrote) cond_broadcast(&query->written);
+	}
+	mutex_unlock(&query->mutex);
+	return 0;
+}
+
+static bool map_input(input_t* input, const char* name) {
+	input->name = name;
+	input->text = NULL;
+	input->size = 0;
+#ifdef _WIN32
+	input->mapping = NULL;
+	input->file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (input->file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(input->file, &size)) return false;
+	input->size = (size_t)size.QuadPart;
+	if (!input->size) return true;
+	input->mapping = CreateFileMappingA(input->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!input->mapping) return false;
+	input->text = MapViewOfFile(input->mapping, FILE_MAP_READ, 0, 0, 0);
+	return input->text != NULL;
+#else
+	int fd = open(name, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return false;
+	}
+	input->size = (size_t)st.st_size;
+	if (input->size) {
+		void* text = mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text != MAP_FAILED) {
+			input->text = text;
+#ifdef MADV_SEQUENTIAL
+			madvise(text, input->size, MADV_SEQUENTIAL);
+#endif
+		}
+	}
+	close(fd);
+	return !input->size || input->text;
+#endif
+}
+
+static void unmap_input(input_t* input) {
+#ifdef _WIN32
+	if (input->text) UnmapViewOfFile(input->text);
+	if (input->mapping) CloseHandle(input->mapping);
+	if (input->file != INVALID_HANDLE_VALUE) CloseHandle(input->file);
+#else
+	if (input->text) munmap((void*)input->text, input->size);
+#endif
+}
+
+// chunks of about CHUNK_SIZE, each ending at the end of a line. returns false if out of memory.
+static bool split_input(query_t* query, size_t* capacity, size_t index) {
+	const input_t* input = &query->inputs[index];
+	size_t begin = 0;
+	while (begin < input->size) {
+		size_t end = begin + CHUNK_SIZE;
+		if (end >= input->size) {
+			end = input->size;
+		} else {
+			const char* line_end = memchr(input->text + end, '\n', input->size - end);
+			end = line_end ? (size_t)(line_end - input->text) + 1 : input->size;
+		}
+		if (query->chunk_n == *capacity) {
+			size_t grown = *capacity ? *capacity * 2 : 64;
+			chunk_t* chunks = realloc(query->chunks, sizeof(chunk_t) * grown);
+			if (!chunks) return false;
+			query->chunks = chunks;
+			*capacity = grown;
+		}
+		chunk_t* chunk = &query->chunks[query->chunk_n++];
+		memset(chunk, 0, sizeof(chunk_t));
+		chunk->input = index;
+		chunk->begin = begin;
+		chunk->end = end;
+		begin = end;
+	}
+	return true;
+}
+
+static size_t core_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+int main(int argc, char** argv) {
+	size_t threads = core_count();
+	bool ordered = true, stream = false;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; ++i) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = (size_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--unordered")) ordered = false;
+		else if (!strcmp(argv[i], "--stream")) stream = true;
+		else break;
+	}
+	if (argc - i < 2 || !threads) {
+		fprintf(stderr, "usage: %s [--threads n] [--unordered] [--stream] jsonpath file.jsonl...\n", argv[0]);
+		return 2;
+	}
+
+	jsonpath_error_t error;
+	jsonpath_t* jsonpath = jsonpath_compile(argv[i], &error);
+	if (error.abort) {
+		fprintf(stderr, "%s: %s\n", argv[i], error.reason);
+		return 2;
+	}
+	query_t query;
+	memset(&query, 0, sizeof(query));
+	query.jsonpath = jsonpath;
+	if (stream) {
+		query.stream = jsonpath_stream_compile(jsonpath, &error);
+		if (!query.stream) fprintf(stderr, "%s: not streamed, %s\n", argv[i], error.reason);
+	}
+	if (!query.stream) query.bytecode = jsonpath_bytecode_compile(jsonpath);
+	++i;
+
+	size_t input_n = (size_t)(argc - i), capacity = 0, j;
+	input_t* inputs = calloc(input_n, sizeof(input_t));
+	int ret = 0;
+	query.inputs = inputs;
+	for (j = 0; inputs && j < input_n; ++j) {
+		if (!map_input(&inputs[j], argv[i + (int)j])) {
+			fprintf(stderr, "%s: failed to open\n", argv[i + (int)j]);
+			ret = 2;
+			break;
+		}
+		if (!split_input(&query, &capacity, j)) break;
+	}
+	if (!inputs || (!ret && j < input_n)) {
+		fprintf(stderr, "out of memory\n");
+		ret = 2;
+	}
+
+	if (!ret) {
+		jsonpath_thread_t* pool = malloc(sizeof(jsonpath_thread_t) * threads);
+		size_t started = 0;
+		query.ordered = ordered;
+		query.window = threads * CHUNKS_AHEAD;
+		query.mutex = (jsonpath_mutex_t)JSONPATH_MUTEX_INITIALIZER;
+		query.written = (jsonpath_cond_t)JSONPATH_COND_INITIALIZER;
+		// the main thread is one of them
+		while (pool && started + 1 < threads && thread_create(&pool[started], worker, &query)) ++started;
+		worker(&query);
+		while (started) thread_join(pool[--started]);
+		free(pool);
+		fflush(stdout);
+		if (query.write_failed || ferror(stdout)) {
+			fprintf(stderr, "failed to write output\n");
+			ret = 2;
+		} else if (query.failed) {
+			ret = 1;
+		}
+	}
+
+	for (j = 0; inputs && j < input_n; ++j) unmap_input(&inputs[j]);
+	free(inputs);
+	free(query.chunks);
+	jsonpath_stream_release((jsonpath_stream_t*)query.stream);
+	jsonpath_bytecode_release((jsonpath_bytecode_t*)query.bytecode);
+	jsonpath_release(jsonpath);
+	return ret;
+}
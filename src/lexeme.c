@@ -1,6 +1,7 @@
 #include "private/lexeme.h"
 #include <stdlib.h>
 #include <string.h>
+#include <wchar.h>
 #include "private/common.h"
 #include "private/error.h"
 
@@ -21,14 +22,14 @@ static string_slice make_slice(const char* s_begin, const char* s_end) {
     } while (0)
 
 // maybe not good practice
-#define go_next()                          \
-    do {                                   \
-        mb_next(&s_begin, s_end, error);   \
-        check_error();                     \
-        if (error->code == 0x200000001ull) { \
-            ++s_begin;                     \
-            continue;                      \
-        }                                  \
+#define go_next()                                \
+    do {                                         \
+        mb_next(reader, &s_begin, s_end, error); \
+        check_error();                           \
+        if (error->code == 0x200000001ull) {     \
+            ++s_begin;                           \
+            continue;                            \
+        }                                        \
     } while (0)
 
 static bool encode_recoverable = false;
@@ -45,31 +46,47 @@ static jsonpath_error_t encode_error(const char* pos) {
 }
 
 // why not simply convert it to wchar_t string?
-static wchar_t mb_peek;
+// decoding state is kept per call rather than in file scope(and mbrtowc rather
+// than mbtowc), so that lexing is reentrant and thread-safe.
+typedef struct mb_reader_t {
+    wchar_t peek;
+    mbstate_t state;
+} mb_reader_t;
 
-static void mb_peek_init(const char** ps_begin, const char* s_end,
-                         jsonpath_error_t* error) {
+#define mb_peek (reader->peek)
+
+static void mb_reader_init(mb_reader_t* reader) {
+    memset(reader, 0, sizeof(mb_reader_t));
+}
+
+static void mb_peek_init(mb_reader_t* reader, const char** ps_begin,
+                         const char* s_end, jsonpath_error_t* error) {
     if (IS_END(s_begin, s_end)) {
         mb_peek = L'\0';
         return;
     }
-    mbtowc(&mb_peek, s_begin, s_end ? s_end - s_begin : MB_LEN_MAX);
-    if (mb_peek == -1) {
+    mbstate_t state = reader->state;  // peeking does not consume
+    size_t len = mbrtowc(&mb_peek, s_begin,
+                         s_end ? (size_t)(s_end - s_begin) : MB_LEN_MAX, &state);
+    if (len == (size_t)-1 || len == (size_t)-2) {
+        mb_peek = -1;
         *error = encode_error(s_begin);
     }
 }
 
 static void mb_next(
-    const char** ps_begin, const char* s_end,
+    mb_reader_t* reader, const char** ps_begin, const char* s_end,
     jsonpath_error_t*
         error) {  // if mb_peek_init does not generate error, this should not.
-    int len = mblen(s_begin, s_end ? s_end - s_begin : MB_LEN_MAX);
-    if (len == -1) {
+    size_t len = mbrlen(s_begin, s_end ? (size_t)(s_end - s_begin) : MB_LEN_MAX,
+                        &reader->state);
+    if (len == (size_t)-1 || len == (size_t)-2) {
+        memset(&reader->state, 0, sizeof(mbstate_t));
         *error = encode_error(s_begin);
         return;
     }
-    s_begin += len;
-    mb_peek_init(ps_begin, s_end, error);
+    s_begin += len ? len : 1;
+    mb_peek_init(reader, ps_begin, s_end, error);
 }
 
 // static wchar_t mb_read(const char** ps_begin, const char* s_end,
@@ -84,13 +101,14 @@ jsonpath_error_eof_escape(const char* position);
 jsonpath_error_t JANSSONPATH_NO_EXPORT
 jsonpath_error_zero_length_escape(const char* position);
 
-static string_slice get_string(const char** ps_begin, const char* s_end,
-                               jsonpath_error_t* error) {
+static string_slice get_string(mb_reader_t* reader, const char** ps_begin,
+                               const char* s_end, jsonpath_error_t* error) {
     assert(ps_begin && s_begin);
     assert(s_begin != s_end && *s_begin);
 
-    mb_peek_init(ps_begin, s_end, error);  // no unwanted side effect so it's
-                                           // not harmful to do multiple times
+    mb_peek_init(reader, ps_begin, s_end,
+                 error);  // no unwanted side effect so it's not harmful to do
+                          // multiple times
 
     const char* start = s_begin;  // start of the word
     wchar_t delima = mb_peek;
@@ -143,7 +161,10 @@ string_slice JANSSONPATH_NO_EXPORT next_lexeme(const char** ps_begin,
         return empty_word;
     }
 
-    mb_peek_init(ps_begin, s_end, error);
+    mb_reader_t reader_;
+    mb_reader_t* reader = &reader_;
+    mb_reader_init(reader);
+    mb_peek_init(reader, ps_begin, s_end, error);
 
     *error = jsonpath_error_ok;
     if (!mb_peek) return empty_word;  // eof
@@ -175,7 +196,7 @@ string_slice JANSSONPATH_NO_EXPORT next_lexeme(const char** ps_begin,
 
     // string
     if (mb_peek == L'\"' || mb_peek == L'\'') {
-        return get_string(&s_begin, s_end, error);
+        return get_string(reader, &s_begin, s_end, error);
     }
 
     // for == >= <=, we simply consider they are pairs of word, and leave it for
@@ -0,0 +1,173 @@
+#include "private/common.h"
+#include "private/jsonpath_ast.h"
+#include "janssonpath_evaluate.h"
+#include "private/jansson_memory.h"
+#ifdef JANSSONPATH_SUPPORT_REGEX
+#include "private/regex_impl.h"
+#endif
+
+// passes over the compiled tree, run once at the end of compilation.
+// anything done here saves time for every evaluation afterwards.
+
+#ifdef JANSSONPATH_CONSTANT_FOLD
+static bool is_literal(const jsonpath_t* jsonpath) {
+	return jsonpath->tag == JSON_SINGLE && jsonpath->single.tag == SINGLE_CONST;
+}
+
+// omitted part of range is fine
+#define is_literal_or_omitted(jsonpath) (!(jsonpath) || is_literal(jsonpath))
+
+static void fold_constant(jsonpath_t* jsonpath);
+
+static bool fold_index(path_index_t index) {
+	switch (index.tag) {
+	case INDEX_DOT:
+	case INDEX_DOT_RECURSIVE:
+		return true;
+	case INDEX_SUB_EXP:
+	case INDEX_FILTER:
+		fold_constant(index.expression);
+		return is_literal(index.expression);
+	case INDEX_SUB_RANGE:
+		fold_constant(index.range[0]);
+		fold_constant(index.range[1]);
+		return is_literal_or_omitted(index.range[0]) && is_literal_or_omitted(index.range[1]);
+	default:
+		return false;
+	}
+}
+
+// replace the node by its value if it evaluates to one. returns whether it's a literal now
+static bool fold_node(jsonpath_t* jsonpath) {
+	jsonpath_error_t error;
+	jsonpath_result_t result = jsonpath_evaluate(NULL, jsonpath, NULL, &error);
+	if (error.abort) return false; // leave it to evaluation to report the error
+	// a literal carries no collection flag
+	if (!result.is_constant || result.is_collection) {
+		jsonpath_decref(result);
+		return false;
+	}
+	jsonpath_release_no_free(jsonpath);
+	jsonpath->tag = JSON_SINGLE;
+	jsonpath->single.tag = SINGLE_CONST;
+	jsonpath->single.constant = result.value;
+	return true;
+}
+
+// children are folded first, so that literal parts of an expression which is not a literal as a whole(like 1+2 in $.a[1+2]) are folded as well.
+// a node is folded if all its children are literal after that. $ @ and function calls are never literal, thus they stay to evaluation.
+static void fold_constant(jsonpath_t* jsonpath) {
+	if (!jsonpath) return;
+	bool foldable = false;
+	size_t i;
+	switch (jsonpath->tag) {
+	case JSON_SINGLE:
+		return;
+	case JSON_INDEX:
+		fold_constant(jsonpath->indexes.root_node);
+		foldable = is_literal(jsonpath->indexes.root_node);
+		for (i = 0; i < jsonpath->indexes.size; ++i) {
+			if (!fold_index(jsonpath->indexes.indexes[i])) foldable = false;
+		}
+		break;
+	case JSON_UNARY:
+		fold_constant(jsonpath->unary.node);
+		foldable = is_literal(jsonpath->unary.node);
+		break;
+	case JSON_BINARY: {
+		// a ++ b ++ c ... is a left deep tree, walk down the left side with a loop so that long chains don't recurse,
+		// then fold the chain from the bottom up as far as it stays literal
+		size_t depth = 0;
+		jsonpath_t* node;
+		for (node = jsonpath; node->tag == JSON_BINARY; node = node->binary.lhs) {
+			fold_constant(node->binary.rhs);
+			++depth;
+		}
+		fold_constant(node);
+		if (!is_literal(node)) return;
+		jsonpath_t** chain = do_malloc(sizeof(jsonpath_t*) * depth);
+		if (!chain) return; // only an optimization, the chain is left to evaluation
+		for (i = 0, node = jsonpath; i < depth; ++i, node = node->binary.lhs) chain[i] = node;
+		for (i = depth; i-- > 0;) {
+			if (!is_literal(chain[i]->binary.rhs) || !fold_node(chain[i])) break;
+		}
+		do_free(chain);
+		return;
+	}
+	case JSON_ARBITRAY:
+		// we don't assume function call to be pure
+		for (i = 0; i < jsonpath->arbitrary.size; ++i) {
+			fold_constant(jsonpath->arbitrary.nodes[i]);
+		}
+		return;
+	default:
+		return;
+	}
+	if (foldable) fold_node(jsonpath);
+}
+#endif
+
+#ifdef JANSSONPATH_SUPPORT_REGEX
+static void precompile_regex(jsonpath_t* jsonpath);
+
+static void precompile_regex_index(path_index_t index) {
+	switch (index.tag) {
+	case INDEX_SUB_EXP:
+	case INDEX_FILTER:
+		precompile_regex(index.expression);
+		return;
+	case INDEX_SUB_RANGE:
+		precompile_regex(index.range[0]);
+		precompile_regex(index.range[1]);
+		return;
+	default:
+		return;
+	}
+}
+
+// pattern of x =~ "literal" is compiled here once rather than for every match.
+// if it fails to compile, it's left to evaluation to report the error.
+static void precompile_regex(jsonpath_t* jsonpath) {
+	if (!jsonpath) return;
+	size_t i;
+	switch (jsonpath->tag) {
+	case JSON_INDEX:
+		precompile_regex(jsonpath->indexes.root_node);
+		for (i = 0; i < jsonpath->indexes.size; ++i) precompile_regex_index(jsonpath->indexes.indexes[i]);
+		return;
+	case JSON_UNARY:
+		precompile_regex(jsonpath->unary.node);
+		return;
+	case JSON_BINARY: {
+		// walk down the left side with a loop, like lowering to bytecode, so that long chains don't recurse
+		jsonpath_t* node;
+		for (node = jsonpath; node->tag == JSON_BINARY; node = node->binary.lhs) {
+			path_binary_t* binary = &node->binary;
+			precompile_regex(binary->rhs);
+			if (binary->tag == BINARY_REGEX && binary->rhs->tag == JSON_SINGLE && binary->rhs->single.tag == SINGLE_CONST
+				&& json_is_string(binary->rhs->single.constant)) {
+				jsonpath_error_t error = jsonpath_error_ok;
+				binary->regex = regex_acquire(json_string_value(binary->rhs->single.constant), &error);
+			}
+		}
+		precompile_regex(node);
+		return;
+	}
+	case JSON_ARBITRAY:
+		for (i = 0; i < jsonpath->arbitrary.size; ++i) precompile_regex(jsonpath->arbitrary.nodes[i]);
+		return;
+	default:
+		return;
+	}
+}
+#endif
+
+void JANSSONPATH_NO_EXPORT jsonpath_optimize(jsonpath_t* jsonpath) {
+#ifdef JANSSONPATH_CONSTANT_FOLD
+	fold_constant(jsonpath);
+#endif
+#ifdef JANSSONPATH_SUPPORT_REGEX
+	precompile_regex(jsonpath);
+#endif
+	(void)jsonpath;
+}
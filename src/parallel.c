@@ -0,0 +1,211 @@
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+#include "private/thread.h"
+#include "private/parallel.h"
+
+// a loop run in parallel is a job of chunks, claimed in order by idle workers and by the thread submitting it.
+// the submitter keeps claiming chunks of its own job and then waits for those claimed by others, so a loop nested
+// in the body of another one makes progress even if every worker is busy. once a chunk fails, chunks after it are
+// not started any more. chunks before it were all claimed already and run to the end, so the failure reported is
+// the first one, as if run in order.
+
+typedef struct job_t {
+	parallel_body_t body;
+	void* context;
+	size_t size;
+	size_t chunk_n;
+	// guarded by pool_mutex
+	size_t claimed;
+	size_t done;
+	size_t first_failed; // chunk_n if none
+	bool queued;
+	struct job_t* next;
+} job_t;
+
+#define CHUNKS_PER_THREAD 4
+
+static jsonpath_mutex_t pool_mutex = JSONPATH_MUTEX_INITIALIZER;
+static jsonpath_cond_t pool_work = JSONPATH_COND_INITIALIZER;
+static jsonpath_cond_t pool_finished = JSONPATH_COND_INITIALIZER;
+// jobs with chunks left to claim, guarded by pool_mutex
+static job_t* queue_head;
+static bool pool_stopping;
+// changed only by jsonpath_set_parallel_filter, which is never called with evaluations running
+static jsonpath_thread_t* pool_threads;
+static size_t pool_thread_n;
+static size_t pool_min_size;
+
+static JSONPATH_THREAD_LOCAL char error_reason[256];
+
+// with pool_mutex held. index of the chunk claimed, or chunk_n if there's none left, when the job leaves the queue.
+static size_t claim(job_t* job) {
+	if (job->claimed < job->chunk_n && job->claimed < job->first_failed) return job->claimed++;
+	if (job->queued) {
+		job_t** iter;
+		for (iter = &queue_head; *iter != job; iter = &(*iter)->next) {}
+		*iter = job->next;
+		job->queued = false;
+	}
+	return job->chunk_n;
+}
+
+// with pool_mutex held, which is released while the chunk runs
+static void execute(job_t* job, size_t chunk) {
+	mutex_unlock(&pool_mutex);
+	bool ok = job->body(job->context, chunk, PARALLEL_CHUNK_BEGIN(job->size, job->chunk_n, chunk), PARALLEL_CHUNK_BEGIN(job->size, job->chunk_n, chunk + 1));
+	mutex_lock(&pool_mutex);
+	if (!ok && chunk < job->first_failed) job->first_failed = chunk;
+	if (++job->done == job->claimed) cond_broadcast(&pool_finished);
+}
+
+static JSONPATH_THREAD_PROC worker(void* unused) {
+	(void)unused;
+	mutex_lock(&pool_mutex);
+	for (;;) {
+		if (queue_head) {
+			job_t* job = queue_head;
+			size_t chunk = claim(job);
+			if (chunk < job->chunk_n) execute(job, chunk);
+		} else if (pool_stopping) {
+			break;
+		} else {
+			cond_wait(&pool_work, &pool_mutex);
+		}
+	}
+	mutex_unlock(&pool_mutex);
+	return 0;
+}
+
+JANSSONPATH_NO_EXPORT size_t parallel_chunk_count(size_t size) {
+	size_t ret = (pool_thread_n + 1) * CHUNKS_PER_THREAD;
+	return ret < size ? ret : size;
+}
+
+JANSSONPATH_NO_EXPORT size_t parallel_for(size_t size, size_t chunk_n, parallel_body_t body, void* context) {
+	job_t job;
+	job.body = body;
+	job.context = context;
+	job.size = size;
+	job.chunk_n = chunk_n;
+	job.claimed = job.done = 0;
+	job.first_failed = chunk_n;
+	job.queued = true;
+	job.next = NULL;
+
+	size_t chunk;
+	mutex_lock(&pool_mutex);
+	job_t** tail;
+	for (tail = &queue_head; *tail; tail = &(*tail)->next) {}
+	*tail = &job;
+	cond_broadcast(&pool_work);
+	while ((chunk = claim(&job)) < chunk_n) execute(&job, chunk);
+	while (job.done < job.claimed) cond_wait(&pool_finished, &pool_mutex);
+	mutex_unlock(&pool_mutex);
+	return job.first_failed;
+}
+
+JANSSONPATH_NO_EXPORT bool parallel_filter_wanted(size_t size) {
+	return pool_thread_n && size >= pool_min_size;
+}
+
+typedef struct filter_chunk_t {
+	result_t ret; // matches within the chunk
+	jsonpath_error_t error;
+	char reason[256]; // copy of error.reason, which may be in a buffer local to the worker
+} filter_chunk_t;
+
+typedef struct filter_job_t {
+	json_t* array;
+	parallel_predicate_t predicate;
+	void* context;
+	filter_chunk_t* chunks;
+} filter_job_t;
+
+static bool filter_chunk(void* context, size_t chunk, size_t begin, size_t end) {
+	const filter_job_t* job = context;
+	filter_chunk_t* filter = &job->chunks[chunk];
+	size_t index;
+	filter->ret = make_result_collection(collection_new(end - begin), true, true);
+	for (index = begin; index < end; ++index) {
+		json_t* value = json_array_get(job->array, index);
+		result_t cond = job->predicate(job->context, value, &filter->error);
+		if (filter->error.abort || !filter_accumulate(&filter->ret, value, cond, &filter->error)) {
+			if (filter->error.reason) {
+				strncpy(filter->reason, filter->error.reason, sizeof(filter->reason) - 1);
+				filter->reason[sizeof(filter->reason) - 1] = '\0';
+				filter->error.reason = filter->reason;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+JANSSONPATH_NO_EXPORT bool parallel_filter(result_t* ret, json_t* array, parallel_predicate_t predicate, void* context, jsonpath_error_t* error) {
+	size_t size = json_array_size(array), chunk_n = parallel_chunk_count(size), i;
+	if (!size) return true;
+	filter_job_t job;
+	job.array = array;
+	job.predicate = predicate;
+	job.context = context;
+	job.chunks = do_malloc(sizeof(filter_chunk_t) * chunk_n);
+	if (!job.chunks) {
+		*error = jsonpath_error_unknown;
+		return false;
+	}
+	for (i = 0; i < chunk_n; ++i) {
+		job.chunks[i].ret = make_result_new(NULL, true, true);
+		job.chunks[i].error = jsonpath_error_ok;
+	}
+
+	size_t first_failed = parallel_for(size, chunk_n, filter_chunk, &job);
+	for (i = 0; i < chunk_n; ++i) {
+		result_t matched = job.chunks[i].ret;
+		if (first_failed < chunk_n || !matched.is_collection) {
+			result_decref(matched);
+			continue;
+		}
+		if (!matched.is_constant) ret->is_constant = false;
+		collection_merge(ret->collection, matched.collection);
+	}
+	if (first_failed < chunk_n) {
+		*error = job.chunks[first_failed].error;
+		if (error->reason) {
+			strcpy(error_reason, error->reason);
+			error->reason = error_reason;
+		}
+	}
+	do_free(job.chunks);
+	return first_failed == chunk_n;
+}
+
+JANSSONPATH_EXPORT bool jsonpath_set_parallel_filter(size_t min_size, size_t thread_count) {
+	size_t i;
+	if (pool_thread_n) {
+		mutex_lock(&pool_mutex);
+		pool_stopping = true;
+		cond_broadcast(&pool_work);
+		mutex_unlock(&pool_mutex);
+		for (i = 0; i < pool_thread_n; ++i) thread_join(pool_threads[i]);
+		do_free(pool_threads);
+		pool_threads = NULL;
+		pool_thread_n = 0;
+		pool_stopping = false;
+	}
+	pool_min_size = min_size ? min_size : 1;
+	if (!thread_count) return true;
+	pool_threads = do_malloc(sizeof(jsonpath_thread_t) * thread_count);
+	if (!pool_threads) return false;
+	for (i = 0; i < thread_count; ++i) {
+		if (!thread_create(&pool_threads[i], worker, NULL)) break;
+	}
+	pool_thread_n = i;
+	if (!i) {
+		do_free(pool_threads);
+		pool_threads = NULL;
+	}
+	return i == thread_count;
+}
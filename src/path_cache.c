@@ -0,0 +1,193 @@
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+#include "private/thread.h"
+#include "janssonpath.h"
+
+// compiled jsonpaths keyed by text and classical. the cache is split into shards, each with its own lock, hash
+// buckets and LRU list, so threads looking up different jsonpaths seldom wait for each other.
+
+struct jsonpath_cache_entry_t {
+	jsonpath_t* jsonpath;
+	size_t refcount; // guarded by mutex of the shard, the cache holds one
+	size_t hash;
+	bool classical;
+	bool cacheable; // never changes. if false, it's never seen by other threads
+	bool cached;
+	// most recently used first
+	jsonpath_cache_entry_t* lru_prev;
+	jsonpath_cache_entry_t* lru_next;
+	jsonpath_cache_entry_t* bucket_next;
+	char text[];
+};
+
+#define PATH_CACHE_SHARDS 8
+#define PATH_CACHE_SHARD_SIZE ((JANSSONPATH_PATH_CACHE_SIZE + PATH_CACHE_SHARDS - 1) / PATH_CACHE_SHARDS)
+#define PATH_CACHE_BUCKETS (PATH_CACHE_SHARD_SIZE * 2 + 1)
+// longer texts are compiled every time, so memory of the cache is bounded
+#define PATH_CACHE_MAX_LENGTH 1024
+
+typedef struct shard_t {
+	jsonpath_mutex_t mutex;
+	jsonpath_cache_entry_t* buckets[PATH_CACHE_BUCKETS];
+	jsonpath_cache_entry_t* lru_head;
+	jsonpath_cache_entry_t* lru_tail;
+	size_t size;
+} shard_t;
+
+#define SHARD_INITIALIZER { JSONPATH_MUTEX_INITIALIZER, { NULL }, NULL, NULL, 0 }
+// one initializer for each of PATH_CACHE_SHARDS
+static shard_t shards[PATH_CACHE_SHARDS] = {
+	SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER,
+	SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER, SHARD_INITIALIZER,
+};
+
+// FNV-1a, classical is hashed as the last byte
+static size_t text_hash(const char* text, bool classical) {
+	size_t ret = 2166136261u;
+	for (; *text; ++text) ret = (ret ^ (unsigned char)*text) * 16777619u;
+	return (ret ^ (classical ? 1u : 0u)) * 16777619u;
+}
+
+static void entry_destroy(jsonpath_cache_entry_t* entry) {
+	jsonpath_release(entry->jsonpath);
+	do_free(entry);
+}
+
+static void lru_unlink(shard_t* shard, jsonpath_cache_entry_t* entry) {
+	if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+	else shard->lru_head = entry->lru_next;
+	if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+	else shard->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(shard_t* shard, jsonpath_cache_entry_t* entry) {
+	entry->lru_prev = NULL;
+	entry->lru_next = shard->lru_head;
+	if (shard->lru_head) shard->lru_head->lru_prev = entry;
+	else shard->lru_tail = entry;
+	shard->lru_head = entry;
+}
+
+// with mutex of the shard held
+static jsonpath_cache_entry_t* shard_find(shard_t* shard, const char* text, bool classical, size_t hash) {
+	jsonpath_cache_entry_t* entry = shard->buckets[hash / PATH_CACHE_SHARDS % PATH_CACHE_BUCKETS];
+	for (; entry; entry = entry->bucket_next) {
+		if (entry->hash == hash && entry->classical == classical && !strcmp(entry->text, text)) {
+			if (entry != shard->lru_head) {
+				lru_unlink(shard, entry);
+				lru_push_front(shard, entry);
+			}
+			++entry->refcount;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// with mutex of the shard held. the entry is unlinked, and returned if nobody else refers to it, to be freed out of
+// the lock.
+static jsonpath_cache_entry_t* shard_remove(shard_t* shard, jsonpath_cache_entry_t* entry) {
+	jsonpath_cache_entry_t** bucket;
+	lru_unlink(shard, entry);
+	for (bucket = &shard->buckets[entry->hash / PATH_CACHE_SHARDS % PATH_CACHE_BUCKETS]; *bucket != entry; bucket = &(*bucket)->bucket_next) {}
+	*bucket = entry->bucket_next;
+	entry->cached = false;
+	--shard->size;
+	return --entry->refcount ? NULL : entry;
+}
+
+// with mutex of the shard held. returns the least recently used entry evicted, like shard_remove.
+static jsonpath_cache_entry_t* shard_insert(shard_t* shard, jsonpath_cache_entry_t* entry) {
+	jsonpath_cache_entry_t** bucket = &shard->buckets[entry->hash / PATH_CACHE_SHARDS % PATH_CACHE_BUCKETS];
+	entry->bucket_next = *bucket;
+	*bucket = entry;
+	entry->cached = true;
+	++entry->refcount;
+	lru_push_front(shard, entry);
+	if (++shard->size <= PATH_CACHE_SHARD_SIZE) return NULL;
+	return shard_remove(shard, shard->lru_tail);
+}
+
+JANSSONPATH_EXPORT jsonpath_cache_entry_t* jsonpath_cache_acquire(const char* jsonpath_begin, bool classical, jsonpath_error_t* error) {
+	*error = jsonpath_error_ok;
+	size_t length = strlen(jsonpath_begin);
+	bool cacheable = JANSSONPATH_PATH_CACHE_SIZE && length <= PATH_CACHE_MAX_LENGTH;
+	size_t hash = 0;
+	shard_t* shard = NULL;
+	jsonpath_cache_entry_t* ret;
+	if (cacheable) {
+		hash = text_hash(jsonpath_begin, classical);
+		shard = &shards[hash % PATH_CACHE_SHARDS];
+		mutex_lock(&shard->mutex);
+		ret = shard_find(shard, jsonpath_begin, classical, hash);
+		mutex_unlock(&shard->mutex);
+		if (ret) return ret;
+	}
+
+	// compile out of the lock, other threads may compile the same jsonpath meanwhile
+	jsonpath_t* jsonpath = jsonpath_compile_cond(jsonpath_begin, error, classical);
+	if (error->abort) return NULL;
+	// warnings would be lost for later hits
+	if (error->code) cacheable = false;
+	ret = do_malloc(sizeof(jsonpath_cache_entry_t) + length + 1);
+	if (!ret) {
+		jsonpath_release(jsonpath);
+		*error = jsonpath_error_unknown;
+		return NULL;
+	}
+	memcpy(ret->text, jsonpath_begin, length + 1);
+	ret->jsonpath = jsonpath;
+	ret->refcount = 1;
+	ret->hash = hash;
+	ret->classical = classical;
+	ret->cacheable = cacheable;
+	ret->cached = false;
+	if (!cacheable) return ret;
+
+	mutex_lock(&shard->mutex);
+	jsonpath_cache_entry_t* existing = shard_find(shard, jsonpath_begin, classical, hash);
+	jsonpath_cache_entry_t* garbage = existing ? ret : shard_insert(shard, ret);
+	mutex_unlock(&shard->mutex);
+	if (garbage) entry_destroy(garbage);
+	return existing ? existing : ret;
+}
+
+JANSSONPATH_EXPORT const jsonpath_t* jsonpath_cache_get(const jsonpath_cache_entry_t* entry) {
+	return entry->jsonpath;
+}
+
+void JANSSONPATH_EXPORT jsonpath_cache_release(jsonpath_cache_entry_t* entry) {
+	if (!entry) return;
+	if (!entry->cacheable) {
+		entry_destroy(entry);
+		return;
+	}
+	shard_t* shard = &shards[entry->hash % PATH_CACHE_SHARDS];
+	mutex_lock(&shard->mutex);
+	bool garbage = !--entry->refcount;
+	mutex_unlock(&shard->mutex);
+	if (garbage) entry_destroy(entry);
+}
+
+void JANSSONPATH_EXPORT jsonpath_cache_clear(void) {
+	size_t i;
+	for (i = 0; i < PATH_CACHE_SHARDS; ++i) {
+		shard_t* shard = &shards[i];
+		jsonpath_cache_entry_t* garbage = NULL;
+		mutex_lock(&shard->mutex);
+		while (shard->lru_head) {
+			jsonpath_cache_entry_t* entry = shard_remove(shard, shard->lru_head);
+			if (entry) {
+				entry->bucket_next = garbage;
+				garbage = entry;
+			}
+		}
+		mutex_unlock(&shard->mutex);
+		while (garbage) {
+			jsonpath_cache_entry_t* next = garbage->bucket_next;
+			entry_destroy(garbage);
+			garbage = next;
+		}
+	}
+}
@@ -0,0 +1,172 @@
+#include <string.h>
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+#include "private/jsonpath_ast.h"
+#include "private/evaluate_impl.h"
+#include "private/arena.h"
+
+// jsonpaths evaluated against one document together. leading .name, [n], .* and ..name steps of paths starting from
+// $(or the outermost @, which is the same) form a trie, so a step shared by several paths is taken once. the rest
+// of each path, from its first other index on, is applied to the node where it leaves the trie. paths not starting
+// from $ are evaluated by themselves.
+
+typedef struct plan_step_t {
+	size_t parent; // steps[0] is $ itself, parents always come before children
+	path_index_tag_t tag; // INDEX_SUB_SIMPLE or INDEX_DOT_RECURSIVE
+	json_t* simple_index;
+} plan_step_t;
+
+typedef struct plan_path_t {
+	const jsonpath_t* jsonpath;
+	bool is_rooted; // evaluated by itself if not
+	size_t step; // where the path leaves the trie
+	size_t rest; // first index not in the trie
+} plan_path_t;
+
+struct jsonpath_plan_t {
+	plan_step_t* steps;
+	size_t step_size;
+	plan_path_t* paths;
+	size_t path_size;
+};
+
+typedef struct plan_builder_t {
+	arena_t arena;
+	plan_step_t* steps;
+	size_t step_size;
+	size_t step_capacity;
+	bool failed;
+} plan_builder_t;
+
+static bool is_trie_index(const path_index_t* index) {
+	return index->tag == INDEX_SUB_SIMPLE || index->tag == INDEX_DOT_RECURSIVE;
+}
+
+// child of parent taking index, added if there isn't one yet
+static size_t find_step(plan_builder_t* builder, size_t parent, const path_index_t* index) {
+	size_t i;
+	for (i = parent + 1; i < builder->step_size; ++i) {
+		const plan_step_t* step = &builder->steps[i];
+		if (step->parent != parent || step->tag != index->tag) continue;
+		if (step->simple_index == index->simple_index) return i;
+		if (step->simple_index && index->simple_index && json_equal(step->simple_index, index->simple_index)) return i;
+	}
+	if (builder->step_size + 1 > builder->step_capacity) {
+		size_t capacity = builder->step_capacity * 2;
+		plan_step_t* steps = arena_alloc(&builder->arena, sizeof(plan_step_t) * capacity);
+		if (!steps) {
+			builder->failed = true;
+			return parent;
+		}
+		memcpy(steps, builder->steps, sizeof(plan_step_t) * builder->step_size);
+		builder->steps = steps;
+		builder->step_capacity = capacity;
+	}
+	plan_step_t step = { parent, index->tag, index->simple_index };
+	builder->steps[builder->step_size] = step;
+	return builder->step_size++;
+}
+
+JANSSONPATH_EXPORT jsonpath_plan_t* jsonpath_plan_compile(const jsonpath_t* const* jsonpaths, size_t size) {
+	plan_builder_t builder;
+	memset(&builder, 0, sizeof(builder));
+	arena_init(&builder.arena);
+	builder.step_capacity = 16;
+	builder.steps = arena_alloc(&builder.arena, sizeof(plan_step_t) * builder.step_capacity);
+	plan_path_t* paths = arena_alloc(&builder.arena, sizeof(plan_path_t) * (size ? size : 1));
+	builder.failed = !builder.steps || !paths;
+	if (!builder.failed) {
+		plan_step_t root = { 0, INDEX_SUB_SIMPLE, NULL };
+		builder.steps[builder.step_size++] = root;
+	}
+
+	size_t i;
+	for (i = 0; i < size && !builder.failed; ++i) {
+		const jsonpath_t* jsonpath = jsonpaths[i];
+		plan_path_t* path = &paths[i];
+		path->jsonpath = jsonpath;
+		path->is_rooted = jsonpath->tag == JSON_INDEX && jsonpath->indexes.root_node->tag == JSON_SINGLE &&
+			(jsonpath->indexes.root_node->single.tag == SINGLE_ROOT || jsonpath->indexes.root_node->single.tag == SINGLE_CURR);
+		path->step = 0;
+		path->rest = 0;
+		if (!path->is_rooted) continue;
+		const path_indexes_t* indexes = &jsonpath->indexes;
+		for (; path->rest < indexes->size && is_trie_index(&indexes->indexes[path->rest]); ++path->rest) {
+			path->step = find_step(&builder, path->step, &indexes->indexes[path->rest]);
+		}
+	}
+
+	jsonpath_plan_t* ret = NULL;
+	if (!builder.failed) {
+		size_t step_offset = ARENA_ALIGN(sizeof(jsonpath_plan_t));
+		size_t path_offset = step_offset + ARENA_ALIGN(sizeof(plan_step_t) * builder.step_size);
+		ret = do_malloc(path_offset + sizeof(plan_path_t) * size);
+	}
+	if (ret) {
+		ret->steps = (plan_step_t*)((char*)ret + ARENA_ALIGN(sizeof(jsonpath_plan_t)));
+		ret->step_size = builder.step_size;
+		ret->paths = (plan_path_t*)((char*)ret->steps + ARENA_ALIGN(sizeof(plan_step_t) * builder.step_size));
+		ret->path_size = size;
+		memcpy(ret->steps, builder.steps, sizeof(plan_step_t) * builder.step_size);
+		if (size) memcpy(ret->paths, paths, sizeof(plan_path_t) * size);
+		for (i = 1; i < ret->step_size; ++i) json_incref(ret->steps[i].simple_index);
+	}
+	arena_release(&builder.arena);
+	return ret;
+}
+
+void JANSSONPATH_EXPORT jsonpath_plan_release(jsonpath_plan_t* plan) {
+	if (!plan) return;
+	size_t i;
+	for (i = 1; i < plan->step_size; ++i) json_decref(plan->steps[i].simple_index);
+	do_free(plan);
+}
+
+#define LOCAL_STEPS 32
+
+void JANSSONPATH_EXPORT jsonpath_plan_evaluate(json_t* root, const jsonpath_plan_t* plan, jsonpath_symbol_lookup_t* symbols, jsonpath_result_t* results, jsonpath_error_t* errors) {
+	result_t local_steps[LOCAL_STEPS];
+	result_t* steps = plan->step_size > LOCAL_STEPS ? do_malloc(sizeof(result_t) * plan->step_size) : local_steps;
+	size_t i;
+	if (!steps) {
+		// one by one then
+		for (i = 0; i < plan->path_size; ++i) results[i] = jsonpath_evaluate(root, plan->paths[i].jsonpath, symbols, &errors[i]);
+		return;
+	}
+
+	// simple indexes never fail
+	jsonpath_error_t error = jsonpath_error_ok;
+	steps[0] = make_result_borrow(root, false, false);
+	for (i = 1; i < plan->step_size; ++i) {
+		const plan_step_t* step = &plan->steps[i];
+		path_index_t index;
+		index.tag = step->tag;
+		index.simple_index = step->simple_index;
+		steps[i] = evaluate_path_index(root, steps[step->parent], index, symbols, &error);
+	}
+
+	for (i = 0; i < plan->path_size; ++i) {
+		const plan_path_t* path = &plan->paths[i];
+		if (!path->is_rooted) {
+			results[i] = jsonpath_evaluate(root, path->jsonpath, symbols, &errors[i]);
+			continue;
+		}
+		errors[i] = jsonpath_error_ok;
+		result_t ret = result_incref(steps[path->step]);
+		const path_indexes_t* indexes = &path->jsonpath->indexes;
+		size_t rest;
+		for (rest = path->rest; rest < indexes->size; ++rest) {
+			result_t next = evaluate_path_index(root, ret, indexes->indexes[rest], symbols, &errors[i]);
+			result_decref(ret);
+			ret = next;
+			if (errors[i].abort) break;
+		}
+		results[i] = result_export(ret);
+	}
+
+	for (i = 0; i < plan->step_size; ++i) result_decref(steps[i]);
+	if (steps != local_steps) do_free(steps);
+}
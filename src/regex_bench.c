@@ -0,0 +1,90 @@
+#include "janssonpath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Time =~ over a large array of strings, with a pattern known at compile time
+// and with one read from the document, by both engines.
+// usage: regex_bench [string_count [repeat]]
+// build once with JANSSONPATH_REGEX_JIT ON and once OFF to see what JIT gives.
+
+#ifdef JANSSONPATH_SUPPORT_REGEX
+static const char* expressions[] = {
+	"$.items[?(@ =~ \"^item-[0-9]*7-[a-f]+$\")]",
+	"$.items[?(@ =~ $.pattern)]",
+	"$.items[?(@ =~ \"(ab|cd)+e\")]",
+};
+
+static json_t* make_document(size_t count) {
+	json_t* items = json_array();
+	char buffer[64];
+	size_t i;
+	srand(1);
+	for (i = 0; i < count; ++i) {
+		snprintf(buffer, sizeof(buffer), "item-%lu-%x%s", (unsigned long)i, (unsigned)rand(), i % 5 ? "" : "abcdabe");
+		json_array_append_new(items, json_string(buffer));
+	}
+	json_t* ret = json_object();
+	json_object_set_new(ret, "items", items);
+	json_object_set_new(ret, "pattern", json_string("^item-[0-9]*7-[a-f]+$"));
+	return ret;
+}
+
+static double elapsed_ms(clock_t begin) {
+	return (double)(clock() - begin) * 1000.0 / CLOCKS_PER_SEC;
+}
+#endif
+
+int main(int argc, char** argv) {
+#ifndef JANSSONPATH_SUPPORT_REGEX
+	(void)argc;
+	(void)argv;
+	printf("built without regular expression support\n");
+	return 0;
+#else
+	size_t count = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 200000;
+	int repeat = argc > 2 ? atoi(argv[2]) : 5;
+	json_t* document = make_document(count);
+	size_t i;
+#ifdef JANSSONPATH_REGEX_JIT
+	const char* jit = "on";
+#else
+	const char* jit = "off";
+#endif
+	printf("engine %d, jit %s, %lu strings, best of %d\n", JANSSONPATH_REGEX_ENGINE, jit, (unsigned long)count, repeat);
+
+	for (i = 0; i < sizeof(expressions) / sizeof(*expressions); ++i) {
+		jsonpath_error_t error;
+		jsonpath_t* path = jsonpath_compile(expressions[i], &error);
+		if (!path) {
+			printf("%s: does not compile: %s\n", expressions[i], error.reason);
+			continue;
+		}
+		jsonpath_bytecode_t* bytecode = jsonpath_bytecode_compile(path);
+		double best_tree = -1, best_bytecode = -1;
+		size_t matched = 0;
+		int r;
+		for (r = 0; r < repeat; ++r) {
+			clock_t begin = clock();
+			jsonpath_result_t result = jsonpath_evaluate(document, path, NULL, &error);
+			double ms = elapsed_ms(begin);
+			if (best_tree < 0 || ms < best_tree) best_tree = ms;
+			matched = json_is_array(result.value) ? json_array_size(result.value) : 0;
+			jsonpath_decref(result);
+
+			if (!bytecode) continue;
+			begin = clock();
+			result = jsonpath_evaluate_bytecode(document, bytecode, NULL, &error);
+			ms = elapsed_ms(begin);
+			if (best_bytecode < 0 || ms < best_bytecode) best_bytecode = ms;
+			jsonpath_decref(result);
+		}
+		printf("%-48s %8lu matched  tree %9.3f ms  bytecode %9.3f ms\n", expressions[i], (unsigned long)matched, best_tree, best_bytecode);
+		jsonpath_bytecode_release(bytecode);
+		jsonpath_release(path);
+	}
+	json_decref(document);
+	return 0;
+#endif
+}
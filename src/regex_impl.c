@@ -1,18 +1,24 @@
 #include "private/regex_impl.h"
+#include "private/thread.h"
 #include <stdint.h>
 
 #if JANSSONPATH_REGEX_ENGINE == ENGINE_system_regex
 JANSSONPATH_NO_EXPORT jansson_regex_t* regex_compile(const char* pattern,
                                                      jsonpath_error_t* error) {
-    static char error_msg[1024];
-        jansson_regex_t ret=do_malloc(sizeof(jansson_regex_t);
-	int error_code = regcomp(ret, pattern, REG_EXTENDED| REG_NOSUB);
-	if (error_code) {
+    static JSONPATH_THREAD_LOCAL char error_msg[1024];
+    jansson_regex_t* ret = do_malloc(sizeof(jansson_regex_t));
+    if (!ret) {
+        *error = jsonpath_error_unknown;
+        return NULL;
+    }
+    int error_code = regcomp(ret, pattern, REG_EXTENDED | REG_NOSUB);
+    if (error_code) {
         regerror(error_code, ret, error_msg, 1024);
         *error = jsonpath_error_regex_compile_error(error_code, error_msg);
+        do_free(ret);
         return NULL;
-	}
-	return ret;
+    }
+    return ret;
 }
 
 JANSSONPATH_NO_EXPORT void regex_free(jansson_regex_t* regex) {
@@ -20,14 +26,12 @@ JANSSONPATH_NO_EXPORT void regex_free(jansson_regex_t* regex) {
     do_free(regex);
 }
 
-#define regex_match(subject, regex) (!regexec((regex), (subject), 0, NULL, 0))
-
 #elif JANSSONPATH_REGEX_ENGINE == ENGINE_PCRE2
 JANSSONPATH_NO_EXPORT jansson_regex_t* regex_compile(const char* pattern,
                                                      jsonpath_error_t* error) {
     size_t offset;
     int error_code;
-    static char error_msg[1024];
+    static JSONPATH_THREAD_LOCAL char error_msg[1024];
     jansson_regex_t* ret =
         pcre2_compile((PCRE2_SPTR8)pattern, PCRE2_ZERO_TERMINATED,
                       PCRE2_UTF | PCRE2_NO_AUTO_CAPTURE | PCRE2_EXTENDED,
@@ -38,17 +42,103 @@ JANSSONPATH_NO_EXPORT jansson_regex_t* regex_compile(const char* pattern,
         *error = jsonpath_error_regex_compile_error(error_code, error_msg);
         return NULL;
     }
+#ifdef JANSSONPATH_REGEX_JIT
+    // if JIT is not available on this platform pcre2_match keeps using the
+    // interpreter, so failure is not an error
+    pcre2_jit_compile(ret, PCRE2_JIT_COMPLETE);
+#endif
     return ret;
 }
 
+// what pcre2_match needs besides the pattern. it's created at the first match
+// of a thread and reused by every match after on the thread, rather than
+// created and freed for each string matched.
+typedef struct match_scratch_t {
+    pcre2_match_data* match_data;  // no capture, so one pair for the whole match
+#ifdef JANSSONPATH_REGEX_JIT
+    // JIT code runs on a 32K machine stack by default, which is too small for
+    // some patterns on long subjects
+    pcre2_match_context* match_context;
+    pcre2_jit_stack* jit_stack;
+#endif
+} match_scratch_t;
+
+#ifdef JANSSONPATH_REGEX_JIT
+#define JIT_STACK_START (32 * 1024)
+#define JIT_STACK_MAX (512 * 1024)
+#endif
+
+static jsonpath_mutex_t scratch_mutex = JSONPATH_MUTEX_INITIALIZER;
+static bool scratch_key_created;
+static jsonpath_tls_key_t scratch_key;  // only to release scratch at thread exit
+static JSONPATH_THREAD_LOCAL match_scratch_t* thread_scratch;
+
+static void JSONPATH_TLS_CALLBACK scratch_free(void* p) {
+    match_scratch_t* scratch = p;
+    if (!scratch) return;
+    if (scratch->match_data) pcre2_match_data_free(scratch->match_data);
+#ifdef JANSSONPATH_REGEX_JIT
+    if (scratch->match_context) pcre2_match_context_free(scratch->match_context);
+    if (scratch->jit_stack) pcre2_jit_stack_free(scratch->jit_stack);
+#endif
+    do_free(scratch);
+    thread_scratch = NULL;
+}
+
+static match_scratch_t* scratch_new(void) {
+    match_scratch_t* ret = do_malloc(sizeof(match_scratch_t));
+    if (!ret) return NULL;
+    ret->match_data = pcre2_match_data_create(1, NULL);
+#ifdef JANSSONPATH_REGEX_JIT
+    ret->match_context = pcre2_match_context_create(NULL);
+    ret->jit_stack = pcre2_jit_stack_create(JIT_STACK_START, JIT_STACK_MAX, NULL);
+    if (ret->match_context && ret->jit_stack)
+        pcre2_jit_stack_assign(ret->match_context, NULL, ret->jit_stack);
+    if (!ret->match_context || !ret->jit_stack) {
+        scratch_free(ret);
+        return NULL;
+    }
+#endif
+    if (!ret->match_data) {
+        scratch_free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+static match_scratch_t* get_scratch(void) {
+    if (thread_scratch) return thread_scratch;
+    mutex_lock(&scratch_mutex);
+    if (!scratch_key_created)
+        scratch_key_created = tls_key_create(&scratch_key, scratch_free);
+    bool key_created = scratch_key_created;
+    mutex_unlock(&scratch_mutex);
+    // without the key it could never be released, so the caller does without
+    if (!key_created) return NULL;
+    match_scratch_t* scratch = scratch_new();
+    if (!scratch) return NULL;
+    if (!tls_set(scratch_key, scratch)) {
+        scratch_free(scratch);
+        return NULL;
+    }
+    return thread_scratch = scratch;
+}
+
 JANSSONPATH_NO_EXPORT bool regex_match(const char* subject,
                                        jansson_regex_t* regex) {
-    pcre2_match_data* match_data = pcre2_match_data_create(16, NULL);
+    match_scratch_t* scratch = get_scratch();
+    pcre2_match_data* match_data =
+        scratch ? scratch->match_data : pcre2_match_data_create(1, NULL);
+    if (!match_data) return false;
+    pcre2_match_context* match_context = NULL;
+#ifdef JANSSONPATH_REGEX_JIT
+    if (scratch) match_context = scratch->match_context;
+#endif
     int n = pcre2_match(regex, (PCRE2_SPTR8)subject, PCRE2_ZERO_TERMINATED, 0,
-                        0, match_data, NULL);
-    pcre2_match_data_free(match_data);
-    assert(n != 0);   // do not use capature!
-    assert(n >= -1);  // -1 for no match
+                        0, match_data, match_context);
+    if (!scratch) pcre2_match_data_free(match_data);
+    assert(n != 0);  // do not use capature!
+    // -1 for no match, and errors like exceeding the JIT stack are no match either
     return n > 0;
 }
 
@@ -73,6 +163,146 @@ JANSSONPATH_NO_EXPORT bool regex_match(const char* subject,
 	return ret>=1;
 }
 
+#endif
 
 
-#endif
+struct jsonpath_regex_t {
+    jansson_regex_t* compiled;
+    size_t refcount;  // guarded by cache_mutex, the cache holds one
+    char* pattern;
+    size_t hash;
+    bool cached;
+    // most recently used first
+    jsonpath_regex_t* lru_prev;
+    jsonpath_regex_t* lru_next;
+    jsonpath_regex_t* bucket_next;
+};
+
+#define REGEX_CACHE_BUCKETS (JANSSONPATH_REGEX_CACHE_SIZE * 2 + 1)
+
+static jsonpath_mutex_t cache_mutex = JSONPATH_MUTEX_INITIALIZER;
+static jsonpath_regex_t* cache_buckets[REGEX_CACHE_BUCKETS];
+static jsonpath_regex_t* lru_head;
+static jsonpath_regex_t* lru_tail;
+static size_t cache_size;
+
+// FNV-1a
+static size_t pattern_hash(const char* pattern) {
+    size_t ret = 2166136261u;
+    for (; *pattern; ++pattern) ret = (ret ^ (unsigned char)*pattern) * 16777619u;
+    return ret;
+}
+
+static void regex_destroy(jsonpath_regex_t* regex) {
+    regex_free(regex->compiled);
+    do_free(regex->pattern);
+    do_free(regex);
+}
+
+static void lru_unlink(jsonpath_regex_t* regex) {
+    if (regex->lru_prev) regex->lru_prev->lru_next = regex->lru_next;
+    else lru_head = regex->lru_next;
+    if (regex->lru_next) regex->lru_next->lru_prev = regex->lru_prev;
+    else lru_tail = regex->lru_prev;
+}
+
+static void lru_push_front(jsonpath_regex_t* regex) {
+    regex->lru_prev = NULL;
+    regex->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = regex;
+    else lru_tail = regex;
+    lru_head = regex;
+}
+
+// with cache_mutex held
+static jsonpath_regex_t* cache_find(const char* pattern, size_t hash) {
+    jsonpath_regex_t* regex = cache_buckets[hash % REGEX_CACHE_BUCKETS];
+    for (; regex; regex = regex->bucket_next) {
+        if (regex->hash == hash && !strcmp(regex->pattern, pattern)) {
+            if (regex != lru_head) {
+                lru_unlink(regex);
+                lru_push_front(regex);
+            }
+            ++regex->refcount;
+            return regex;
+        }
+    }
+    return NULL;
+}
+
+// with cache_mutex held. returns the least recently used pattern evicted, if
+// nobody else refers to it, to be freed out of the lock.
+static jsonpath_regex_t* cache_insert(jsonpath_regex_t* regex) {
+    if (!JANSSONPATH_REGEX_CACHE_SIZE) return NULL;
+    jsonpath_regex_t** bucket = &cache_buckets[regex->hash % REGEX_CACHE_BUCKETS];
+    regex->bucket_next = *bucket;
+    *bucket = regex;
+    regex->cached = true;
+    ++regex->refcount;
+    lru_push_front(regex);
+    if (++cache_size <= JANSSONPATH_REGEX_CACHE_SIZE) return NULL;
+
+    jsonpath_regex_t* evicted = lru_tail;
+    lru_unlink(evicted);
+    for (bucket = &cache_buckets[evicted->hash % REGEX_CACHE_BUCKETS]; *bucket != evicted; bucket = &(*bucket)->bucket_next) {}
+    *bucket = evicted->bucket_next;
+    evicted->cached = false;
+    --cache_size;
+    return --evicted->refcount ? NULL : evicted;
+}
+
+JANSSONPATH_NO_EXPORT jsonpath_regex_t* regex_acquire(const char* pattern,
+                                                     jsonpath_error_t* error) {
+    size_t hash = pattern_hash(pattern);
+    mutex_lock(&cache_mutex);
+    jsonpath_regex_t* ret = cache_find(pattern, hash);
+    mutex_unlock(&cache_mutex);
+    if (ret) return ret;
+
+    // compile out of the lock, other threads may compile the same pattern meanwhile
+    jansson_regex_t* compiled = regex_compile(pattern, error);
+    if (error->abort) return NULL;
+    size_t length = strlen(pattern);
+    ret = do_malloc(sizeof(jsonpath_regex_t));
+    char* pattern_copy = do_malloc(length + 1);
+    if (!ret || !pattern_copy) {
+        if (ret) do_free(ret);
+        if (pattern_copy) do_free(pattern_copy);
+        regex_free(compiled);
+        *error = jsonpath_error_unknown;
+        return NULL;
+    }
+    memcpy(pattern_copy, pattern, length + 1);
+    ret->compiled = compiled;
+    ret->refcount = 1;
+    ret->pattern = pattern_copy;
+    ret->hash = hash;
+    ret->cached = false;
+
+    mutex_lock(&cache_mutex);
+    jsonpath_regex_t* existing = cache_find(pattern, hash);
+    jsonpath_regex_t* garbage = existing ? ret : cache_insert(ret);
+    mutex_unlock(&cache_mutex);
+    if (garbage) regex_destroy(garbage);
+    return existing ? existing : ret;
+}
+
+JANSSONPATH_NO_EXPORT jsonpath_regex_t* regex_incref(jsonpath_regex_t* regex) {
+    mutex_lock(&cache_mutex);
+    ++regex->refcount;
+    mutex_unlock(&cache_mutex);
+    return regex;
+}
+
+void JANSSONPATH_NO_EXPORT regex_release(jsonpath_regex_t* regex) {
+    if (!regex) return;
+    mutex_lock(&cache_mutex);
+    bool garbage = !--regex->refcount;
+    mutex_unlock(&cache_mutex);
+    if (garbage) regex_destroy(regex);
+}
+
+JANSSONPATH_NO_EXPORT bool regex_test(const char* subject,
+                                      const jsonpath_regex_t* regex) {
+    return regex_match(subject, regex->compiled);
+}
@@ -0,0 +1,834 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "jansson.h"
+#include "janssonpath_evaluate.h"
+#include "private/common.h"
+#include "private/error.h"
+#include "private/jansson_memory.h"
+#include "private/jsonpath_ast.h"
+#include "private/evaluate_impl.h"
+#include "private/thread.h"
+#include "private/arena.h"
+
+// jsonpath matched against json text while it's read. the leading indexes of the path(up to the first filter) are
+// matched as values begin: each value being read has the set of leading indexes it has matched so far, as a bit mask,
+// worked out from its parent's set and its own key or position. a value matching all of them is built as json_t, and
+// so is every child of a value reaching the filter, which is then tested, and the rest of the path applied to it by
+// the tree walker. values nothing can match any more are skipped, checking only that brackets are balanced and
+// strings terminated.
+// the tree walker gives matches of ..name grouped by the node the name is looked up in, in document order of those
+// nodes, rather than in document order of the matches. matches are sorted by that node and then by their own
+// position at the end, which is the order of the tree walker for at most one .. before the filter.
+
+#define MAX_STREAMED_STEPS 63
+#define MAX_DEPTH 2048 // the same as jansson
+#define STREAM_BUFFER_SIZE 65536
+#define NONE ((size_t)-1)
+
+typedef struct stream_step_t {
+	path_index_tag_t tag; // INDEX_SUB_SIMPLE, INDEX_DOT_RECURSIVE or INDEX_SUB_RANGE
+	json_t* simple_index; // borrowed from the jsonpath. for ranges and [n] range below is used instead
+	json_int_t range[2]; // inclusive, [n] is [n:n]
+} stream_step_t;
+
+struct jsonpath_stream_t {
+	const path_index_t* indexes;
+	size_t size;
+	stream_step_t* steps; // indexes matched while reading
+	size_t streamed;
+	size_t recursive; // the .. step, NONE if there's none
+	bool is_collection;
+	bool is_right_value;
+	// the first index making a collection, if it's a range. it makes a collection only for a json array.
+	size_t range_base;
+};
+
+static bool refers_root(const jsonpath_t* jsonpath);
+
+static bool index_refers_root(const path_index_t* index) {
+	switch (index->tag) {
+	case INDEX_SUB_EXP:
+	case INDEX_FILTER:
+		return refers_root(index->expression);
+	case INDEX_SUB_RANGE:
+		return refers_root(index->range[0]) || refers_root(index->range[1]);
+	default:
+		return false;
+	}
+}
+
+static bool refers_root(const jsonpath_t* jsonpath) {
+	if (!jsonpath) return false;
+	size_t i;
+	switch (jsonpath->tag) {
+	case JSON_SINGLE:
+		return jsonpath->single.tag == SINGLE_ROOT;
+	case JSON_INDEX:
+		if (refers_root(jsonpath->indexes.root_node)) return true;
+		for (i = 0; i < jsonpath->indexes.size; ++i) {
+			if (index_refers_root(&jsonpath->indexes.indexes[i])) return true;
+		}
+		return false;
+	case JSON_UNARY:
+		return refers_root(jsonpath->unary.node);
+	case JSON_BINARY: {
+		// walk down the left side with a loop, so that long chains don't recurse
+		const jsonpath_t* node;
+		for (node = jsonpath; node->tag == JSON_BINARY; node = node->binary.lhs) {
+			if (refers_root(node->binary.rhs)) return true;
+		}
+		return refers_root(node);
+	}
+	case JSON_ARBITRAY:
+		for (i = 0; i < jsonpath->arbitrary.size; ++i) {
+			if (refers_root(jsonpath->arbitrary.nodes[i])) return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+static bool is_constant_bound(const jsonpath_t* bound) {
+	return !bound || (bound->tag == JSON_SINGLE && bound->single.tag == SINGLE_CONST);
+}
+
+static json_int_t index_value(const json_t* number) {
+	return json_is_integer(number) ? json_integer_value(number) : (json_int_t)json_real_value(number);
+}
+
+// [(constant)] is the same as the simple index
+static path_index_t simplified(const path_index_t* index) {
+	path_index_t ret = *index;
+	if (index->tag == INDEX_SUB_EXP && is_constant_bound(index->expression)) {
+		ret.tag = INDEX_SUB_SIMPLE;
+		ret.simple_index = index->expression->single.constant;
+	}
+	return ret;
+}
+
+// why index can't be matched while reading, NULL if it can
+static const char* check_streamed(const path_index_t* index, stream_step_t* step) {
+	step->tag = index->tag;
+	step->simple_index = index->simple_index;
+	switch (index->tag) {
+	case INDEX_SUB_SIMPLE:
+		if (json_is_null(index->simple_index)) return "# can't be streamed before a filter";
+		if (json_is_number(index->simple_index)) {
+			step->range[0] = step->range[1] = index_value(index->simple_index);
+			if (step->range[0] < 0) return "indexes counting back from the end of an array can't be streamed";
+			return NULL;
+		}
+		if (index->simple_index && !json_is_string(index->simple_index)) return "unsupported index";
+		return NULL;
+	case INDEX_DOT_RECURSIVE:
+		if (index->simple_index && !json_is_string(index->simple_index)) return "only ..name and ..* can be streamed";
+		return NULL;
+	case INDEX_SUB_RANGE: {
+		size_t i;
+		for (i = 0; i < 2; ++i) {
+			const jsonpath_t* bound = index->range[i];
+			if (!is_constant_bound(bound) || (bound && !json_is_number(bound->single.constant)))
+				return "bounds of ranges streamed must be numbers";
+			step->range[i] = !bound ? (i ? LLONG_MAX : 0) : index_value(bound->single.constant);
+			if (step->range[i] < 0) return "indexes counting back from the end of an array can't be streamed";
+		}
+		return NULL;
+	}
+	default:
+		return "[()] can't be streamed";
+	}
+}
+
+// why index after the filter can't be applied to each element kept, NULL if it can
+static const char* check_rest(const path_index_t* index) {
+	switch (index->tag) {
+	case INDEX_SUB_EXP:
+		if (!is_constant_bound(index->expression)) return "[()] can't be streamed";
+		return NULL;
+	case INDEX_SUB_RANGE:
+		if (!is_constant_bound(index->range[0]) || !is_constant_bound(index->range[1]))
+			return "bounds of ranges after a filter must be constants";
+		return NULL;
+	case INDEX_FILTER:
+		if (refers_root(index->expression)) return "filters referring to $ can't be streamed";
+		return NULL;
+	default:
+		return NULL;
+	}
+}
+
+static bool makes_collection(const path_index_t* index) {
+	return (index->tag == INDEX_SUB_SIMPLE && !index->simple_index) || index->tag == INDEX_DOT_RECURSIVE || index->tag == INDEX_SUB_RANGE
+		|| index->tag == INDEX_FILTER;
+}
+
+JANSSONPATH_EXPORT jsonpath_stream_t* jsonpath_stream_compile(const jsonpath_t* jsonpath, jsonpath_error_t* error) {
+	const jsonpath_t* root = jsonpath;
+	const path_index_t* indexes = NULL;
+	size_t size = 0, streamed, i;
+	*error = jsonpath_error_ok;
+	if (jsonpath->tag == JSON_INDEX) {
+		root = jsonpath->indexes.root_node;
+		indexes = jsonpath->indexes.indexes;
+		size = jsonpath->indexes.size;
+	}
+	if (root->tag != JSON_SINGLE || (root->single.tag != SINGLE_ROOT && root->single.tag != SINGLE_CURR)) {
+		*error = jsonpath_error_not_streamable("only paths from $ can be streamed");
+		return NULL;
+	}
+	for (streamed = 0; streamed < size && indexes[streamed].tag != INDEX_FILTER; ++streamed) {}
+	if (streamed > MAX_STREAMED_STEPS) {
+		*error = jsonpath_error_not_streamable("too many indexes before the filter to stream");
+		return NULL;
+	}
+
+	jsonpath_stream_t* ret = do_malloc(ARENA_ALIGN(sizeof(jsonpath_stream_t)) + sizeof(stream_step_t) * streamed);
+	if (!ret) {
+		*error = jsonpath_error_unknown;
+		return NULL;
+	}
+	ret->indexes = indexes;
+	ret->size = size;
+	ret->steps = (stream_step_t*)((char*)ret + ARENA_ALIGN(sizeof(jsonpath_stream_t)));
+	ret->streamed = streamed;
+	ret->recursive = NONE;
+	const char* reason = NULL;
+	for (i = 0; i < size && !reason; ++i) {
+		if (i >= streamed) {
+			reason = check_rest(&indexes[i]);
+			continue;
+		}
+		path_index_t index = simplified(&indexes[i]);
+		reason = check_streamed(&index, &ret->steps[i]);
+		if (indexes[i].tag != INDEX_DOT_RECURSIVE) continue;
+		if (ret->recursive != NONE) reason = "only one .. can be streamed before the filter";
+		ret->recursive = i;
+	}
+	if (reason) {
+		do_free(ret);
+		*error = jsonpath_error_not_streamable(reason);
+		return NULL;
+	}
+
+	for (i = 0; i < size && !makes_collection(&indexes[i]); ++i) {}
+	ret->is_collection = i < size;
+	// .* gives a collection of children, and indexes mapped over a collection give right values
+	ret->is_right_value = ret->is_collection && !(i + 1 == size && indexes[i].tag == INDEX_SUB_SIMPLE);
+	ret->range_base = i < size && indexes[i].tag == INDEX_SUB_RANGE ? i : NONE;
+	return ret;
+}
+
+void JANSSONPATH_EXPORT jsonpath_stream_release(jsonpath_stream_t* stream) {
+	do_free(stream);
+}
+
+typedef struct reader_t {
+	const char* pos;
+	const char* end;
+	const char* begin; // of text in hand
+	size_t offset; // of begin in the whole text
+	char* buffer; // for the callback
+	json_load_callback_t callback; // NULL at the end of text
+	void* data;
+	bool failed;
+} reader_t;
+
+static bool refill(reader_t* reader) {
+	if (!reader->callback) return false;
+	size_t size = reader->callback(reader->buffer, STREAM_BUFFER_SIZE, reader->data);
+	if (size == (size_t)-1) reader->failed = true;
+	if (size == (size_t)-1 || !size) {
+		reader->callback = NULL;
+		return false;
+	}
+	reader->offset += (size_t)(reader->end - reader->begin);
+	reader->pos = reader->begin = reader->buffer;
+	reader->end = reader->buffer + size;
+	return true;
+}
+
+// the next byte, -1 at the end of text
+static int peek(reader_t* reader) {
+	if (reader->pos == reader->end && !refill(reader)) return -1;
+	return (unsigned char)*reader->pos;
+}
+
+static int next(reader_t* reader) {
+	int ret = peek(reader);
+	if (ret >= 0) ++reader->pos;
+	return ret;
+}
+
+static int next_nonspace(reader_t* reader) {
+	int c;
+	while ((c = next(reader)) == ' ' || c == '\t' || c == '\n' || c == '\r') {}
+	return c;
+}
+
+typedef struct frame_t {
+	uint64_t states; // bit k is set if the value has matched the first k streamed indexes
+	bool visited; // visited by the .. index: the node it's applied to, or a descendant of that
+	bool candidate; // a child of a value the filter is applied to
+	bool building;
+	bool is_object;
+	size_t ordinal; // position of the value in document order, among values not skipped
+	size_t index; // children read so far
+	size_t key; // for a value of an object being built, offset of its key in keys
+	json_t* value; // container being built
+} frame_t;
+
+typedef struct match_t {
+	json_t* value;
+	size_t visit; // ordinal of the node .. looked it up in, 0 if there's no ..
+	size_t ordinal;
+	size_t sequence;
+} match_t;
+
+typedef struct state_t {
+	const jsonpath_stream_t* stream;
+	jsonpath_symbol_lookup_t* symbols;
+	jsonpath_error_t* error;
+	reader_t reader;
+	frame_t* frames; // containers open, not including those skipped
+	size_t depth;
+	size_t frame_capacity;
+	char* scratch; // text of the string or number being read
+	size_t scratch_size;
+	size_t scratch_capacity;
+	char* keys; // keys of values being built, Null-terminated one after another
+	size_t key_size;
+	size_t key_capacity;
+	match_t* matches;
+	size_t match_size;
+	size_t match_capacity;
+	size_t ordinal;
+	bool range_base_is_array;
+} state_t;
+
+static JSONPATH_THREAD_LOCAL char error_reason[128];
+
+static bool fail(state_t* state, const char* reason) {
+	if (state->error->abort) return false;
+	if (state->reader.failed) {
+		*state->error = jsonpath_error_read_failed;
+		return false;
+	}
+	size_t offset = state->reader.offset + (size_t)(state->reader.pos - state->reader.begin);
+	snprintf(error_reason, sizeof(error_reason), "%s at byte %lu", reason, (unsigned long)offset);
+	*state->error = jsonpath_error_malformed_json(error_reason);
+	return false;
+}
+
+static bool out_of_memory(state_t* state) {
+	*state->error = jsonpath_error_unknown;
+	return false;
+}
+
+// room for needed more elements
+static bool reserve(void** buffer, size_t size, size_t* capacity, size_t element_size, size_t needed) {
+	if (size + needed <= *capacity) return true;
+	size_t new_capacity = *capacity ? *capacity * 2 : 64;
+	while (new_capacity < size + needed) new_capacity *= 2;
+	void* new_buffer = do_malloc(new_capacity * element_size);
+	if (!new_buffer) return false;
+	if (size) memcpy(new_buffer, *buffer, size * element_size);
+	if (*buffer) do_free(*buffer);
+	*buffer = new_buffer;
+	*capacity = new_capacity;
+	return true;
+}
+
+static bool append_scratch(state_t* state, const char* text, size_t size) {
+	if (!reserve((void**)&state->scratch, state->scratch_size, &state->scratch_capacity, 1, size + 1)) return out_of_memory(state);
+	memcpy(state->scratch + state->scratch_size, text, size);
+	state->scratch_size += size;
+	state->scratch[state->scratch_size] = '\0';
+	return true;
+}
+
+static int hex_value(int c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static long read_hex4(reader_t* reader) {
+	long ret = 0;
+	int i;
+	for (i = 0; i < 4; ++i) {
+		int digit = hex_value(next(reader));
+		if (digit < 0) return -1;
+		ret = ret * 16 + digit;
+	}
+	return ret;
+}
+
+// \u escape after the backslash and u, appended to scratch as utf-8 if decode
+static bool read_unicode_escape(state_t* state, bool decode) {
+	reader_t* reader = &state->reader;
+	long code = read_hex4(reader);
+	if (code < 0) return fail(state, "invalid escape");
+	if (code >= 0xd800 && code <= 0xdbff) {
+		if (next(reader) != '\\' || next(reader) != 'u') return fail(state, "invalid unicode surrogate pair");
+		long low = read_hex4(reader);
+		if (low < 0xdc00 || low > 0xdfff) return fail(state, "invalid unicode surrogate pair");
+		code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+	} else if (code >= 0xdc00 && code <= 0xdfff) {
+		return fail(state, "invalid unicode surrogate pair");
+	} else if (!code) {
+		return fail(state, "\\u0000 is not allowed");
+	}
+	if (!decode) return true;
+	char utf8[4];
+	size_t size;
+	if (code < 0x80) {
+		utf8[0] = (char)code;
+		size = 1;
+	} else if (code < 0x800) {
+		utf8[0] = (char)(0xc0 | (code >> 6));
+		utf8[1] = (char)(0x80 | (code & 0x3f));
+		size = 2;
+	} else if (code < 0x10000) {
+		utf8[0] = (char)(0xe0 | (code >> 12));
+		utf8[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+		utf8[2] = (char)(0x80 | (code & 0x3f));
+		size = 3;
+	} else {
+		utf8[0] = (char)(0xf0 | (code >> 18));
+		utf8[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+		utf8[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+		utf8[3] = (char)(0x80 | (code & 0x3f));
+		size = 4;
+	}
+	return append_scratch(state, utf8, size);
+}
+
+// string after its opening quote, into scratch if decode
+static bool read_string(state_t* state, bool decode) {
+	reader_t* reader = &state->reader;
+	if (decode) state->scratch_size = 0;
+	for (;;) {
+		const char* p = reader->pos;
+		while (p < reader->end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) ++p;
+		if (decode && p != reader->pos && !append_scratch(state, reader->pos, (size_t)(p - reader->pos))) return false;
+		reader->pos = p;
+		if (p == reader->end) {
+			if (peek(reader) < 0) return fail(state, "premature end of input");
+			continue;
+		}
+		int c = next(reader);
+		if (c == '"') return !decode || append_scratch(state, "", 0);
+		if (c < 0) return fail(state, "premature end of input");
+		if (c != '\\') return fail(state, "control character in string");
+		char escaped;
+		switch (c = next(reader)) {
+		case '"': case '\\': case '/': escaped = (char)c; break;
+		case 'b': escaped = '\b'; break;
+		case 'f': escaped = '\f'; break;
+		case 'n': escaped = '\n'; break;
+		case 'r': escaped = '\r'; break;
+		case 't': escaped = '\t'; break;
+		case 'u':
+			if (!read_unicode_escape(state, decode)) return false;
+			continue;
+		default:
+			return fail(state, "invalid escape");
+		}
+		if (decode && !append_scratch(state, &escaped, 1)) return false;
+	}
+}
+
+static bool is_digit(int c) {
+	return c >= '0' && c <= '9';
+}
+
+// one byte of a number, into scratch if decode
+static bool take(state_t* state, bool decode) {
+	char c = *state->reader.pos++;
+	return !decode || append_scratch(state, &c, 1);
+}
+
+// digits, at least one
+static bool read_digits(state_t* state, bool decode) {
+	if (!is_digit(peek(&state->reader))) return fail(state, "invalid number");
+	while (is_digit(peek(&state->reader))) {
+		if (!take(state, decode)) return false;
+	}
+	return true;
+}
+
+// number whose first byte first is read already, into a json_t if decode
+static bool read_number(state_t* state, int first, bool decode, json_t** value) {
+	reader_t* reader = &state->reader;
+	bool is_real = false;
+	char c = (char)first;
+	state->scratch_size = 0;
+	if (decode && !append_scratch(state, &c, 1)) return false;
+	if (first == '-') {
+		if (!is_digit(peek(reader))) return fail(state, "invalid number");
+		first = peek(reader);
+		if (!take(state, decode)) return false;
+	}
+	if (first != '0') {
+		while (is_digit(peek(reader))) {
+			if (!take(state, decode)) return false;
+		}
+	} else if (is_digit(peek(reader))) {
+		return fail(state, "invalid number");
+	}
+	if (peek(reader) == '.') {
+		is_real = true;
+		if (!take(state, decode) || !read_digits(state, decode)) return false;
+	}
+	if (peek(reader) == 'e' || peek(reader) == 'E') {
+		is_real = true;
+		if (!take(state, decode)) return false;
+		if ((peek(reader) == '+' || peek(reader) == '-') && !take(state, decode)) return false;
+		if (!read_digits(state, decode)) return false;
+	}
+	if (!decode) return true;
+
+	errno = 0;
+	if (!is_real) {
+		json_int_t integer = strtoll(state->scratch, NULL, 10);
+		if (errno == ERANGE) return fail(state, integer < 0 ? "too big negative integer" : "too big integer");
+		*value = json_integer(integer);
+	} else {
+		double real = strtod(state->scratch, NULL);
+		if (errno == ERANGE && (real == HUGE_VAL || real == -HUGE_VAL)) return fail(state, "real number overflow");
+		*value = json_real(real);
+	}
+	return *value || out_of_memory(state);
+}
+
+static bool read_literal(state_t* state, const char* rest) {
+	for (; *rest; ++rest) {
+		if (next(&state->reader) != *rest) return fail(state, "invalid token");
+	}
+	return true;
+}
+
+// value whose first byte is read, which nothing matches
+static bool skip_value(state_t* state, int first) {
+	reader_t* reader = &state->reader;
+	char kinds[MAX_DEPTH];
+	size_t depth = 0;
+	switch (first) {
+	case '"': return read_string(state, false);
+	case 't': return read_literal(state, "rue");
+	case 'f': return read_literal(state, "alse");
+	case 'n': return read_literal(state, "ull");
+	case '[': case '{': break;
+	default:
+		if (first == '-' || is_digit(first)) return read_number(state, first, false, NULL);
+		return fail(state, first < 0 ? "premature end of input" : "invalid token");
+	}
+	kinds[depth++] = (char)first;
+	while (depth) {
+		const char* p = reader->pos;
+		while (p < reader->end && *p != '"' && *p != '[' && *p != ']' && *p != '{' && *p != '}') ++p;
+		reader->pos = p;
+		if (p == reader->end) {
+			if (peek(reader) < 0) return fail(state, "premature end of input");
+			continue;
+		}
+		switch (*reader->pos++) {
+		case '"':
+			if (!read_string(state, false)) return false;
+			break;
+		case '[':
+		case '{':
+			if (state->depth + depth >= MAX_DEPTH) return fail(state, "maximum parsing depth reached");
+			kinds[depth++] = reader->pos[-1];
+			break;
+		default:
+			if (kinds[depth - 1] != (reader->pos[-1] == ']' ? '[' : '{')) return fail(state, "unmatched bracket");
+			--depth;
+		}
+	}
+	return true;
+}
+
+static bool step_matches(const stream_step_t* step, const frame_t* parent, const char* key, size_t key_size, size_t index) {
+	if (step->tag == INDEX_DOT_RECURSIVE) return false;
+	if (step->tag == INDEX_SUB_SIMPLE && !step->simple_index) return true;
+	if (step->tag == INDEX_SUB_SIMPLE && json_is_string(step->simple_index)) {
+		return parent->is_object && json_string_length(step->simple_index) == key_size && !memcmp(json_string_value(step->simple_index), key, key_size);
+	}
+	return !parent->is_object && (json_int_t)index >= step->range[0] && (json_int_t)index <= step->range[1];
+}
+
+// what a child of parent stored under key(or at index of an array) has matched
+static frame_t child_of(const state_t* state, const frame_t* parent, const char* key, size_t key_size, size_t index) {
+	const jsonpath_stream_t* stream = state->stream;
+	frame_t ret;
+	memset(&ret, 0, sizeof(ret));
+	ret.building = parent->building;
+	if (!parent->states && !parent->visited) return ret;
+	size_t k;
+	for (k = 0; k < stream->streamed; ++k) {
+		if ((parent->states >> k & 1) && step_matches(&stream->steps[k], parent, key, key_size, index)) ret.states |= (uint64_t)1 << (k + 1);
+	}
+	ret.visited = parent->visited || (stream->recursive != NONE && (parent->states >> stream->recursive & 1));
+	if (ret.visited) {
+		json_t* name = stream->steps[stream->recursive].simple_index;
+		if (!name || (parent->is_object && json_string_length(name) == key_size && !memcmp(json_string_value(name), key, key_size)))
+			ret.states |= (uint64_t)1 << (stream->recursive + 1);
+	}
+	ret.candidate = stream->streamed < stream->size && (parent->states >> stream->streamed & 1);
+	ret.building = ret.building || ret.candidate || (stream->streamed == stream->size && (ret.states >> stream->streamed & 1));
+	return ret;
+}
+
+// ordinal of the node .. looked up the value in, which is ancestors levels above a value at depth
+static size_t visit_of(const state_t* state, size_t depth, size_t ancestors) {
+	const jsonpath_stream_t* stream = state->stream;
+	if (stream->recursive == NONE) return 0;
+	return state->frames[depth - ancestors - (stream->streamed - stream->recursive)].ordinal;
+}
+
+// value is taken
+static bool add_match(state_t* state, json_t* value, size_t visit, size_t ordinal) {
+	if (!value) return true;
+	if (!reserve((void**)&state->matches, state->match_size, &state->match_capacity, sizeof(match_t), 1)) {
+		json_decref(value);
+		return out_of_memory(state);
+	}
+	match_t match = { value, visit, ordinal, state->match_size };
+	state->matches[state->match_size++] = match;
+	return true;
+}
+
+// the filter and indexes after it applied to a child of a value the filter is applied to
+static bool test_candidate(state_t* state, json_t* value, size_t visit, size_t ordinal) {
+	const jsonpath_stream_t* stream = state->stream;
+	jsonpath_error_t* error = state->error;
+	result_t ret = make_result_collection(collection_new(1), true, false);
+	collection_anchor_value(ret.collection, json_incref(value));
+	result_t cond = evaluate_condition(value, value, stream->indexes[stream->streamed].expression, state->symbols, error);
+	if (error->abort || !filter_accumulate(&ret, value, cond, error)) {
+		result_decref(ret);
+		return false;
+	}
+	size_t i;
+	for (i = stream->streamed + 1; i < stream->size && ret.collection->size; ++i) {
+		result_t next_ret = evaluate_path_index(value, ret, stream->indexes[i], state->symbols, error);
+		result_decref(ret);
+		if (error->abort) return false;
+		ret = next_ret;
+	}
+	bool ok = true;
+	for (i = 0; i < ret.collection->size && ok; ++i) ok = add_match(state, json_incref(ret.collection->items[i]), visit, ordinal);
+	result_decref(ret);
+	return ok;
+}
+
+// value read completely, at depth. value is taken, it's NULL unless built.
+static bool finish_value(state_t* state, const frame_t* frame, json_t* value) {
+	const jsonpath_stream_t* stream = state->stream;
+	size_t depth = state->depth;
+	bool ok = true;
+	if (stream->streamed == stream->size && (frame->states >> stream->streamed & 1))
+		ok = add_match(state, json_incref(value), visit_of(state, depth, 0), frame->ordinal);
+	if (ok && frame->candidate) ok = test_candidate(state, value, visit_of(state, depth, 1), frame->ordinal);
+	frame_t* parent = depth ? &state->frames[depth - 1] : NULL;
+	if (!ok || !parent || !parent->building) {
+		json_decref(value);
+		return ok;
+	}
+	if (parent->is_object) {
+		ok = !json_object_set_new(parent->value, state->keys + frame->key, value);
+		state->key_size = frame->key;
+	} else {
+		ok = !json_array_append_new(parent->value, value);
+	}
+	return ok || out_of_memory(state);
+}
+
+// value which has matched what frame tells
+static bool read_value(state_t* state, frame_t* frame) {
+	reader_t* reader = &state->reader;
+	int c = next_nonspace(reader);
+	if (!frame->states && !frame->visited && !frame->building) return skip_value(state, c);
+	frame->ordinal = state->ordinal++;
+	json_t* value = NULL;
+	switch (c) {
+	case '{': case '[':
+		if (state->depth >= MAX_DEPTH) return fail(state, "maximum parsing depth reached");
+		if (!reserve((void**)&state->frames, state->depth, &state->frame_capacity, sizeof(frame_t), 1)) return out_of_memory(state);
+		frame->is_object = c == '{';
+		frame->index = 0;
+		frame->value = !frame->building ? NULL : frame->is_object ? json_object() : json_array();
+		if (frame->building && !frame->value) return out_of_memory(state);
+		if (state->stream->range_base != NONE && (frame->states >> state->stream->range_base & 1) && !frame->is_object)
+			state->range_base_is_array = true;
+		state->frames[state->depth++] = *frame;
+		return true;
+	case '"':
+		if (!read_string(state, frame->building)) return false;
+		if (frame->building && !(value = json_stringn(state->scratch, state->scratch_size))) return fail(state, "invalid utf-8 string");
+		break;
+	case 't':
+		if (!read_literal(state, "rue")) return false;
+		value = frame->building ? json_true() : NULL;
+		break;
+	case 'f':
+		if (!read_literal(state, "alse")) return false;
+		value = frame->building ? json_false() : NULL;
+		break;
+	case 'n':
+		if (!read_literal(state, "ull")) return false;
+		value = frame->building ? json_null() : NULL;
+		break;
+	default:
+		if (c != '-' && !is_digit(c)) return fail(state, c < 0 ? "premature end of input" : "invalid token");
+		if (!read_number(state, c, frame->building, &value)) return false;
+	}
+	return finish_value(state, frame, value);
+}
+
+static bool read_document(state_t* state) {
+	reader_t* reader = &state->reader;
+	frame_t root;
+	memset(&root, 0, sizeof(root));
+	root.states = 1;
+	root.building = state->stream->size == 0;
+	if (!read_value(state, &root)) return false;
+	while (state->depth) {
+		frame_t* top = &state->frames[state->depth - 1];
+		int c = next_nonspace(reader);
+		if (c == (top->is_object ? '}' : ']')) {
+			frame_t frame = *top;
+			--state->depth;
+			if (!finish_value(state, &frame, frame.value)) return false;
+			continue;
+		}
+		if (top->index) {
+			if (c != ',') return fail(state, top->is_object ? "expecting , or }" : "expecting , or ]");
+			c = next_nonspace(reader);
+		}
+		frame_t child;
+		if (top->is_object) {
+			if (c != '"') return fail(state, "expecting a key");
+			if (!read_string(state, true)) return false;
+			if (next_nonspace(reader) != ':') return fail(state, "expecting :");
+			child = child_of(state, top, state->scratch, state->scratch_size, 0);
+			if (top->building) {
+				if (memchr(state->scratch, '\0', state->scratch_size)) return fail(state, "\\u0000 is not allowed in keys");
+				child.key = state->key_size;
+				if (!reserve((void**)&state->keys, state->key_size, &state->key_capacity, 1, state->scratch_size + 1)) return out_of_memory(state);
+				memcpy(state->keys + state->key_size, state->scratch, state->scratch_size + 1);
+				state->key_size += state->scratch_size + 1;
+			}
+		} else {
+			reader->pos -= c >= 0; // the first byte of the element
+			child = child_of(state, top, NULL, 0, top->index);
+		}
+		++top->index;
+		if (!read_value(state, &child)) return false;
+	}
+	if (next_nonspace(reader) >= 0) return fail(state, "end of file expected");
+	return !reader->failed || fail(state, "");
+}
+
+static int compare_match(const void* lhs, const void* rhs) {
+	const match_t* l = lhs;
+	const match_t* r = rhs;
+	if (l->visit != r->visit) return l->visit < r->visit ? -1 : 1;
+	if (l->ordinal != r->ordinal) return l->ordinal < r->ordinal ? -1 : 1;
+	return l->sequence < r->sequence ? -1 : l->sequence > r->sequence;
+}
+
+static jsonpath_result_t evaluate(state_t* state) {
+	const jsonpath_stream_t* stream = state->stream;
+	jsonpath_result_t ret = { NULL, false, false, false };
+	size_t i;
+	*state->error = jsonpath_error_ok;
+	if (read_document(state)) {
+		if (!stream->is_collection || (stream->range_base != NONE && !state->range_base_is_array)) {
+			// a repeated name is the last one, as in jansson
+			if (state->match_size) ret.value = json_incref(state->matches[state->match_size - 1].value);
+		} else {
+			ret.is_collection = true;
+			ret.is_right_value = stream->is_right_value;
+			if (state->match_size) qsort(state->matches, state->match_size, sizeof(match_t), compare_match);
+			ret.value = json_array();
+			for (i = 0; i < state->match_size && ret.value; ++i) {
+				if (json_array_append(ret.value, state->matches[i].value)) {
+					json_decref(ret.value);
+					ret.value = NULL;
+				}
+			}
+			if (!ret.value) {
+				*state->error = jsonpath_error_unknown;
+				ret.is_collection = ret.is_right_value = false;
+			}
+		}
+	}
+
+	for (i = 0; i < state->match_size; ++i) json_decref(state->matches[i].value);
+	for (i = 0; i < state->depth; ++i) json_decref(state->frames[i].value);
+	do_free(state->matches);
+	do_free(state->frames);
+	do_free(state->scratch);
+	do_free(state->keys);
+	return ret;
+}
+
+static void init_state(state_t* state, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	memset(state, 0, sizeof(*state));
+	state->stream = stream;
+	state->symbols = symbols;
+	state->error = error;
+	*error = jsonpath_error_ok;
+}
+
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_stream_evaluate_buffer(const char* buffer, size_t size, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	state_t state;
+	init_state(&state, stream, symbols, error);
+	state.reader.pos = state.reader.begin = buffer;
+	state.reader.end = buffer + size;
+	return evaluate(&state);
+}
+
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_stream_evaluate_callback(json_load_callback_t callback, void* data, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	jsonpath_result_t ret = { NULL, false, false, false };
+	state_t state;
+	init_state(&state, stream, symbols, error);
+	state.reader.buffer = do_malloc(STREAM_BUFFER_SIZE);
+	if (!state.reader.buffer) {
+		*error = jsonpath_error_unknown;
+		return ret;
+	}
+	state.reader.pos = state.reader.begin = state.reader.end = state.reader.buffer;
+	state.reader.callback = callback;
+	state.reader.data = data;
+	ret = evaluate(&state);
+	do_free(state.reader.buffer);
+	return ret;
+}
+
+static size_t read_fd(void* buffer, size_t size, void* data) {
+	int fd = *(int*)data;
+#ifdef _WIN32
+	int ret = _read(fd, buffer, (unsigned)size);
+#else
+	ssize_t ret;
+	while ((ret = read(fd, buffer, size)) < 0 && errno == EINTR) {}
+#endif
+	return ret < 0 ? (size_t)-1 : (size_t)ret;
+}
+
+JANSSONPATH_EXPORT jsonpath_result_t jsonpath_stream_evaluate_fd(int fd, const jsonpath_stream_t* stream, jsonpath_symbol_lookup_t* symbols, jsonpath_error_t* error) {
+	return jsonpath_stream_evaluate_callback(read_fd, &fd, stream, symbols, error);
+}
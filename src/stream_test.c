@@ -0,0 +1,297 @@
+#include "janssonpath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Evaluate every expression on json text with the streaming engine, given
+// all at once, in small pieces and from a file, and check it agrees with the
+// tree walker on the loaded document. then check jsonpaths which can't be
+// streamed and malformed text are rejected.
+// usage: stream_test                      built-in document and expressions
+//        stream_test json_file path...    expressions on the file
+
+static const char document[] =
+    "{\"store\":{\"book\":[{\"category\":\"reference\",\"author\":\"Nigel Rees\",\"title\":\"Sayings of the Century\",\"price\":8.95},"
+    "{\"category\":\"fiction\",\"author\":\"Evelyn Waugh\",\"title\":\"Sword of Honour\",\"price\":12.99},"
+    "{\"category\":\"fiction\",\"author\":\"Herman Melville\",\"title\":\"Moby Dick\",\"isbn\":\"0-553-21311-3\",\"price\":8.99},"
+    "{\"category\":\"fiction\",\"author\":\"J. R. R. Tolkien\",\"title\":\"The Lord of the Rings\",\"isbn\":\"0-395-19395-8\",\"price\":22.99}],"
+    "\"bicycle\":{\"color\":\"red\",\"price\":19.95},\"nums\":[1,2,3,4,5],\"count\":3,\"flags\":[true,false]},"
+    " \"price\" : -1.5e2, \"nested\": {\"price\": {\"price\": [0, {\"price\": null}]}, \"a\": [[], {}, [[\"deep\"]]]},"
+    " \"escaped\\u0041\": \"\\u00e9\\ud83d\\ude00\\n\\\"\\/\", \"big\": 9007199254740993, \"zero\": 0, \"neg\": -0.0}";
+
+static const char* expressions[] = {
+    "$",
+    "$.store.book[0].title",
+    "$.store.book[2]",
+    "$.store.book[*].author",
+    "$.store.book.*.price",
+    "$.store.*",
+    "$.store.book[1:2].title",
+    "$.store.book[2:].title",
+    "$.store.book[:1]",
+    "$.store.nums[0:0]",
+    "$..price",
+    "$..*",
+    "$.nested..price",
+    "$..book[*].title",
+    "$..book[1]",
+    "$.store..color",
+    "$.nested.a[2][0][0]",
+    "$.nested.a.*",
+    "$.escapedA",
+    "$[\"escapedA\"]",
+    "$.big",
+    "$.zero",
+    "$.neg",
+    "$.nonexist",
+    "$.nonexist.deeper",
+    "$.nonexist[0:1]",
+    "$.nonexist.*",
+    "$.store.bicycle[0:1]",
+    "$.store.count[0:1]",
+    "$.store.count.*",
+    "$.store.book[0].title.*",
+    "$.store.book[?(@.price > 10)].title",
+    "$.store.book[?(@.isbn)]",
+    "$.store.book[?(@.price < 10 && @.category == \"fiction\")].author",
+    "$.store.nums[?(@ % 2 == 1)]",
+    "$.store[?(@.color)]",
+    "$.store.bicycle[?(@ == \"red\")]",
+    "$..book[?(@.price > 10)].title",
+    "$..book[?(@.price > 10)]..price",
+    "$.store.book[?(@.price > 10)][\"title\"]",
+    "$.store.book[?(@.price > 10)].*[0:1]",
+    "$.store.book[?(@.price)].#",
+    "$.store.book[?(@.price > 10)][?(@ == \"fiction\")]",
+    "$.store.book[?(@.price > 100)].title",
+    "$.store.book[?(@.price > $.store.count)]",
+    "$.store.book[?(@.price > 10)][(@.#)]",
+    "$.store.book[-1].title",
+    "$.store.nums[1:-1]",
+    "$..book..price",
+    "$.store.book[(1)]",
+    "1 + $.store.count",
+    "$.store.book[?(@.price > 10)][$.zero:1]",
+};
+
+#define EXPRESSION_N (sizeof(expressions) / sizeof(expressions[0]))
+
+static const char* malformed[] = {
+    "",
+    "{",
+    "{\"a\":1,}",
+    "[1 2]",
+    "{\"a\" 1}",
+    "[01]",
+    "[1.]",
+    "[-]",
+    "[tru]",
+    "\"a",
+    "\"\\x\"",
+    "\"\\ud800\"",
+    "{\"a\":[}]}",
+    "{\"store\":{\"x\":[}]}",
+    "[1]]",
+    "[1] 2",
+    "\"\\u0000\"",
+};
+
+// values skipped are not converted, so these are found only in values built
+static const char* malformed_built[] = {
+    "[99999999999999999999]",
+    "{\"store\":{\"x\":-1e999}}",
+};
+
+#define MALFORMED_N (sizeof(malformed) / sizeof(malformed[0]))
+#define MALFORMED_BUILT_N (sizeof(malformed_built) / sizeof(malformed_built[0]))
+
+static bool same_result(jsonpath_result_t lhs, jsonpath_error_t lhs_error,
+                        jsonpath_result_t rhs, jsonpath_error_t rhs_error) {
+    if (lhs_error.abort != rhs_error.abort || lhs_error.code != rhs_error.code)
+        return false;
+    if (lhs_error.abort) return true;
+    if (lhs.is_collection != rhs.is_collection ||
+        lhs.is_right_value != rhs.is_right_value ||
+        lhs.is_constant != rhs.is_constant)
+        return false;
+    if (!lhs.value || !rhs.value) return lhs.value == rhs.value;
+    return json_equal(lhs.value, rhs.value);
+}
+
+static int compare(const char* test_path, const char* name,
+                   jsonpath_result_t expected, jsonpath_error_t expected_error,
+                   jsonpath_result_t result, jsonpath_error_t error) {
+    if (same_result(expected, expected_error, result, error)) return 0;
+    char* expected_out =
+        expected.value
+            ? json_dumps(expected.value, JSON_COMPACT | JSON_ENCODE_ANY)
+            : NULL;
+    char* out = result.value
+                    ? json_dumps(result.value, JSON_COMPACT | JSON_ENCODE_ANY)
+                    : NULL;
+    printf("mismatch: %s\n", test_path);
+    printf("  tree:     code %llx [%d%d%d] %s\n", expected_error.code,
+           expected.is_collection, expected.is_right_value,
+           expected.is_constant, expected_out ? expected_out : "(null)");
+    printf("  %-9s code %llx [%d%d%d] %s %s\n", name, error.code,
+           result.is_collection, result.is_right_value, result.is_constant,
+           out ? out : "(null)", error.abort ? error.reason : "");
+    free(expected_out);
+    free(out);
+    return 1;
+}
+
+#define release_result(result, error) \
+    do {                               \
+        if (!(error).abort) jsonpath_decref(result); \
+    } while (0)
+
+// hands text out a few bytes at a time, so that every token crosses the end
+// of a piece somewhere
+typedef struct pieces_t {
+    const char* text;
+    size_t size;
+    size_t offset;
+    size_t piece;
+} pieces_t;
+
+static size_t read_pieces(void* buffer, size_t size, void* data) {
+    pieces_t* pieces = data;
+    size_t n = pieces->size - pieces->offset;
+    if (n > pieces->piece) n = pieces->piece;
+    if (n > size) n = size;
+    memcpy(buffer, pieces->text + pieces->offset, n);
+    pieces->offset += n;
+    pieces->piece = pieces->piece % 7 + 1;
+    return n;
+}
+
+static size_t read_failing(void* buffer, size_t size, void* data) {
+    (void)buffer;
+    (void)size;
+    (void)data;
+    return (size_t)-1;
+}
+
+// returns 0 if agree, 1 if not. text is streamed from file if not given.
+static int test(json_t* json, const char* text, FILE* file,
+                const char* test_path) {
+    jsonpath_error_t error;
+    jsonpath_t* jsonpath = jsonpath_compile(test_path, &error);
+    if (error.abort) {
+        printf("failed to compile: %s (%s)\n", test_path, error.reason);
+        return 1;
+    }
+    jsonpath_stream_t* stream = jsonpath_stream_compile(jsonpath, &error);
+    if (!stream) {
+        printf("not streamed: %s (%s)\n", test_path, error.reason);
+        jsonpath_release(jsonpath);
+        return 0;
+    }
+
+    jsonpath_error_t tree_error, other_error;
+    jsonpath_result_t tree_result =
+        jsonpath_evaluate(json, jsonpath, NULL, &tree_error);
+    jsonpath_result_t other;
+    int ret = 0;
+    if (!text) {
+        rewind(file);
+        other = jsonpath_stream_evaluate_fd(fileno(file), stream, NULL,
+                                            &other_error);
+        ret |= compare(test_path, "fd:", tree_result, tree_error, other,
+                       other_error);
+        release_result(other, other_error);
+    } else {
+        other = jsonpath_stream_evaluate_buffer(text, strlen(text), stream,
+                                                NULL, &other_error);
+        ret |= compare(test_path, "buffer:", tree_result, tree_error, other,
+                       other_error);
+        release_result(other, other_error);
+        pieces_t pieces = {text, strlen(text), 0, 1};
+        other = jsonpath_stream_evaluate_callback(read_pieces, &pieces,
+                                                  stream, NULL, &other_error);
+        ret |= compare(test_path, "pieces:", tree_result, tree_error, other,
+                       other_error);
+        release_result(other, other_error);
+    }
+
+    release_result(tree_result, tree_error);
+    jsonpath_stream_release(stream);
+    jsonpath_release(jsonpath);
+    return ret;
+}
+
+static int expect_malformed(const jsonpath_stream_t* stream,
+                            const char* text) {
+    jsonpath_error_t error;
+    jsonpath_result_t result = jsonpath_stream_evaluate_buffer(
+        text, strlen(text), stream, NULL, &error);
+    if (error.abort && error.code == 0x700000002ull) return 0;
+    printf("accepted malformed: %s\n", text);
+    release_result(result, error);
+    return 1;
+}
+
+// the text can't be read, or is not json. returns 0 if rejected.
+static int test_malformed(void) {
+    jsonpath_error_t error;
+    jsonpath_t* jsonpath = jsonpath_compile("$.store.x", &error);
+    jsonpath_stream_t* stream = jsonpath_stream_compile(jsonpath, &error);
+    int ret = 0;
+    size_t i;
+    for (i = 0; i < MALFORMED_N; ++i)
+        ret |= expect_malformed(stream, malformed[i]);
+    jsonpath_stream_release(stream);
+    jsonpath_release(jsonpath);
+    // everything built
+    jsonpath = jsonpath_compile("$", &error);
+    stream = jsonpath_stream_compile(jsonpath, &error);
+    for (i = 0; i < MALFORMED_N; ++i)
+        ret |= expect_malformed(stream, malformed[i]);
+    for (i = 0; i < MALFORMED_BUILT_N; ++i)
+        ret |= expect_malformed(stream, malformed_built[i]);
+    jsonpath_stream_evaluate_callback(read_failing, NULL, stream, NULL,
+                                      &error);
+    if (!error.abort || error.code != 0x700000003ull) {
+        printf("read error not reported\n");
+        ret = 1;
+    }
+    jsonpath_stream_release(stream);
+    jsonpath_release(jsonpath);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    json_error_t error;
+    json_t* json;
+    size_t tested = 0, mismatch = 0;
+    if (argc < 2) {
+        json = json_loads(document, JSON_DECODE_ANY, &error);
+        if (!json) {
+            printf("failed to load the document: %s\n", error.text);
+            return -1;
+        }
+        size_t i;
+        for (i = 0; i < EXPRESSION_N; ++i, ++tested)
+            mismatch += test(json, document, NULL, expressions[i]);
+        ++tested;
+        mismatch += test_malformed();
+    } else {
+        json = json_load_file(argv[1], JSON_DECODE_ANY | JSON_ALLOW_NUL,
+                              &error);
+        FILE* file = fopen(argv[1], "rb");
+        if (!json || !file) {
+            printf("failed to load %s: %s\n", argv[1], error.text);
+            return -1;
+        }
+        int i;
+        for (i = 2; i < argc; ++i, ++tested)
+            mismatch += test(json, NULL, file, argv[i]);
+        fclose(file);
+    }
+    printf("%lu tested, %lu mismatches\n", (unsigned long)tested,
+           (unsigned long)mismatch);
+    json_decref(json);
+    return mismatch ? 1 : 0;
+}